@@ -1,240 +1,3189 @@
 #include "AudioSystem.h"
+#include "ImaAdpcm.h"
 #include "SDL3/SDL.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
 #include <filesystem>
+#include <limits>
+#include <thread>
+
+// SoundManifest.h is generated by cmake/GenerateSoundManifest.cmake. A
+// project that copies AudioSystem.cpp without the generator gets an empty
+// manifest, so CacheAllSounds goes through Assets/Sounds instead.
+#if __has_include("SoundManifest.h")
+#include "SoundManifest.h"
+#else
+namespace SoundManifest
+{
+	inline constexpr std::array<std::string_view, 0> Names = {};
+}
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 SoundHandle SoundHandle::Invalid;
+SoundId SoundId::Invalid;
+AudioSystem* AudioSystem::sActiveSystem = nullptr;
+
+// Create the AudioSystem with specified number of channels
+// (Defaults to 8 channels)
+AudioSystem::AudioSystem(int numChannels)
+: AudioSystem(numChannels, SoundManifest::Names)
+{
+}
+
+// Create the AudioSystem with the sounds of a manifest registered first
+AudioSystem::AudioSystem(int numChannels, std::span<const std::string_view> manifest)
+{
+
+	Mix_OpenAudio(0, nullptr);
+	Mix_AllocateChannels(numChannels);
+	mChannels.resize(numChannels);
+	mChannelViews.resize(numChannels);
+	mChannelVolumes.resize(numChannels, MIX_MAX_VOLUME);
+	mChannelPans.resize(numChannels, 0.0f);
+	mHandleMap.reserve(numChannels);
+	ResetFreeChannels();
+
+	// A channel is only in the ring once at a time, so the callback never
+	// runs out of room
+	mFinishedRing = std::make_unique<int[]>(numChannels);
+	mFinishedFlags = std::make_unique<std::atomic<bool>[]>(numChannels);
+	sActiveSystem = this;
+	Mix_ChannelFinished(OnChannelFinished);
+
+	int frequency = 0;
+	SDL_AudioFormat format = SDL_AUDIO_UNKNOWN;
+	int outputChannels = 0;
+	if (Mix_QuerySpec(&frequency, &format, &outputChannels))
+	{
+		mFrameSize = static_cast<int>(SDL_AUDIO_BYTESIZE(format)) * outputChannels;
+		mBytesPerSecond = mFrameSize * frequency;
+	}
+
+	// Stream channels loop a quarter second of silence, which StreamEffect
+	// writes the stream over
+	mStreamSilence.assign(static_cast<size_t>(mBytesPerSecond / 4 / mFrameSize * mFrameSize),
+						  format == SDL_AUDIO_U8 ? 0x80 : 0);
+	mStreamCarrier.allocated = 0;
+	mStreamCarrier.abuf = mStreamSilence.data();
+	mStreamCarrier.alen = static_cast<Uint32>(mStreamSilence.size());
+
+	// Register the sounds from the manifest first, so with the build-time
+	// one their SoundIds match the SoundManifest::Sound values
+	mSoundIds.reserve(manifest.size());
+	for (std::string_view soundName : manifest)
+	{
+		RegisterSound(std::string(soundName));
+	}
+	mNumManifestSounds = manifest.size();
+}
+
+// Destroy the AudioSystem
+AudioSystem::~AudioSystem()
+{
+	// A newer AudioSystem may have taken over the callback
+	if (sActiveSystem == this)
+	{
+		Mix_ChannelFinished(nullptr);
+		sActiveSystem = nullptr;
+	}
+
+	// Sounds still queued for the loader thread are dropped, and any it
+	// already decoded are freed with the rest
+	if (mLoaderThread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mLoadMutex);
+			mStopLoader = true;
+		}
+		mLoadQueued.notify_one();
+		mLoaderThread.join();
+	}
+	if (!mDecodeWorkers.empty())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mDecodeMutex);
+			mStopDecode = true;
+		}
+		mDecodeStart.notify_all();
+		for (std::thread& worker : mDecodeWorkers)
+		{
+			worker.join();
+		}
+	}
+	for (SoundInfo* soundInfo : mLoadingSounds)
+	{
+		soundInfo->mChunk = soundInfo->mLoad.get();
+	}
+
+	for (auto& [s, m] : mSounds)
+	{
+		if (m.mChunk != nullptr)
+		{
+			ReleaseChunk(m);
+		}
+	}
+	mSounds.clear();
+	CloseSoundBank();
+	SetHotReload(false);
+	Mix_CloseAudio();
+}
+
+// Updates the status of all the active sounds every frame
+void AudioSystem::Update(float deltaTime)
+{
+	mTime += deltaTime;
+
+	// The software mixer plays the frame's audio, finishing channels just
+	// like SDL_mixer would
+	if (mSoftwareMixer)
+	{
+		MixSoftware(deltaTime);
+	}
+
+	// Swap in sounds whose files changed
+	if (mWatchFd != -1)
+	{
+		ReadSoundChanges();
+	}
+
+	// Start voices of any sounds the loader thread has finished
+	if (!mLoadingSounds.empty())
+	{
+		UpdateLoadingSounds();
+	}
+
+	// Only channels SDL_mixer reported as finished need to be looked at.
+	// Each one's slot is given back before its flag is cleared, so the
+	// callback can't queue it again into a slot that's still being read.
+	size_t numChannels = mChannels.size();
+	size_t tail = mFinishedTail.load(std::memory_order_acquire);
+	for (size_t head = mFinishedHead.load(std::memory_order_relaxed); head != tail;)
+	{
+		int channel = mFinishedRing[head % numChannels];
+		mFinishedHead.store(++head, std::memory_order_release);
+		mFinishedFlags[channel].store(false, std::memory_order_release);
+		ProcessFinishedChannel(channel);
+	}
+
+	if (!mVirtualVoices.empty())
+	{
+		UpdateVirtualVoices();
+	}
+
+	if (!mStreams.empty())
+	{
+		UpdateStreams();
+	}
+}
+
+// Registered with Mix_ChannelFinished. SDL_mixer calls this from the
+// audio thread (or from Mix_HaltChannel), so it only queues the channel
+// for the next Update. SDL_mixer's lock (or the software mixer's) keeps
+// calls from overlapping, and nothing here allocates.
+void AudioSystem::OnChannelFinished(int channel)
+{
+	AudioSystem* system = sActiveSystem;
+	if (system != nullptr &&
+		!system->mFinishedFlags[channel].exchange(true, std::memory_order_acq_rel))
+	{
+		size_t tail = system->mFinishedTail.load(std::memory_order_relaxed);
+		system->mFinishedRing[tail % system->mChannels.size()] = channel;
+		system->mFinishedTail.store(tail + 1, std::memory_order_release);
+	}
+}
+
+// Frees the channel and its handle if the channel isn't playing anymore
+void AudioSystem::ProcessFinishedChannel(int channel)
+{
+	// The channel may have been stopped by StopSound (and possibly reused)
+	// since it was queued, so check it's still an active, stopped channel
+	if (channel < 0 || channel >= static_cast<int>(mChannels.size()) ||
+		!mChannels[channel].IsValid() || IsChannelPlaying(channel))
+	{
+		return;
+	}
+
+	// A voice waiting on its sound to load hasn't been started yet
+	auto iter = mHandleMap.find(mChannels[channel]);
+	if (iter != mHandleMap.end() && iter->second.mChunk == nullptr)
+	{
+		return;
+	}
+	if (iter != mHandleMap.end())
+	{
+		UnbindVoice(iter->first, iter->second);
+		EraseVoice(iter);
+	}
+	FreeChannel(channel);
+}
+
+// Plays the sound with the specified name and loops if looping is true
+// Returns the SoundHandle which is used to perform any other actions on the
+// sound when active
+// NOTE: The soundName is without the "Assets/Sounds/" part of the file
+//       For example, pass in "ChompLoop.wav" rather than
+//       "Assets/Sounds/ChompLoop.wav".
+SoundHandle AudioSystem::PlaySound(const std::string& soundName, bool looping, int priority)
+{
+	SoundInfo* soundInfo = GetSoundInfo(soundName);
+	if (soundInfo == nullptr)
+	{
+		SDL_Log("[AudioSystem] PlaySound couldn't find sound for %s", soundName.c_str());
+		return SoundHandle::Invalid;
+	}
+
+	return PlayLoadedSound(soundInfo, looping, priority);
+}
+
+// Same as above, but for a sound from RegisterSound. Once the sound is
+// cached this doesn't allocate or hash anything.
+SoundHandle AudioSystem::PlaySound(SoundId sound, bool looping, int priority)
+{
+	if (!sound.IsValid() || sound.GetIndex() >= mSoundIds.size())
+	{
+		SDL_Log("[AudioSystem] PlaySound called with an unregistered SoundId");
+		return SoundHandle::Invalid;
+	}
+
+	SoundInfo* soundInfo = mSoundIds[sound.GetIndex()];
+	if (!LoadSound(*soundInfo))
+	{
+		return SoundHandle::Invalid;
+	}
+
+	return PlayLoadedSound(soundInfo, looping, priority);
+}
+
+// Plays a voice of a loaded (or loading) sound (shared by both PlaySound
+// overloads)
+SoundHandle AudioSystem::PlayLoadedSound(SoundInfo* soundInfo, bool looping, int priority)
+{
+	// The sound's policy may merge this into a voice that's already playing
+	SoundHandle soundHandle = MergeVoice(soundInfo, looping);
+	if (soundHandle.IsValid())
+	{
+		return soundHandle;
+	}
+
+	soundHandle = RegisterVoice(soundInfo, looping, priority);
+
+	//Play the sound (unless it started as virtual)
+	auto iter = mHandleMap.find(soundHandle);
+	if (iter != mHandleMap.end() && iter->second.mChannel != -1)
+	{
+		StartVoice(iter->second.mChannel, iter->second);
+	}
+
+	return soundHandle;
+}
+
+// Plays the sound by streaming it through a few small buffers
+SoundHandle AudioSystem::PlayStream(const std::string& soundName, bool looping, int priority)
+{
+	// A sound is only added to mSounds if it can be streamed
+	SoundInfo* soundInfo = FindSoundInfo(soundName);
+	bool isNew = soundInfo == nullptr;
+	if (isNew)
+	{
+		soundInfo = AddSoundInfo(soundName);
+	}
+	auto stream = std::make_unique<StreamInfo>();
+	stream->mIsLooping = looping;
+	const char* failure = nullptr;
+	int channel = -1;
+	if (!OpenStream(*stream, *soundInfo))
+	{
+		failure = "can't stream";
+	}
+	else if (!PrimeStream(*stream))
+	{
+		failure = "found no data in";
+	}
+	else if (mHandleMap.full())
+	{
+		failure = "has no handles left for";
+	}
+	else
+	{
+		channel = ClaimFreeChannel();
+		if (channel == -1)
+		{
+			channel = mVirtualVoicesEnabled ? DemoteVoice(priority) : StealChannel(soundInfo);
+		}
+		if (channel == -1)
+		{
+			failure = "couldn't find a free channel for";
+		}
+	}
+
+	if (failure != nullptr)
+	{
+		// Whatever failed, a sound that was only just added isn't kept
+		if (isNew)
+		{
+			RemoveSoundInfo(*soundInfo);
+		}
+		SDL_Log("[AudioSystem] PlayStream %s %s", failure, soundName.c_str());
+		return SoundHandle::Invalid;
+	}
+
+	HandleInfo handleInfo;
+	handleInfo.mSoundName = soundInfo->mName;
+	handleInfo.mSoundId = soundInfo->mId;
+	handleInfo.mChannel = channel;
+	handleInfo.mIsLooping = looping;
+	handleInfo.mChunk = &mStreamCarrier;
+	handleInfo.mPriority = priority;
+	handleInfo.mPlayOrder = mNextPlayOrder++;
+	handleInfo.mStartTime = mTime;
+	handleInfo.mSound = soundInfo;
+	handleInfo.mVolume = soundInfo->mPolicy.mVolume;
+
+	auto iter = mHandleMap.emplace(handleInfo);
+	soundInfo->mNumVoices++;
+	BindVoice(channel, iter->first, iter->second);
+	StartStream(channel, iter->second, std::move(stream));
+	return iter->first;
+}
+
+// Sizes the stream's buffers and fills as many as it can
+// Returns false if the stream has no data
+bool AudioSystem::PrimeStream(StreamInfo& stream)
+{
+	// Each buffer is a quarter second, rounded down to whole frames
+	size_t bufferSize = static_cast<size_t>(mBytesPerSecond / 4 / mFrameSize * mFrameSize);
+	for (std::vector<Uint8>& buffer : stream.mBuffers)
+	{
+		buffer.resize(bufferSize);
+	}
+	while (FillStreamBuffer(stream))
+	{
+	}
+	return stream.mNumFilled > 0;
+}
+
+// Plays the stream on the voice's channel, and hands it to UpdateStreams
+// to keep refilled
+void AudioSystem::StartStream(int channel, HandleInfo& info, std::unique_ptr<StreamInfo> stream)
+{
+	info.mStream = stream.get();
+	if (info.mDemotableIndex != NO_SLOT)
+	{
+		HeapRemove<&HandleInfo::mDemotableIndex, true>(mDemotableVoices, info);
+	}
+	stream->mHandle = mChannels[channel];
+	stream->mChannel = channel;
+	stream->mIndex = mStreams.size();
+	stream->mSilence = mStreamSilence.empty() ? 0 : mStreamSilence[0];
+
+	// The effect goes on before the pan, so SDL_mixer's panning effect
+	// comes after it. A stream with nothing filled is finished off by
+	// UpdateStreams.
+	PlayChannel(channel, &mStreamCarrier, -1);
+	RegisterEffect(channel, StreamEffect, stream.get());
+	SetChannelVolume(channel, info.mVolume);
+	SetChannelPan(channel, info.mPan);
+	if (info.mIsPaused)
+	{
+		PauseChannel(channel);
+	}
+	mStreams.emplace_back(std::move(stream));
+}
+
+// Finds where the PCM of the sound is for streaming
+bool AudioSystem::OpenStream(StreamInfo& stream, const SoundInfo& soundInfo)
+{
+	if (!soundInfo.mAdpcm.empty())
+	{
+		stream.mAdpcm = soundInfo.mAdpcm.data();
+		stream.mDataLength = soundInfo.mPcmLength;
+		return true;
+	}
+	if (const SoundBank::Entry* entry = FindBankEntry(soundInfo.mName))
+	{
+		stream.mBankData = mBankData + entry->mDataOffset;
+		stream.mDataLength = entry->mDataLength;
+		return true;
+	}
+
+	// Otherwise it has to be a PCM WAV file that's already in the mixer's
+	// format, since it's played as is
+	int frequency = 0;
+	SDL_AudioFormat format{};
+	int outputChannels = 0;
+	Mix_QuerySpec(&frequency, &format, &outputChannels);
+	uint16_t formatTag = SDL_AUDIO_ISFLOAT(format) ? 3 : 1;
+
+	stream.mFile.open(std::string(soundInfo.mPath), std::ios::binary);
+	uint8_t riff[12] = {};
+	if (!stream.mFile.read(reinterpret_cast<char*>(riff), sizeof(riff)) ||
+		std::memcmp(riff, "RIFF", 4) != 0 || std::memcmp(riff + 8, "WAVE", 4) != 0)
+	{
+		return false;
+	}
+
+	bool formatMatches = false;
+	uint8_t header[8] = {};
+	while (stream.mFile.read(reinterpret_cast<char*>(header), sizeof(header)))
+	{
+		uint32_t size = header[4] | (header[5] << 8) | (header[6] << 16) |
+						(static_cast<uint32_t>(header[7]) << 24);
+		if (std::memcmp(header, "fmt ", 4) == 0 && size >= 16)
+		{
+			uint8_t fmt[16] = {};
+			stream.mFile.read(reinterpret_cast<char*>(fmt), sizeof(fmt));
+			uint16_t tag = static_cast<uint16_t>(fmt[0] | (fmt[1] << 8));
+			uint16_t channels = static_cast<uint16_t>(fmt[2] | (fmt[3] << 8));
+			uint32_t rate = fmt[4] | (fmt[5] << 8) | (fmt[6] << 16) |
+							(static_cast<uint32_t>(fmt[7]) << 24);
+			uint16_t bits = static_cast<uint16_t>(fmt[14] | (fmt[15] << 8));
+			formatMatches = tag == formatTag && channels == outputChannels &&
+							rate == static_cast<uint32_t>(frequency) &&
+							bits == SDL_AUDIO_BITSIZE(format);
+			stream.mFile.seekg(size - 16 + (size & 1), std::ios::cur);
+		}
+		else if (std::memcmp(header, "data", 4) == 0)
+		{
+			stream.mDataOffset = static_cast<uint64_t>(stream.mFile.tellg());
+			stream.mDataLength = size - size % mFrameSize;
+			return formatMatches;
+		}
+		else
+		{
+			stream.mFile.seekg(size + (size & 1), std::ios::cur);
+		}
+	}
+	return false;
+}
+
+// Fills the next free buffer of the stream (wrapping around if it loops)
+// Returns false if the stream has ended or every buffer is full
+bool AudioSystem::FillStreamBuffer(StreamInfo& stream)
+{
+	// Acquire, so StreamEffect is done reading the buffer before it's
+	// written over
+	uint64_t numFilled = stream.mNumFilled.load(std::memory_order_relaxed);
+	if (numFilled - stream.mNumPlayed.load(std::memory_order_acquire) >= NUM_STREAM_BUFFERS)
+	{
+		return false;
+	}
+
+	size_t index = numFilled % NUM_STREAM_BUFFERS;
+	std::vector<Uint8>& buffer = stream.mBuffers[index];
+	size_t filled = 0;
+	while (filled < buffer.size() && !stream.mEnded)
+	{
+		size_t count = static_cast<size_t>(
+			std::min<uint64_t>(buffer.size() - filled, stream.mDataLength - stream.mReadPos));
+		if (stream.mAdpcm != nullptr)
+		{
+			count = ReadAdpcm(stream, buffer.data() + filled, count);
+		}
+		else if (stream.mBankData != nullptr)
+		{
+			std::memcpy(buffer.data() + filled, stream.mBankData + stream.mReadPos, count);
+		}
+		else if (!stream.mFile.read(reinterpret_cast<char*>(buffer.data() + filled),
+									static_cast<std::streamsize>(count)))
+		{
+			// The file got shorter since it was opened, so end it here
+			count = static_cast<size_t>(stream.mFile.gcount());
+			stream.mEnded = true;
+		}
+		filled += count;
+		stream.mReadPos += count;
+
+		// A loop carries on from the start in the same buffer, so there's
+		// no gap at the loop point
+		if (stream.mReadPos >= stream.mDataLength && !stream.mEnded)
+		{
+			if (stream.mIsLooping && stream.mDataLength > 0)
+			{
+				stream.mReadPos = 0;
+				if (stream.mFile.is_open())
+				{
+					stream.mFile.seekg(static_cast<std::streamoff>(stream.mDataOffset));
+				}
+			}
+			else
+			{
+				stream.mEnded = true;
+			}
+		}
+	}
+
+	if (filled == 0)
+	{
+		return false;
+	}
+	stream.mLengths[index] = filled;
+	stream.mNumFilled.store(numFilled + 1, std::memory_order_release);
+	return true;
+}
+
+// Copies up to count bytes of PCM from the stream's compressed sound,
+// decoding the block they're in if needed. Returns the bytes copied.
+size_t AudioSystem::ReadAdpcm(StreamInfo& stream, Uint8* dest, size_t count)
+{
+	int channels = mFrameSize / static_cast<int>(sizeof(int16_t));
+	uint64_t blockBytes = ImaAdpcm::FRAMES_PER_BLOCK * mFrameSize;
+	uint64_t blockIndex = stream.mReadPos / blockBytes;
+	if (blockIndex != stream.mBlockIndex)
+	{
+		stream.mBlock.resize(ImaAdpcm::FRAMES_PER_BLOCK * channels);
+		ImaAdpcm::DecodeBlock(stream.mAdpcm + blockIndex * ImaAdpcm::BlockSize(channels), channels,
+							  stream.mBlock.data());
+		stream.mBlockIndex = blockIndex;
+	}
+
+	uint64_t offset = stream.mReadPos - blockIndex * blockBytes;
+	count = static_cast<size_t>(std::min<uint64_t>(count, blockBytes - offset));
+	std::memcpy(dest, reinterpret_cast<const Uint8*>(stream.mBlock.data()) + offset, count);
+	return count;
+}
+
+// Refills the buffers of the streams that StreamEffect has played, and stops
+// the ones that have played all the way through
+void AudioSystem::UpdateStreams()
+{
+	for (size_t i = mStreams.size(); i-- > 0;)
+	{
+		StreamInfo& stream = *mStreams[i];
+		if (stream.mEnded && stream.mNumPlayed.load(std::memory_order_acquire) ==
+								 stream.mNumFilled.load(std::memory_order_relaxed))
+		{
+			// The channel loops the carrier, so it has to be stopped here
+			auto iter = mHandleMap.find(stream.mHandle);
+			int channel = stream.mChannel;
+			HaltChannel(channel);
+			UnbindVoice(iter->first, iter->second);
+			EraseVoice(iter);
+			FreeChannel(channel);
+			continue;
+		}
+
+		while (FillStreamBuffer(stream))
+		{
+		}
+	}
+}
+
+// Copies the next length bytes of the stream's ring into the channel's
+// audio, on the audio thread
+void AudioSystem::StreamEffect(int, void* data, int length, void* userData)
+{
+	StreamInfo& stream = *static_cast<StreamInfo*>(userData);
+	Uint8* dest = static_cast<Uint8*>(data);
+	size_t size = static_cast<size_t>(length);
+	size_t done = 0;
+	uint64_t numPlayed = stream.mNumPlayed.load(std::memory_order_relaxed);
+	uint64_t numFilled = stream.mNumFilled.load(std::memory_order_acquire);
+	while (done < size && numPlayed < numFilled)
+	{
+		size_t index = numPlayed % NUM_STREAM_BUFFERS;
+		size_t count = std::min(size - done, stream.mLengths[index] - stream.mPlayOffset);
+		std::memcpy(dest + done, stream.mBuffers[index].data() + stream.mPlayOffset, count);
+		done += count;
+		stream.mPlayOffset += count;
+
+		// Hand the buffer back to UpdateStreams to refill
+		if (stream.mPlayOffset == stream.mLengths[index])
+		{
+			stream.mPlayOffset = 0;
+			stream.mNumPlayed.store(++numPlayed, std::memory_order_release);
+		}
+	}
+
+	// If Update has fallen behind (or the stream has ended) it's silent
+	// until there's more
+	std::memset(dest + done, stream.mSilence, size - done);
+}
+
+// Takes the stream out of mStreams, moving the last one into its place
+void AudioSystem::RemoveStream(StreamInfo* stream)
+{
+	size_t index = stream->mIndex;
+	if (index != mStreams.size() - 1)
+	{
+		mStreams[index] = std::move(mStreams.back());
+		mStreams[index]->mIndex = index;
+	}
+	mStreams.pop_back();
+}
+
+// Plays a batch of sounds that start on the same frame, in order, as if
+// PlaySound was called for each one. Returns the handles in the same
+// order, which stay valid until the next call to PlaySounds.
+std::span<const SoundHandle> AudioSystem::PlaySounds(std::span<const SoundRequest> requests)
+{
+	mBatchHandles.clear();
+	mBatchHandles.reserve(requests.size());
+	mBatchStarts.clear();
+	mBatchStarts.reserve(requests.size());
+
+	// First set up all the handles and channels...
+	SoundInfo* soundInfo = nullptr;
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		const SoundRequest& request = requests[i];
+		// Bursts tend to repeat a sound, so only look up a name when it changes
+		if (i == 0 || request.mSoundName != requests[i - 1].mSoundName)
+		{
+			soundInfo = GetSoundInfo(request.mSoundName);
+		}
+
+		if (soundInfo == nullptr)
+		{
+			SDL_Log("[AudioSystem] PlaySounds couldn't find sound for %.*s",
+					static_cast<int>(request.mSoundName.size()), request.mSoundName.data());
+			mBatchHandles.emplace_back(SoundHandle::Invalid);
+			continue;
+		}
+
+		SoundHandle sound = MergeVoice(soundInfo, request.mLooping);
+		if (!sound.IsValid())
+		{
+			sound = RegisterVoice(soundInfo, request.mLooping, request.mPriority);
+			mBatchStarts.emplace_back(sound);
+		}
+		mBatchHandles.emplace_back(sound);
+	}
+
+	// ...then start the new ones in SDL_mixer back to back. A voice can lose
+	// its channel to a later request in the same batch, so skip any that did.
+	for (SoundHandle sound : mBatchStarts)
+	{
+		auto iter = mHandleMap.find(sound);
+		if (iter != mHandleMap.end() && iter->second.mChannel != -1)
+		{
+			StartVoice(iter->second.mChannel, iter->second);
+		}
+	}
+
+	return mBatchHandles;
+}
+
+// Finds a channel for a new voice of the sound and adds its handle, but
+// doesn't start it in SDL_mixer. Returns an invalid handle if there's no
+// channel for it (and virtual voices are off), or no handle left.
+SoundHandle AudioSystem::RegisterVoice(SoundInfo* soundInfo, bool looping, int priority)
+{
+	// Every handle is in use, so there's none to give the voice
+	if (mHandleMap.full())
+	{
+		SDL_Log("[AudioSystem] PlaySound has no handles left for %.*s",
+				static_cast<int>(soundInfo->mName.size()), soundInfo->mName.data());
+		return SoundHandle::Invalid;
+	}
+
+	//Find the first available channel, otherwise make one available
+	int firstAvailChannel = ClaimFreeChannel();
+	if (firstAvailChannel == -1)
+	{
+		firstAvailChannel = mVirtualVoicesEnabled ? DemoteVoice(priority)
+												  : StealChannel(soundInfo);
+	}
+	if (firstAvailChannel == -1 && !mVirtualVoicesEnabled)
+	{
+		SDL_Log("[AudioSystem] PlaySound couldn't find a free channel for %.*s",
+				static_cast<int>(soundInfo->mName.size()), soundInfo->mName.data());
+		return SoundHandle::Invalid;
+	}
+
+	//Handle info
+	HandleInfo handleInfo;
+	handleInfo.mSoundName = soundInfo->mName;
+	handleInfo.mSoundId = soundInfo->mId;
+	handleInfo.mChannel = firstAvailChannel;
+	handleInfo.mIsLooping = looping;
+	handleInfo.mChunk = soundInfo->mChunk;
+	handleInfo.mPriority = priority;
+	handleInfo.mPlayOrder = mNextPlayOrder++;
+	handleInfo.mStartTime = mTime;
+	handleInfo.mSound = soundInfo;
+	handleInfo.mVolume = soundInfo->mPolicy.mVolume;
+
+	//Put in map, which hands out the handle
+	auto iter = mHandleMap.emplace(handleInfo);
+	SoundHandle soundHandle = iter->first;
+	soundInfo->mNumVoices++;
+	soundInfo->mLastVoice = soundHandle;
+	soundInfo->mLastStartTime = mTime;
+	if (soundInfo->mChunk == nullptr)
+	{
+		mLoadingVoices.emplace_back(soundHandle);
+	}
+	else
+	{
+		TouchCachedSound(*soundInfo);
+	}
+
+	//Give it the channel, or start it as virtual if there's no channel for it
+	if (firstAvailChannel == -1)
+	{
+		AddVirtualVoice(iter->second, soundHandle);
+		// It was the lowest priority voice with too many virtual already
+		if (mHandleMap.find(soundHandle) == mHandleMap.end())
+		{
+			return SoundHandle::Invalid;
+		}
+	}
+	else
+	{
+		BindVoice(firstAvailChannel, soundHandle, iter->second);
+	}
+
+	return soundHandle;
+}
+
+// Stops the sound if it is currently playing
+void AudioSystem::StopSound(SoundHandle sound)
+{
+	auto iter = mHandleMap.find(sound);
+	if (iter == mHandleMap.end())
+	{
+		SDL_Log("[AudioSystem] StopSound couldn't find handle %s", sound.GetDebugStr());
+	}
+	else
+	{
+		StopVoice(iter);
+	}
+}
+
+// Pauses the sound if it is currently playing
+void AudioSystem::PauseSound(SoundHandle sound)
+{
+	auto iter = mHandleMap.find(sound);
+	if (iter == mHandleMap.end())
+	{
+		SDL_Log("[AudioSystem] PauseSound couldn't find handle %s", sound.GetDebugStr());
+	}
+	else
+	{
+		PauseVoice(iter->second);
+	}
+}
+
+// Resumes the sound if it is currently paused
+void AudioSystem::ResumeSound(SoundHandle sound)
+{
+	auto iter = mHandleMap.find(sound);
+	if (iter == mHandleMap.end())
+	{
+		SDL_Log("[AudioSystem] PauseSound couldn't find handle %s", sound.GetDebugStr());
+	}
+	else
+	{
+		ResumeVoice(iter->second);
+	}
+}
+
+// Sets the volume of the sound, fading to it over rampTime seconds
+void AudioSystem::SetVolume(SoundHandle sound, int volume, float rampTime)
+{
+	auto iter = mHandleMap.find(sound);
+	if (iter == mHandleMap.end())
+	{
+		SDL_Log("[AudioSystem] SetVolume couldn't find handle %s", sound.GetDebugStr());
+		return;
+	}
+
+	// A virtual voice just starts at the new volume when it gets a channel
+	HandleInfo& info = iter->second;
+	info.mVolume = std::clamp(volume, 0, MIX_MAX_VOLUME);
+	if (info.mChannel != -1)
+	{
+		SetChannelVolume(info.mChannel, info.mVolume, rampTime);
+	}
+}
+
+// Sets where the sound is between the left and right speakers
+void AudioSystem::SetPan(SoundHandle sound, float pan)
+{
+	auto iter = mHandleMap.find(sound);
+	if (iter == mHandleMap.end())
+	{
+		SDL_Log("[AudioSystem] SetPan couldn't find handle %s", sound.GetDebugStr());
+		return;
+	}
+
+	HandleInfo& info = iter->second;
+	info.mPan = std::clamp(pan, -1.0f, 1.0f);
+	if (info.mChannel != -1)
+	{
+		SetChannelPan(info.mChannel, info.mPan, PAN_RAMP_TIME);
+	}
+}
+
+// Returns the current state of the sound
+SoundState AudioSystem::GetSoundState(SoundHandle sound) const
+{
+	auto iter = mHandleMap.find(sound);
+	if (iter == mHandleMap.end())
+	{
+		return SoundState::Stopped;
+	}
+	//Referenced Process input
+	if (iter->second.mIsPaused)
+	{
+		return SoundState::Paused;
+	}
+	if (iter->second.mChunk == nullptr)
+	{
+		return SoundState::Loading;
+	}
+	return SoundState::Playing;
+}
+
+// Stops all sounds on all channels
+void AudioSystem::StopAllSounds()
+{
+	for (size_t i = 0; i < mChannels.size(); i++)
+	{
+		if (mChannels[i].IsValid())
+		{
+			HaltChannel(static_cast<int>(i));
+			mChannels[i].Reset();
+		}
+	}
+	mHandleMap.clear();
+	mVirtualVoices.clear();
+	mVirtualVictims.clear();
+	mDemotableVoices.clear();
+	mLoadingVoices.clear();
+	mStreams.clear();
+	mLoopingVoices = AgeList();
+	mOneShotVoices = AgeList();
+	for (auto& [name, soundInfo] : mSounds)
+	{
+		soundInfo.mVoices = AgeList();
+		soundInfo.mNumVoices = 0;
+		ReleaseIfUnused(soundInfo);
+	}
+	for (auto& [name, bus] : mBuses)
+	{
+		bus.mVoices = AgeList();
+	}
+	ResetFreeChannels();
+}
+
+// Puts the sound on the named bus (taking it off any bus it was on)
+void AudioSystem::SetSoundBus(SoundHandle sound, const std::string& busName)
+{
+	auto iter = mHandleMap.find(sound);
+	if (iter == mHandleMap.end())
+	{
+		SDL_Log("[AudioSystem] SetSoundBus couldn't find handle %s", sound.GetDebugStr());
+		return;
+	}
+
+	HandleInfo& info = iter->second;
+	if (info.mBus != nullptr)
+	{
+		Unlink<&HandleInfo::mBusLink>(info.mBus->mVoices, sound.GetIndex());
+	}
+	info.mBus = &mBuses[busName];
+	PushBack<&HandleInfo::mBusLink>(info.mBus->mVoices, sound.GetIndex());
+}
+
+// Pauses every sound on the bus
+void AudioSystem::PauseBus(const std::string& busName)
+{
+	auto iter = mBuses.find(busName);
+	if (iter != mBuses.end())
+	{
+		for (uint32_t i = iter->second.mVoices.mHead; i != NO_SLOT;)
+		{
+			HandleInfo& info = mHandleMap.at_slot(i)->second;
+			PauseVoice(info);
+			i = info.mBusLink.mNext;
+		}
+	}
+}
+
+// Resumes every sound on the bus
+void AudioSystem::ResumeBus(const std::string& busName)
+{
+	auto iter = mBuses.find(busName);
+	if (iter != mBuses.end())
+	{
+		for (uint32_t i = iter->second.mVoices.mHead; i != NO_SLOT;)
+		{
+			HandleInfo& info = mHandleMap.at_slot(i)->second;
+			ResumeVoice(info);
+			i = info.mBusLink.mNext;
+		}
+	}
+}
+
+// Stops every sound on the bus
+void AudioSystem::StopBus(const std::string& busName)
+{
+	auto iter = mBuses.find(busName);
+	if (iter == mBuses.end())
+	{
+		return;
+	}
+
+	// Stopping frees channels, which can promote (or drop) virtual voices on
+	// the same bus, so copy the handles out before stopping any of them
+	mBusScratch.clear();
+	for (uint32_t i = iter->second.mVoices.mHead; i != NO_SLOT;)
+	{
+		auto voice = mHandleMap.at_slot(i);
+		mBusScratch.emplace_back(voice->first);
+		i = voice->second.mBusLink.mNext;
+	}
+
+	for (SoundHandle sound : mBusScratch)
+	{
+		auto voice = mHandleMap.find(sound);
+		if (voice != mHandleMap.end())
+		{
+			StopVoice(voice);
+		}
+	}
+}
+
+// Sets the limits for the sound (loading it if it's not cached yet)
+void AudioSystem::SetSoundPolicy(const std::string& soundName, const SoundPolicy& policy)
+{
+	SoundInfo* soundInfo = GetSoundInfo(soundName);
+	if (soundInfo == nullptr)
+	{
+		SDL_Log("[AudioSystem] SetSoundPolicy couldn't find sound for %s", soundName.c_str());
+		return;
+	}
+	soundInfo->mPolicy = policy;
+}
+
+// Turns voice virtualization on or off (off by default)
+void AudioSystem::SetVirtualVoicesEnabled(bool enabled)
+{
+	mVirtualVoicesEnabled = enabled;
+	if (!enabled)
+	{
+		for (uint32_t index : mVirtualVoices)
+		{
+			EraseVoice(mHandleMap.at_slot(index));
+		}
+		mVirtualVoices.clear();
+		mVirtualVictims.clear();
+	}
+}
+
+// Cache all sounds under Assets/Sounds
+void AudioSystem::CacheAllSounds()
+{
+	std::vector<SoundInfo*> sounds;
+	// Sounds whose size and duration came from the index
+	std::vector<SoundInfo*> indexed;
+
+	// Without a manifest, the index also lists the sounds, so the directory
+	// is only walked if the index is out of date
+	bool useIndex = !mSoundIndexPath.empty();
+	bool indexValid = useIndex && ReadSoundIndex(sounds, indexed);
+	if (mNumManifestSounds > 0)
+	{
+		sounds.assign(mSoundIds.begin(), mSoundIds.begin() + mNumManifestSounds);
+	}
+	else if (!indexValid)
+	{
+#ifndef __clang_analyzer__
+		std::error_code ec{};
+		for (const auto& rootDirEntry : std::filesystem::directory_iterator{"Assets/Sounds", ec})
+		{
+			std::string extension = rootDirEntry.path().extension().string();
+			if (extension == ".ogg" || extension == ".wav")
+			{
+				std::string fileName = rootDirEntry.path().stem().string();
+				fileName += extension;
+				sounds.emplace_back(AddSoundInfo(fileName));
+			}
+		}
+#endif
+	}
+
+	if (!mLazyCaching)
+	{
+		LoadSounds(sounds);
+	}
+
+	// Sounds that aren't loaded (from lazy caching, or a full budget) get
+	// their size and duration from their files
+	std::sort(indexed.begin(), indexed.end());
+	size_t numStale = 0;
+	for (SoundInfo* soundInfo : sounds)
+	{
+		if (!std::binary_search(indexed.begin(), indexed.end(), soundInfo))
+		{
+			numStale++;
+			if (mLazyCaching || soundInfo->mChunk == nullptr)
+			{
+				IndexSound(*soundInfo);
+			}
+		}
+	}
+
+	if (useIndex && (!indexValid || numStale > 0))
+	{
+		WriteSoundIndex(sounds);
+	}
+}
+
+// Sets a file for CacheAllSounds to keep an index of Assets/Sounds in
+void AudioSystem::SetSoundIndexPath(const std::string& path)
+{
+	mSoundIndexPath = path;
+}
+
+// Adds the sounds in the index to sounds, if Assets/Sounds hasn't changed
+// since it was written. The ones whose files haven't changed either get
+// their size and duration from it, and are added to indexed. With a
+// manifest, which lists the sounds itself, only the manifest's sounds get
+// their size and duration from it, whatever the folder's time.
+// Returns false if the index can't be used.
+bool AudioSystem::ReadSoundIndex(std::vector<SoundInfo*>& sounds,
+								 std::vector<SoundInfo*>& indexed)
+{
+	std::ifstream file(mSoundIndexPath, std::ios::binary | std::ios::ate);
+	if (!file)
+	{
+		return false;
+	}
+	size_t fileSize = static_cast<size_t>(file.tellg());
+	file.seekg(0);
+
+	// Adding, removing or renaming a sound changes the folder's time, so
+	// this one check covers the whole list
+	SoundIndexHeader header;
+	std::error_code ec{};
+	auto folderTime = std::filesystem::last_write_time("Assets/Sounds", ec);
+	bool listsSounds = mNumManifestSounds == 0;
+	if (ec || !file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+		std::memcmp(header.mMagic, SoundIndexHeader().mMagic, 4) != 0 ||
+		header.mVersion != SoundIndexHeader().mVersion ||
+		(listsSounds && header.mFolderTime != folderTime.time_since_epoch().count()) ||
+		header.mNumSounds > (fileSize - sizeof(header)) / sizeof(SoundIndexEntry))
+	{
+		return false;
+	}
+
+	std::vector<SoundIndexEntry> entries(header.mNumSounds);
+	std::string names(fileSize - sizeof(header) - sizeof(SoundIndexEntry) * entries.size(), '\0');
+	file.read(reinterpret_cast<char*>(entries.data()),
+			  static_cast<std::streamsize>(sizeof(SoundIndexEntry) * entries.size()));
+	file.read(names.data(), static_cast<std::streamsize>(names.size()));
+	if (!file)
+	{
+		return false;
+	}
+
+	// Editing a file doesn't change the folder's time, so each file is
+	// checked too (which doesn't need to open it)
+	for (const SoundIndexEntry& entry : entries)
+	{
+		if (entry.mNameOffset > names.size() || entry.mNameLength > names.size() - entry.mNameOffset)
+		{
+			continue;
+		}
+		std::string_view name = std::string_view(names).substr(entry.mNameOffset, entry.mNameLength);
+		SoundInfo* soundInfo = listsSounds ? AddSoundInfo(name) : FindSoundInfo(name);
+		if (soundInfo == nullptr)
+		{
+			continue;
+		}
+		if (listsSounds)
+		{
+			sounds.emplace_back(soundInfo);
+		}
+
+		std::filesystem::path path(soundInfo->mPath);
+		std::error_code sizeError{};
+		uint64_t size = std::filesystem::file_size(path, sizeError);
+		auto time = std::filesystem::last_write_time(path, ec);
+		if (!sizeError && !ec && size == entry.mFileSize &&
+			time.time_since_epoch().count() == entry.mFileTime)
+		{
+			soundInfo->mFileSize = entry.mFileSize;
+			soundInfo->mDuration = entry.mDuration;
+			indexed.emplace_back(soundInfo);
+		}
+	}
+	return true;
+}
+
+// Writes an index of the sounds to the file from SetSoundIndexPath
+void AudioSystem::WriteSoundIndex(std::span<SoundInfo* const> sounds)
+{
+	std::error_code ec{};
+	SoundIndexHeader header;
+	header.mFolderTime =
+		std::filesystem::last_write_time("Assets/Sounds", ec).time_since_epoch().count();
+	if (ec)
+	{
+		return;
+	}
+
+	std::vector<SoundIndexEntry> entries;
+	entries.reserve(sounds.size());
+	std::string names;
+	for (SoundInfo* soundInfo : sounds)
+	{
+		std::filesystem::path path(soundInfo->mPath);
+		SoundIndexEntry entry;
+		std::error_code sizeError{};
+		entry.mFileSize = std::filesystem::file_size(path, sizeError);
+		entry.mFileTime = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+		if (sizeError || ec)
+		{
+			continue;
+		}
+		entry.mDuration = soundInfo->mChunk ? GetSoundLength(*soundInfo) : soundInfo->mDuration;
+		entry.mNameOffset = static_cast<uint32_t>(names.size());
+		entry.mNameLength = static_cast<uint32_t>(soundInfo->mName.size());
+		names += soundInfo->mName;
+		entries.emplace_back(entry);
+	}
+	header.mNumSounds = static_cast<uint32_t>(entries.size());
+
+	// Written to the side and renamed over the old one, so a crash partway
+	// through can't leave a broken index
+	std::string tempPath = mSoundIndexPath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(entries.data()),
+				   static_cast<std::streamsize>(sizeof(SoundIndexEntry) * entries.size()));
+		file.write(names.data(), static_cast<std::streamsize>(names.size()));
+		if (!file)
+		{
+			SDL_Log("[AudioSystem] Couldn't write the sound index %s", mSoundIndexPath.c_str());
+			return;
+		}
+	}
+	std::filesystem::rename(tempPath, mSoundIndexPath, ec);
+}
+
+// Turns lazy caching on or off
+void AudioSystem::SetLazyCaching(bool enabled)
+{
+	mLazyCaching = enabled;
+}
+
+// Turns sharing of identical sounds on or off
+void AudioSystem::SetSoundSharing(bool enabled)
+{
+	mShareSounds = enabled;
+}
+
+// Turns compressed storage on or off
+void AudioSystem::SetCompressedStorage(bool enabled)
+{
+	mCompressSounds = enabled;
+}
+
+// Returns the file size and duration of the sound
+SoundMetadata AudioSystem::GetSoundMetadata(const std::string& soundName)
+{
+	SoundMetadata metadata;
+	mPathBuffer = "Assets/Sounds/";
+	mPathBuffer += soundName;
+	auto iter = mSounds.find(mPathBuffer);
+	if (iter != mSounds.end())
+	{
+		const SoundInfo& soundInfo = iter->second;
+		metadata.mFileSize = soundInfo.mFileSize;
+		metadata.mDuration = soundInfo.mDuration;
+		metadata.mIsLoaded = soundInfo.mChunk != nullptr;
+		if (metadata.mIsLoaded)
+		{
+			metadata.mDuration = GetSoundLength(soundInfo);
+		}
+	}
+	return metadata;
+}
+
+// Records the file size and duration of the sound from its file's header,
+// without decoding it
+void AudioSystem::IndexSound(SoundInfo& soundInfo)
+{
+	if (const SoundBank::Entry* entry = FindBankEntry(soundInfo.mName))
+	{
+		soundInfo.mFileSize = entry->mDataLength;
+		soundInfo.mDuration = static_cast<double>(entry->mDataLength) / mBytesPerSecond;
+		return;
+	}
+
+	std::ifstream file(std::string(soundInfo.mPath), std::ios::binary | std::ios::ate);
+	if (!file)
+	{
+		return;
+	}
+	soundInfo.mFileSize = static_cast<uint64_t>(file.tellg());
+
+	// Only the start (and for Ogg, the end) of the file is needed, so this
+	// reads at most 64KB from each end
+	auto readAt = [&file](uint64_t offset, size_t size) {
+		std::string data(size, '\0');
+		file.seekg(static_cast<std::streamoff>(offset));
+		file.read(data.data(), static_cast<std::streamsize>(size));
+		data.resize(static_cast<size_t>(file.gcount()));
+		return data;
+	};
+	auto readU32 = [](const std::string& data, size_t pos) {
+		return static_cast<uint8_t>(data[pos]) | (static_cast<uint8_t>(data[pos + 1]) << 8) |
+			   (static_cast<uint8_t>(data[pos + 2]) << 16) |
+			   (static_cast<uint32_t>(static_cast<uint8_t>(data[pos + 3])) << 24);
+	};
+	const size_t readSize = 64 * 1024;
+	std::string head = readAt(0, std::min<uint64_t>(readSize, soundInfo.mFileSize));
+
+	if (head.compare(0, 4, "RIFF") == 0)
+	{
+		// Duration is the size of the data chunk over the fmt chunk's byte rate
+		uint32_t byteRate = 0;
+		for (size_t pos = 12; pos + 8 <= head.size();)
+		{
+			uint32_t size = readU32(head, pos + 4);
+			if (head.compare(pos, 4, "fmt ") == 0 && pos + 20 <= head.size())
+			{
+				byteRate = readU32(head, pos + 16);
+			}
+			else if (head.compare(pos, 4, "data") == 0)
+			{
+				if (byteRate != 0)
+				{
+					soundInfo.mDuration = static_cast<double>(size) / byteRate;
+				}
+				break;
+			}
+			pos += 8 + size + (size & 1);
+		}
+	}
+	else if (head.compare(0, 4, "OggS") == 0)
+	{
+		// Duration is the granule position (sample count) of the last page
+		// over the sample rate in the Vorbis identification header
+		size_t idHeader = head.find("\x01vorbis");
+		uint64_t tailStart = soundInfo.mFileSize - std::min<uint64_t>(readSize, soundInfo.mFileSize);
+		std::string tail = readAt(tailStart, static_cast<size_t>(soundInfo.mFileSize - tailStart));
+		size_t lastPage = tail.rfind("OggS");
+		if (idHeader != std::string::npos && idHeader + 16 <= head.size() &&
+			lastPage != std::string::npos && lastPage + 14 <= tail.size())
+		{
+			uint32_t rate = readU32(head, idHeader + 12);
+			uint64_t granule = readU32(tail, lastPage + 6) |
+							   (static_cast<uint64_t>(readU32(tail, lastPage + 10)) << 32);
+			if (rate != 0)
+			{
+				soundInfo.mDuration = static_cast<double>(granule) / rate;
+			}
+		}
+	}
+}
+
+// Used to preload the sound data of a sound
+// NOTE: The soundName is without the "Assets/Sounds/" part of the file
+//       For example, pass in "ChompLoop.wav" rather than
+//       "Assets/Sounds/ChompLoop.wav".
+void AudioSystem::CacheSound(const std::string& soundName)
+{
+	// A sound still on the loader thread lands on Update, so this doesn't
+	// wait for it
+	SoundInfo* soundInfo = FindSoundInfo(soundName);
+	if (soundInfo == nullptr || !soundInfo->mLoad.valid())
+	{
+		GetSoundInfo(soundName);
+	}
+}
+
+// Same as above, but for a sound from RegisterSound
+void AudioSystem::CacheSound(SoundId sound)
+{
+	if (!sound.IsValid() || sound.GetIndex() >= mSoundIds.size())
+	{
+		SDL_Log("[AudioSystem] CacheSound called with an unregistered SoundId");
+		return;
+	}
+
+	LoadSound(*mSoundIds[sound.GetIndex()]);
+}
+
+// Starts loading the sound on a background thread and returns right away
+LoadTicket AudioSystem::CacheSoundAsync(const std::string& soundName)
+{
+	// Like GetSoundInfo, a sound added here is removed again if it doesn't
+	// load (by FinishLoad, since that's when it's known)
+	bool isNew = FindSoundInfo(soundName) == nullptr;
+	SoundInfo* soundInfo = AddSoundInfo(soundName);
+	soundInfo->mRemoveIfLoadFails |= isNew;
+	return LoadSoundAsync(*soundInfo);
+}
+
+// Same as above, but for a sound from RegisterSound
+LoadTicket AudioSystem::CacheSoundAsync(SoundId sound)
+{
+	if (!sound.IsValid() || sound.GetIndex() >= mSoundIds.size())
+	{
+		SDL_Log("[AudioSystem] CacheSoundAsync called with an unregistered SoundId");
+		return LoadTicket();
+	}
+	return LoadSoundAsync(*mSoundIds[sound.GetIndex()]);
+}
+
+// Returns the SoundId for the sound, which can be passed to PlaySound
+// and CacheSound in place of its name. This doesn't load the sound.
+SoundId AudioSystem::RegisterSound(const std::string& soundName)
+{
+	SoundInfo* soundInfo = AddSoundInfo(soundName);
+	if (!soundInfo->mId.IsValid())
+	{
+		soundInfo->mId = SoundId(static_cast<uint32_t>(mSoundIds.size()));
+		mSoundIds.emplace_back(soundInfo);
+	}
+	return soundInfo->mId;
+}
+
+// If the sound is already loaded, returns Mix_Chunk from the map.
+// Otherwise, will attempt to load the file and save it in the map.
+// Returns nullptr if sound is not found.
+// NOTE: The soundName is without the "Assets/Sounds/" part of the file
+//       For example, pass in "ChompLoop.wav" rather than
+//       "Assets/Sounds/ChompLoop.wav".
+Mix_Chunk* AudioSystem::GetSound(const std::string& soundName)
+{
+	// A sound still on the loader thread has no chunk until it lands on
+	// Update, and a compressed sound's chunk holds IMA-ADPCM, which can't
+	// be played
+	SoundInfo* soundInfo = GetSoundInfo(soundName);
+	if (soundInfo == nullptr || soundInfo->mLoad.valid() || !soundInfo->mAdpcm.empty())
+	{
+		return nullptr;
+	}
+	return soundInfo->mChunk;
+}
+
+// Same as GetSound, but returns the SoundInfo for the sound. A sound
+// that isn't in mSounds yet is only added if it loads.
+AudioSystem::SoundInfo* AudioSystem::GetSoundInfo(std::string_view soundName)
+{
+	SoundInfo* soundInfo = FindSoundInfo(soundName);
+	bool isNew = soundInfo == nullptr;
+	if (isNew)
+	{
+		soundInfo = AddSoundInfo(soundName);
+	}
+	if (!LoadSound(*soundInfo))
+	{
+		if (isNew)
+		{
+			RemoveSoundInfo(*soundInfo);
+		}
+		return nullptr;
+	}
+	return soundInfo;
+}
+
+// Returns the SoundInfo for the sound, or nullptr if it's not in mSounds
+AudioSystem::SoundInfo* AudioSystem::FindSoundInfo(std::string_view soundName)
+{
+	mPathBuffer = "Assets/Sounds/";
+	mPathBuffer += soundName;
+	auto iter = mSounds.find(mPathBuffer);
+	return iter != mSounds.end() ? &iter->second : nullptr;
+}
+
+// Takes a sound that was only just added back out of mSounds, since it
+// turned out not to load
+void AudioSystem::RemoveSoundInfo(SoundInfo& soundInfo)
+{
+	mSounds.erase(mSounds.find(std::string(soundInfo.mPath)));
+}
+
+// Returns the SoundInfo for the sound, adding it (without loading it)
+// if it's not in mSounds yet
+AudioSystem::SoundInfo* AudioSystem::AddSoundInfo(std::string_view soundName)
+{
+	std::string& fileName = mPathBuffer;
+	fileName = "Assets/Sounds/";
+	fileName += soundName;
+
+	auto iter = mSounds.find(fileName);
+	if (iter == mSounds.end())
+	{
+		iter = mSounds.emplace(fileName, SoundInfo()).first;
+		SoundInfo& soundInfo = iter->second;
+		soundInfo.mPath = iter->first;
+		soundInfo.mName = soundInfo.mPath.substr(soundInfo.mPath.size() - soundName.size());
+	}
+	return &iter->second;
+}
+
+// Loads the chunk for the sound if it isn't loaded (or loading)
+// Returns false if the file couldn't be loaded
+bool AudioSystem::LoadSound(SoundInfo& soundInfo)
+{
+	soundInfo.mUnloadRequested = false;
+	if (soundInfo.mChunk != nullptr)
+	{
+		mCacheStats.mHits++;
+	}
+	else if (!soundInfo.mLoad.valid())
+	{
+		mCacheStats.mMisses++;
+		// mPath views the whole key, so it's null-terminated
+		soundInfo.mChunk = DecodeSound(soundInfo);
+		if (!soundInfo.mChunk)
+		{
+			SDL_Log("[AudioSystem] Failed to load sound file %s", soundInfo.mPath.data());
+			return false;
+		}
+		AddToCache(soundInfo);
+	}
+	return true;
+}
+
+// Keeps the sound's newly loaded chunk in the cache, unloading other
+// sounds if that puts it over budget
+void AudioSystem::AddToCache(SoundInfo& soundInfo)
+{
+	if (mCompressSounds && soundInfo.mChunk->allocated)
+	{
+		CompressSound(soundInfo);
+	}
+
+	// Sound bank chunks point into the mapping and don't take up memory of
+	// their own, so they're neither shared nor counted against the budget.
+	// Compressed chunks don't own their samples either, so aren't shared.
+	if (!IsBankChunk(soundInfo.mChunk))
+	{
+		if (mShareSounds && soundInfo.mChunk->allocated && ShareChunk(soundInfo))
+		{
+			mCacheStats.mSharedBytes += soundInfo.mChunk->alen;
+		}
+		else
+		{
+			mCacheStats.mResidentBytes += soundInfo.mChunk->alen;
+		}
+	}
+	soundInfo.mCachePrev = mCacheTail;
+	soundInfo.mCacheNext = nullptr;
+	if (mCacheTail != nullptr)
+	{
+		mCacheTail->mCacheNext = &soundInfo;
+	}
+	else
+	{
+		mCacheHead = &soundInfo;
+	}
+	mCacheTail = &soundInfo;
+
+	if (mCacheBudget != 0 && mCacheStats.mResidentBytes > mCacheBudget)
+	{
+		EvictSounds(&soundInfo);
+	}
+}
+
+// Moves the sound to the most recently played end of the cache
+void AudioSystem::TouchCachedSound(SoundInfo& soundInfo)
+{
+	if (mCacheTail != &soundInfo)
+	{
+		UnlinkCachedSound(soundInfo);
+		soundInfo.mCachePrev = mCacheTail;
+		mCacheTail->mCacheNext = &soundInfo;
+		mCacheTail = &soundInfo;
+	}
+}
+
+// Takes the sound out of the cache's list (without freeing it)
+void AudioSystem::UnlinkCachedSound(SoundInfo& soundInfo)
+{
+	if (soundInfo.mCachePrev != nullptr)
+	{
+		soundInfo.mCachePrev->mCacheNext = soundInfo.mCacheNext;
+	}
+	else
+	{
+		mCacheHead = soundInfo.mCacheNext;
+	}
+	if (soundInfo.mCacheNext != nullptr)
+	{
+		soundInfo.mCacheNext->mCachePrev = soundInfo.mCachePrev;
+	}
+	else
+	{
+		mCacheTail = soundInfo.mCachePrev;
+	}
+	soundInfo.mCachePrev = nullptr;
+	soundInfo.mCacheNext = nullptr;
+}
+
+// Unloads sounds that aren't playing, least recently played first, until
+// the cache is back under budget (never unloading keep)
+void AudioSystem::EvictSounds(const SoundInfo* keep)
+{
+	SoundInfo* soundInfo = mCacheHead;
+	while (soundInfo != nullptr && mCacheStats.mResidentBytes > mCacheBudget)
+	{
+		SoundInfo* next = soundInfo->mCacheNext;
+		// Voices (even virtual ones) still point into the chunk, and
+		// unloading a sound bank chunk frees nothing
+		if (soundInfo != keep && soundInfo->mNumVoices == 0 &&
+			!IsBankChunk(soundInfo->mChunk))
+		{
+			FreeSoundChunk(*soundInfo);
+			mCacheStats.mEvictions++;
+		}
+		soundInfo = next;
+	}
+}
+
+// Takes the sound out of the cache and frees its chunk
+void AudioSystem::FreeSoundChunk(SoundInfo& soundInfo)
+{
+	UnlinkCachedSound(soundInfo);
+	Uint32 length = IsBankChunk(soundInfo.mChunk) ? 0 : soundInfo.mChunk->alen;
+	if (ReleaseChunk(soundInfo))
+	{
+		mCacheStats.mResidentBytes -= length;
+	}
+	else
+	{
+		mCacheStats.mSharedBytes -= length;
+	}
+	soundInfo.mChunk = nullptr;
+}
+
+// Returns a 64-bit FNV-1a hash of the samples
+uint64_t AudioSystem::HashSamples(const Uint8* samples, size_t length)
+{
+	// Eight bytes at a time, since this runs over every loaded sample
+	uint64_t hash = 14695981039346656037ull;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t))
+	{
+		uint64_t word = 0;
+		std::memcpy(&word, samples + i, sizeof(word));
+		hash = (hash ^ word) * 1099511628211ull;
+	}
+	for (; i < length; i++)
+	{
+		hash = (hash ^ samples[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+// Switches the sound's newly loaded chunk for the chunk of a sound with the
+// same samples, if there is one. Returns true if it switched.
+bool AudioSystem::ShareChunk(SoundInfo& soundInfo)
+{
+	Mix_Chunk* chunk = soundInfo.mChunk;
+	uint64_t hash = HashSamples(chunk->abuf, chunk->alen);
+	auto [iter, inserted] = mSharedChunks.try_emplace(hash, SharedChunk{chunk, 1});
+	soundInfo.mSamplesHash = hash;
+	if (inserted)
+	{
+		return false;
+	}
+
+	// A hash collision keeps its own chunk, which isn't shared
+	SharedChunk& shared = iter->second;
+	if (shared.mChunk->alen != chunk->alen ||
+		std::memcmp(shared.mChunk->abuf, chunk->abuf, chunk->alen) != 0)
+	{
+		return false;
+	}
+	Mix_FreeChunk(chunk);
+	soundInfo.mChunk = shared.mChunk;
+	shared.mNumSounds++;
+	return true;
+}
+
+// Lets go of the sound's chunk, freeing it unless other sounds are still
+// sharing it. Returns true if it was freed.
+bool AudioSystem::ReleaseChunk(SoundInfo& soundInfo)
+{
+	auto iter = mSharedChunks.find(soundInfo.mSamplesHash);
+	if (iter != mSharedChunks.end() && iter->second.mChunk == soundInfo.mChunk)
+	{
+		if (--iter->second.mNumSounds > 0)
+		{
+			return false;
+		}
+		mSharedChunks.erase(iter);
+	}
+	Mix_FreeChunk(soundInfo.mChunk);
+	soundInfo.mAdpcm = std::vector<uint8_t>();
+	return true;
+}
+
+// Replaces the sound's newly loaded PCM chunk with a chunk of its IMA-ADPCM
+// blocks (if the mixer's format is 16-bit)
+void AudioSystem::CompressSound(SoundInfo& soundInfo)
+{
+	int frequency = 0;
+	SDL_AudioFormat format{};
+	int channels = 0;
+	if (!Mix_QuerySpec(&frequency, &format, &channels) || format != SDL_AUDIO_S16)
+	{
+		return;
+	}
+
+	// Each voice streams through a second's worth of PCM buffers, so a
+	// sound that isn't longer than that is left as PCM
+	size_t bufferSize = static_cast<size_t>(mBytesPerSecond / 4 / mFrameSize * mFrameSize);
+	if (soundInfo.mChunk->alen <= bufferSize * NUM_STREAM_BUFFERS)
+	{
+		return;
+	}
+
+	Mix_Chunk* pcm = soundInfo.mChunk;
+	size_t numFrames = pcm->alen / mFrameSize;
+	std::vector<int16_t> samples(numFrames * channels);
+	std::memcpy(samples.data(), pcm->abuf, numFrames * mFrameSize);
+	soundInfo.mAdpcm = ImaAdpcm::Encode(samples.data(), numFrames, channels);
+	soundInfo.mPcmLength = static_cast<uint32_t>(numFrames * mFrameSize);
+	Mix_FreeChunk(pcm);
+
+	// The chunk is only there to mark the sound as loaded and count its
+	// bytes, since voices play it through a stream
+	soundInfo.mChunk = Mix_QuickLoad_RAW(soundInfo.mAdpcm.data(),
+										 static_cast<Uint32>(soundInfo.mAdpcm.size()));
+}
+
+// Frees the sound's chunk if UnloadSound asked for it and no voice is
+// using it anymore
+void AudioSystem::ReleaseIfUnused(SoundInfo& soundInfo)
+{
+	// A sound that's loading is checked again by FinishLoad
+	if (soundInfo.mUnloadRequested && soundInfo.mNumVoices == 0 && !soundInfo.mLoad.valid())
+	{
+		soundInfo.mUnloadRequested = false;
+		if (soundInfo.mChunk != nullptr)
+		{
+			FreeSoundChunk(soundInfo);
+		}
+	}
+}
+
+// Frees the sound's data once no voice is using it
+void AudioSystem::UnloadSound(const std::string& soundName)
+{
+	SoundInfo* soundInfo = FindSoundInfo(soundName);
+	if (soundInfo == nullptr)
+	{
+		return;
+	}
+	soundInfo->mUnloadRequested = true;
+	ReleaseIfUnused(*soundInfo);
+}
+
+// Same as above, but for a sound from RegisterSound
+void AudioSystem::UnloadSound(SoundId sound)
+{
+	if (!sound.IsValid() || sound.GetIndex() >= mSoundIds.size())
+	{
+		SDL_Log("[AudioSystem] UnloadSound called with an unregistered SoundId");
+		return;
+	}
+
+	SoundInfo* soundInfo = mSoundIds[sound.GetIndex()];
+	soundInfo->mUnloadRequested = true;
+	ReleaseIfUnused(*soundInfo);
+}
+
+// Frees the data of every sound that isn't playing
+void AudioSystem::UnloadUnused()
+{
+	SoundInfo* soundInfo = mCacheHead;
+	while (soundInfo != nullptr)
+	{
+		SoundInfo* next = soundInfo->mCacheNext;
+		if (soundInfo->mNumVoices == 0)
+		{
+			FreeSoundChunk(*soundInfo);
+		}
+		soundInfo = next;
+	}
+}
+
+// Limits how many bytes of decoded sounds are kept loaded (0 for no limit)
+void AudioSystem::SetSoundCacheBudget(size_t bytes)
+{
+	mCacheBudget = bytes;
+	if (mCacheBudget != 0 && mCacheStats.mResidentBytes > mCacheBudget)
+	{
+		EvictSounds(nullptr);
+	}
+}
+
+// Returns the resident bytes and hit/miss/eviction counts of the cache
+const SoundCacheStats& AudioSystem::GetSoundCacheStats() const
+{
+	return mCacheStats;
+}
+
+// Returns a new chunk for the sound, pointing into the sound bank if it's
+// in there, or else loaded from its file
+Mix_Chunk* AudioSystem::DecodeSound(const SoundInfo& soundInfo) const
+{
+	if (const SoundBank::Entry* entry = FindBankEntry(soundInfo.mName))
+	{
+		// SDL_mixer only reads from the chunk, so it can use the read-only
+		// mapping directly
+		Uint8* data = const_cast<Uint8*>(mBankData + entry->mDataOffset);
+		return Mix_QuickLoad_RAW(data, entry->mDataLength);
+	}
+
+	// mPath views the whole key, so it's null-terminated
+	return Mix_LoadWAV(soundInfo.mPath.data());
+}
+
+// Returns whether the chunk points into the sound bank's mapping
+bool AudioSystem::IsBankChunk(const Mix_Chunk* chunk) const
+{
+	return mBankData != nullptr && chunk->abuf >= mBankData &&
+		   chunk->abuf < mBankData + mBankSize;
+}
+
+// Returns the sound bank entry for the sound, or nullptr if it isn't in
+// the bank (or there's no bank)
+const SoundBank::Entry* AudioSystem::FindBankEntry(std::string_view soundName) const
+{
+	auto getName = [this](const SoundBank::Entry& entry) {
+		return std::string_view(reinterpret_cast<const char*>(mBankData + entry.mNameOffset),
+								entry.mNameLength);
+	};
+	uint32_t hash = SoundBank::HashName(soundName);
+	auto iter = std::lower_bound(mBankEntries.begin(), mBankEntries.end(), soundName,
+								 [&](const SoundBank::Entry& entry, std::string_view name) {
+									 return SoundBank::EntryLess(entry.mNameHash, getName(entry),
+																 hash, name);
+								 });
+	if (iter == mBankEntries.end() || iter->mNameHash != hash || getName(*iter) != soundName)
+	{
+		return nullptr;
+	}
+	return &*iter;
+}
+
+// Maps a sound bank file, checking it's a valid bank in the mixer's format
+bool AudioSystem::OpenSoundBank(const std::string& path)
+{
+	if (mBankData != nullptr)
+	{
+		SDL_Log("[AudioSystem] OpenSoundBank called with a bank already open");
+		return false;
+	}
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+							  FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		SDL_Log("[AudioSystem] Failed to open sound bank %s", path.c_str());
+		return false;
+	}
+	LARGE_INTEGER fileSize{};
+	GetFileSizeEx(file, &fileSize);
+	HANDLE mapping = fileSize.QuadPart > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0,
+																  0, nullptr)
+										   : nullptr;
+	void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	// The view keeps the file mapped after the handles are closed
+	if (mapping)
+	{
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+	size_t size = static_cast<size_t>(fileSize.QuadPart);
+#else
+	int file = open(path.c_str(), O_RDONLY);
+	if (file == -1)
+	{
+		SDL_Log("[AudioSystem] Failed to open sound bank %s", path.c_str());
+		return false;
+	}
+	struct stat fileStat{};
+	fstat(file, &fileStat);
+	size_t size = static_cast<size_t>(fileStat.st_size);
+	void* data = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+	// The mapping stays valid after the file is closed
+	close(file);
+	if (data == MAP_FAILED)
+	{
+		data = nullptr;
+	}
+#endif
+	if (data == nullptr)
+	{
+		SDL_Log("[AudioSystem] Failed to map sound bank %s", path.c_str());
+		return false;
+	}
+	mBankData = static_cast<const uint8_t*>(data);
+	mBankSize = size;
+
+	// Check the header and that every entry is inside the file
+	SoundBank::Header header;
+	bool valid = size >= sizeof(header);
+	if (valid)
+	{
+		std::memcpy(&header, mBankData, sizeof(header));
+		int frequency = 0;
+		SDL_AudioFormat format{};
+		int outputChannels = 0;
+		Mix_QuerySpec(&frequency, &format, &outputChannels);
+		valid = std::memcmp(header.mMagic, SoundBank::MAGIC, sizeof(header.mMagic)) == 0 &&
+				header.mVersion == SoundBank::VERSION &&
+				header.mFrequency == static_cast<uint32_t>(frequency) &&
+				header.mFormat == static_cast<uint16_t>(format) &&
+				header.mChannels == static_cast<uint16_t>(outputChannels) &&
+				header.mNumSounds <= (size - sizeof(header)) / sizeof(SoundBank::Entry);
+	}
+	if (valid)
+	{
+		mBankEntries = std::span<const SoundBank::Entry>(
+			reinterpret_cast<const SoundBank::Entry*>(mBankData + sizeof(header)),
+			header.mNumSounds);
+		for (const SoundBank::Entry& entry : mBankEntries)
+		{
+			valid = valid && entry.mNameOffset <= size &&
+					entry.mNameLength <= size - entry.mNameOffset &&
+					entry.mDataOffset <= size && entry.mDataLength <= size - entry.mDataOffset &&
+					entry.mDataOffset % SoundBank::ALIGNMENT == 0;
+		}
+	}
+	if (!valid)
+	{
+		SDL_Log("[AudioSystem] %s isn't a sound bank in the mixer's format", path.c_str());
+		CloseSoundBank();
+		return false;
+	}
+	return true;
+}
+
+// Unmaps the sound bank
+void AudioSystem::CloseSoundBank()
+{
+	if (mBankData != nullptr)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(mBankData);
+#else
+		munmap(const_cast<uint8_t*>(mBankData), mBankSize);
+#endif
+		mBankData = nullptr;
+		mBankSize = 0;
+		mBankEntries = {};
+	}
+}
+
+// Turns the software mixer on or off
+// Returns false if the mixer's format isn't S16 or F32
+bool AudioSystem::SetSoftwareMixer(bool enabled)
+{
+	int frequency = 0;
+	SDL_AudioFormat format{};
+	int outputChannels = 0;
+	if (enabled && (!Mix_QuerySpec(&frequency, &format, &outputChannels) ||
+					!SoftwareMixer::IsFormatSupported(format, outputChannels)))
+	{
+		SDL_Log("[AudioSystem] SetSoftwareMixer can't mix this format");
+		return false;
+	}
+
+	// The voices would have to move from one mixer to the other partway
+	// through, so they're stopped instead
+	StopAllSounds();
+	mSoftwareMixer.reset();
+	mMixBlock.clear();
+	mMixFrames = 0.0;
+	if (enabled)
+	{
+		mSoftwareMixer = std::make_unique<SoftwareMixer>(static_cast<int>(mChannels.size()),
+														 frequency, format, outputChannels);
+		mSoftwareMixer->SetChannelFinished(OnChannelFinished);
+		mMixBlock.resize(MIX_BLOCK_FRAMES * outputChannels);
+	}
+
+	// Whichever mixer is on now gets the volumes and pans the channels were
+	// left at
+	for (size_t i = 0; i < mChannelVolumes.size(); i++)
+	{
+		int channel = static_cast<int>(i);
+		if (mSoftwareMixer)
+		{
+			mSoftwareMixer->SetVolume(channel, mChannelVolumes[i]);
+			mSoftwareMixer->SetPan(channel, mChannelPans[i]);
+		}
+		else
+		{
+			Mix_Volume(channel, mChannelVolumes[i]);
+			SetMixPanning(channel, mChannelPans[i]);
+		}
+	}
+	return true;
+}
+
+// Mixes deltaTime's worth of audio with the software mixer, into its null
+// output (or the offline render's samples)
+void AudioSystem::MixSoftware(float deltaTime)
+{
+	mMixFrames += static_cast<double>(deltaTime) * mSoftwareMixer->GetFrequency();
+	while (mMixFrames >= 1.0)
+	{
+		size_t numFrames = std::min(static_cast<size_t>(mMixFrames), MIX_BLOCK_FRAMES);
+		if (mRenderOutput != nullptr)
+		{
+			// A render stops on exactly the frame it asked for, and the rest
+			// waits for the next Update
+			numFrames = std::min(numFrames, mRenderFramesLeft);
+			if (numFrames == 0)
+			{
+				break;
+			}
+		}
+
+		mSoftwareMixer->Mix(mMixBlock.data(), numFrames);
+		mMixFrames -= static_cast<double>(numFrames);
+		if (mRenderOutput != nullptr)
+		{
+			size_t numSamples = numFrames * mSoftwareMixer->GetOutputChannels();
+			mRenderOutput->insert(mRenderOutput->end(), mMixBlock.begin(),
+								  mMixBlock.begin() + static_cast<std::ptrdiff_t>(numSamples));
+			mRenderFramesLeft -= numFrames;
+		}
+	}
+}
+
+// Renders the next seconds of audio as fast as the CPU allows
+// Returns false if the software mixer isn't on
+bool AudioSystem::RenderOffline(float seconds, std::vector<float>& samples, float updateTime)
+{
+	if (!mSoftwareMixer)
+	{
+		SDL_Log("[AudioSystem] RenderOffline needs the software mixer");
+		return false;
+	}
+	if (updateTime <= 0.0f)
+	{
+		SDL_Log("[AudioSystem] RenderOffline needs an updateTime above 0 (got %f)", updateTime);
+		return false;
+	}
+
+	double frequency = mSoftwareMixer->GetFrequency();
+	mRenderFramesLeft = static_cast<size_t>(std::llround(std::max(seconds, 0.0f) * frequency));
+	samples.reserve(samples.size() + mRenderFramesLeft * mSoftwareMixer->GetOutputChannels());
+	mRenderOutput = &samples;
+	while (mRenderFramesLeft > 0)
+	{
+		// The last step is cut short to end on the frame, but every step is
+		// at least a frame so the render always gets there
+		double timeLeft = (static_cast<double>(mRenderFramesLeft) - mMixFrames) / frequency;
+		double step = std::clamp(timeLeft, 1.0 / frequency, static_cast<double>(updateTime));
+		Update(static_cast<float>(step));
+	}
+	mRenderOutput = nullptr;
+	return true;
+}
+
+// Same as RenderOffline, but writes the audio to a 16-bit WAV file
+bool AudioSystem::RenderOfflineToWav(float seconds, const std::string& fileName,
+									 float updateTime)
+{
+	std::vector<float> samples;
+	return RenderOffline(seconds, samples, updateTime) &&
+		   WriteWav(fileName, samples, mSoftwareMixer->GetFrequency(),
+					mSoftwareMixer->GetOutputChannels());
+}
+
+// Writes interleaved float samples to a 16-bit WAV file
+bool AudioSystem::WriteWav(const std::string& fileName, std::span<const float> samples,
+						   int frequency, int channels)
+{
+	std::vector<int16_t> pcm(samples.size());
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		float sample = std::clamp(samples[i], -1.0f, 1.0f);
+		pcm[i] = static_cast<int16_t>(std::lround(sample * 32767.0f));
+	}
+
+	uint32_t dataSize = static_cast<uint32_t>(pcm.size() * sizeof(int16_t));
+	uint32_t riffSize = 36 + dataSize;
+	uint32_t fmtSize = 16;
+	uint16_t pcmFormat = 1;
+	uint16_t numChannels = static_cast<uint16_t>(channels);
+	uint32_t sampleRate = static_cast<uint32_t>(frequency);
+	uint16_t blockAlign = static_cast<uint16_t>(channels * sizeof(int16_t));
+	uint32_t byteRate = sampleRate * blockAlign;
+	uint16_t bitsPerSample = 16;
+
+	std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+	auto write = [&file](const auto& value) {
+		file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+	};
+	file.write("RIFF", 4);
+	write(riffSize);
+	file.write("WAVEfmt ", 8);
+	write(fmtSize);
+	write(pcmFormat);
+	write(numChannels);
+	write(sampleRate);
+	write(byteRate);
+	write(blockAlign);
+	write(bitsPerSample);
+	file.write("data", 4);
+	write(dataSize);
+	file.write(reinterpret_cast<const char*>(pcm.data()), dataSize);
+	if (!file)
+	{
+		SDL_Log("[AudioSystem] Couldn't write %s", fileName.c_str());
+		return false;
+	}
+	return true;
+}
+
+// Turns hot reloading on or off
+// Returns false if the folder couldn't be watched
+bool AudioSystem::SetHotReload(bool enabled)
+{
+#ifdef __linux__
+	if (mWatchFd != -1)
+	{
+		close(mWatchFd);
+		mWatchFd = -1;
+		mWatchFolders.clear();
+		mChangedSounds.clear();
+	}
+	if (!enabled)
+	{
+		return true;
+	}
+
+	// Non-blocking, so Update only has to try a read to see if anything
+	// changed
+	mWatchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (mWatchFd == -1)
+	{
+		SDL_Log("[AudioSystem] SetHotReload couldn't start inotify");
+		return false;
+	}
+	WatchSoundFolder("");
+	if (mWatchFolders.empty())
+	{
+		SDL_Log("[AudioSystem] SetHotReload couldn't watch Assets/Sounds");
+		SetHotReload(false);
+		return false;
+	}
+	return true;
+#else
+	if (enabled)
+	{
+		SDL_Log("[AudioSystem] SetHotReload is only supported on Linux");
+	}
+	return !enabled;
+#endif
+}
+
+// Watches the folder (relative to Assets/Sounds) and the folders in it for
+// changed files
+void AudioSystem::WatchSoundFolder(const std::string& folder)
+{
+#ifdef __linux__
+	// Editors tend to save to a temporary file and rename it over the old
+	// one, so moves count as changes too. Partial writes aren't watched,
+	// only the file being closed after them, and creating only matters for
+	// new folders.
+	std::string path = "Assets/Sounds/" + folder;
+	int watch = inotify_add_watch(mWatchFd, path.c_str(),
+								  IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+	if (watch == -1)
+	{
+		return;
+	}
+	mWatchFolders[watch] = folder;
+
+	std::error_code ec{};
+	for (const auto& entry : std::filesystem::directory_iterator{path, ec})
+	{
+		if (entry.is_directory(ec))
+		{
+			WatchSoundFolder(folder + entry.path().filename().string() + "/");
+		}
+	}
+#endif
+}
+
+// Queues the cached sounds whose files changed since the last Update, and
+// reloads them
+void AudioSystem::ReadSoundChanges()
+{
+#ifdef __linux__
+	alignas(inotify_event) char buffer[4096];
+	ssize_t length = 0;
+	while ((length = read(mWatchFd, buffer, sizeof(buffer))) > 0)
+	{
+		const char* next = buffer;
+		while (next < buffer + length)
+		{
+			const inotify_event* event = reinterpret_cast<const inotify_event*>(next);
+			next += sizeof(inotify_event) + event->len;
+
+			// Events were dropped, so anything could have changed
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				mChangedSounds.clear();
+				for (auto& [path, soundInfo] : mSounds)
+				{
+					mChangedSounds.emplace_back(&soundInfo);
+				}
+				continue;
+			}
+
+			auto folder = mWatchFolders.find(event->wd);
+			if (folder == mWatchFolders.end() || event->len == 0)
+			{
+				continue;
+			}
+			if (event->mask & IN_ISDIR)
+			{
+				WatchSoundFolder(folder->second + event->name + "/");
+				continue;
+			}
+
+			// A file that was just created is still being written, and is
+			// picked up when it's closed
+			if (event->mask & IN_CREATE)
+			{
+				continue;
+			}
+
+			// Sounds that haven't been used yet load the new file anyway
+			mPathBuffer = "Assets/Sounds/";
+			mPathBuffer += folder->second;
+			mPathBuffer += event->name;
+			auto iter = mSounds.find(mPathBuffer);
+			if (iter != mSounds.end() &&
+				std::find(mChangedSounds.begin(), mChangedSounds.end(), &iter->second) ==
+					mChangedSounds.end())
+			{
+				mChangedSounds.emplace_back(&iter->second);
+			}
+		}
+	}
+#endif
+
+	// A sound that's still loading may have read the old file, so it's
+	// reloaded once it's done
+	size_t numLeft = 0;
+	for (SoundInfo* soundInfo : mChangedSounds)
+	{
+		if (soundInfo->mLoad.valid())
+		{
+			mChangedSounds[numLeft++] = soundInfo;
+			continue;
+		}
+		if (soundInfo->mChunk != nullptr)
+		{
+			ReloadSound(*soundInfo);
+		}
+		if (soundInfo->mFileSize != 0)
+		{
+			IndexSound(*soundInfo);
+		}
+	}
+	mChangedSounds.resize(numLeft);
+}
+
+// Loads the sound's file again and moves its voices over to the new chunk
+// Keeps the old chunk if the file can't be loaded
+void AudioSystem::ReloadSound(SoundInfo& soundInfo)
+{
+	Mix_Chunk* chunk = DecodeSound(soundInfo);
+	if (!chunk)
+	{
+		SDL_Log("[AudioSystem] Failed to reload sound file %s", soundInfo.mPath.data());
+		return;
+	}
+
+	// Voices from PlayStream read the file themselves, so they're left alone
+	std::vector<SoundHandle> voices;
+	for (uint32_t slot = soundInfo.mVoices.mHead; slot != NO_SLOT;)
+	{
+		auto iter = mHandleMap.at_slot(slot);
+		slot = iter->second.mSoundLink.mNext;
+		if (iter->second.mStream == nullptr || iter->second.mStream->mAdpcm != nullptr)
+		{
+			voices.emplace_back(iter->first);
+		}
+	}
+	for (uint32_t index : mVirtualVoices)
+	{
+		auto iter = mHandleMap.at_slot(index);
+		if (iter->second.mSound == &soundInfo)
+		{
+			voices.emplace_back(iter->first);
+		}
+	}
+
+	// The channels have to let go of the old chunk before it's freed
+	for (SoundHandle sound : voices)
+	{
+		HandleInfo& info = mHandleMap[sound];
+		if (info.mChannel != -1)
+		{
+			HaltChannel(info.mChannel);
+		}
+		if (info.mStream != nullptr)
+		{
+			RemoveStream(info.mStream);
+			info.mStream = nullptr;
+			if (info.mChannel != -1)
+			{
+				// StartVoice takes it back out if it's still compressed
+				HeapPush<&HandleInfo::mDemotableIndex, true>(mDemotableVoices, sound.GetIndex());
+			}
+		}
+	}
+
+	FreeSoundChunk(soundInfo);
+	soundInfo.mChunk = chunk;
+	AddToCache(soundInfo);
+
+	// Voices pick up where they were in the new data, and one-shots that
+	// are past the end of it stop
+	for (SoundHandle sound : voices)
+	{
+		auto iter = mHandleMap.find(sound);
+		HandleInfo& info = iter->second;
+		info.mChunk = soundInfo.mChunk;
+		if (!info.mIsLooping && GetPlayPosition(info) >= GetSoundLength(soundInfo))
+		{
+			StopVoice(iter);
+		}
+		else if (info.mChannel != -1)
+		{
+			StartVoice(info.mChannel, info);
+		}
+	}
+}
+
+// Queues the sound for the loader thread (starting it if needed)
+LoadTicket AudioSystem::LoadSoundAsync(SoundInfo& soundInfo)
+{
+	soundInfo.mUnloadRequested = false;
+	if (soundInfo.mChunk != nullptr)
+	{
+		mCacheStats.mHits++;
+		std::promise<Mix_Chunk*> loaded;
+		loaded.set_value(soundInfo.mChunk);
+		return LoadTicket(loaded.get_future().share());
+	}
+
+	if (!soundInfo.mLoad.valid())
+	{
+		mCacheStats.mMisses++;
+		std::promise<Mix_Chunk*> chunk;
+		soundInfo.mLoad = chunk.get_future().share();
+		mLoadingSounds.emplace_back(&soundInfo);
+		{
+			std::lock_guard<std::mutex> lock(mLoadMutex);
+			if (!mLoaderThread.joinable())
+			{
+				mLoaderThread = std::thread(&AudioSystem::RunLoader, this);
+			}
+			mLoadQueue.emplace_back(&soundInfo, std::move(chunk));
+		}
+		mLoadQueued.notify_one();
+	}
+	return LoadTicket(soundInfo.mLoad);
+}
+
+// Runs on the loader thread, decoding queued sounds until shutdown
+void AudioSystem::RunLoader()
+{
+	std::unique_lock<std::mutex> lock(mLoadMutex);
+	while (true)
+	{
+		mLoadQueued.wait(lock, [this] { return mStopLoader || !mLoadQueue.empty(); });
+		if (mStopLoader)
+		{
+			break;
+		}
+
+		auto [soundInfo, chunk] = std::move(mLoadQueue.front());
+		mLoadQueue.pop_front();
+		lock.unlock();
+		chunk.set_value(DecodeSound(*soundInfo));
+		lock.lock();
+	}
+
+	// Anything still queued is never loaded
+	for (auto& [soundInfo, chunk] : mLoadQueue)
+	{
+		chunk.set_value(nullptr);
+	}
+	mLoadQueue.clear();
+}
+
+// Hands the decoded chunk from the loader thread to the sound, and starts
+// the voices waiting on it. If the sound didn't load and CacheSoundAsync
+// added it, it's removed from mSounds.
+void AudioSystem::FinishLoad(SoundInfo& soundInfo)
+{
+	Mix_Chunk* chunk = soundInfo.mLoad.get();
+	soundInfo.mLoad = std::shared_future<Mix_Chunk*>();
+	auto loading = std::find(mLoadingSounds.begin(), mLoadingSounds.end(), &soundInfo);
+	if (loading != mLoadingSounds.end())
+	{
+		*loading = mLoadingSounds.back();
+		mLoadingSounds.pop_back();
+	}
+
+	soundInfo.mChunk = chunk;
+	if (chunk)
+	{
+		AddToCache(soundInfo);
+	}
+	else
+	{
+		SDL_Log("[AudioSystem] Failed to load sound file %s", soundInfo.mPath.data());
+	}
+
+	// Voices of the sound start from the top now (or stop if it failed),
+	// keeping the voices of other sounds in order
+	size_t numLeft = 0;
+	for (SoundHandle sound : mLoadingVoices)
+	{
+		auto iter = mHandleMap.find(sound);
+		if (iter == mHandleMap.end())
+		{
+			// Stopped while it was loading
+			continue;
+		}
+
+		HandleInfo& info = iter->second;
+		if (info.mSound != &soundInfo)
+		{
+			mLoadingVoices[numLeft++] = sound;
+		}
+		else if (!chunk)
+		{
+			StopVoice(iter);
+		}
+		else
+		{
+			// AddToCache may have switched it for a shared chunk
+			info.mChunk = soundInfo.mChunk;
+			info.mStartTime = mTime;
+			info.mPauseTime = mTime;
+			if (info.mChannel != -1)
+			{
+				StartVoice(info.mChannel, info);
+			}
+		}
+	}
+	mLoadingVoices.resize(numLeft);
+
+	// UnloadSound may have been called while it was loading
+	ReleaseIfUnused(soundInfo);
+
+	// Its voices were all stopped above, so nothing refers to it unless
+	// RegisterSound gave it a SoundId
+	if (!chunk && soundInfo.mRemoveIfLoadFails && !soundInfo.mId.IsValid())
+	{
+		auto changed = std::find(mChangedSounds.begin(), mChangedSounds.end(), &soundInfo);
+		if (changed != mChangedSounds.end())
+		{
+			mChangedSounds.erase(changed);
+		}
+		RemoveSoundInfo(soundInfo);
+	}
+	else
+	{
+		soundInfo.mRemoveIfLoadFails = false;
+	}
+}
+
+// Calls FinishLoad for the sounds the loader thread has decoded
+void AudioSystem::UpdateLoadingSounds()
+{
+	// FinishLoad swaps the last sound into the one it removes, which has
+	// already been checked when going backwards
+	for (size_t i = mLoadingSounds.size(); i-- > 0;)
+	{
+		if (mLoadingSounds[i]->mLoad.wait_for(std::chrono::seconds(0)) ==
+			std::future_status::ready)
+		{
+			FinishLoad(*mLoadingSounds[i]);
+		}
+	}
+}
+
+// Loads the chunks for all the sounds that aren't loaded yet, decoding
+// them on the decode workers (the calling thread is one of them). The
+// workers only write to their own slot in chunks, and the results are
+// merged into the SoundInfos once every decode has finished.
+void AudioSystem::LoadSounds(std::span<SoundInfo* const> sounds)
+{
+	std::vector<SoundInfo*> toLoad;
+	toLoad.reserve(sounds.size());
+	for (SoundInfo* soundInfo : sounds)
+	{
+		soundInfo->mUnloadRequested = false;
+		if (soundInfo->mChunk != nullptr)
+		{
+			mCacheStats.mHits++;
+		}
+		else if (!soundInfo->mLoad.valid())
+		{
+			toLoad.emplace_back(soundInfo);
+		}
+	}
+
+	std::vector<Mix_Chunk*> chunks(toLoad.size(), nullptr);
+	size_t numWorkers = std::max(std::thread::hardware_concurrency(), 1u) - 1;
+	bool useWorkers = toLoad.size() > 1 && numWorkers > 0;
+	{
+		std::lock_guard<std::mutex> lock(mDecodeMutex);
+		// The workers are started once and kept for later calls
+		while (useWorkers && mDecodeWorkers.size() < numWorkers)
+		{
+			mDecodeWorkers.emplace_back(&AudioSystem::RunDecodeWorker, this, mDecodeBatch);
+		}
+		mDecodeSounds = toLoad;
+		mDecodeChunks = chunks.data();
+		mDecodeNext = 0;
+		mDecodeBytes = 0;
+		// With a budget, sounds stop being decoded once they fill what's
+		// left of it, rather than decoding them all and evicting the rest
+		mDecodeRoom = std::numeric_limits<size_t>::max();
+		if (mCacheBudget != 0)
+		{
+			mDecodeRoom = mCacheBudget > mCacheStats.mResidentBytes
+							  ? mCacheBudget - mCacheStats.mResidentBytes
+							  : 0;
+		}
+		if (useWorkers)
+		{
+			mDecodeBusy = mDecodeWorkers.size();
+			mDecodeBatch++;
+		}
+	}
+	if (useWorkers)
+	{
+		mDecodeStart.notify_all();
+	}
+	DecodeBatch();
+	if (useWorkers)
+	{
+		std::unique_lock<std::mutex> lock(mDecodeMutex);
+		mDecodeDone.wait(lock, [this] { return mDecodeBusy == 0; });
+	}
+	mDecodeSounds = {};
+	mDecodeChunks = nullptr;
+
+	// Every sound before the first one no worker took was decoded
+	toLoad.resize(std::min(mDecodeNext.load(), toLoad.size()));
+	mCacheStats.mMisses += toLoad.size();
+	for (size_t i = 0; i < toLoad.size(); i++)
+	{
+		toLoad[i]->mChunk = chunks[i];
+		if (chunks[i])
+		{
+			AddToCache(*toLoad[i]);
+		}
+		else
+		{
+			SDL_Log("[AudioSystem] Failed to load sound file %s", toLoad[i]->mPath.data());
+		}
+	}
+
+	// Sounds that were already loading on the loader thread aren't loaded
+	// again (or waited on), and land on the Update after they're decoded
+}
+
+// Decodes sounds from the batch LoadSounds handed out until none are left,
+// or the ones decoded so far fill the room left in the budget. The check
+// comes before taking a sound, so every sound taken is decoded.
+void AudioSystem::DecodeBatch()
+{
+	while (mDecodeBytes < mDecodeRoom)
+	{
+		size_t i = mDecodeNext++;
+		if (i >= mDecodeSounds.size())
+		{
+			break;
+		}
+		Mix_Chunk* chunk = DecodeSound(*mDecodeSounds[i]);
+		if (chunk != nullptr && !IsBankChunk(chunk))
+		{
+			mDecodeBytes += chunk->alen;
+		}
+		mDecodeChunks[i] = chunk;
+	}
+}
+
+// Runs on a decode worker, helping with each batch from LoadSounds (after
+// the one it was started in) until shutdown
+void AudioSystem::RunDecodeWorker(uint64_t batch)
+{
+	std::unique_lock<std::mutex> lock(mDecodeMutex);
+	while (true)
+	{
+		mDecodeStart.wait(lock, [this, batch] { return mStopDecode || mDecodeBatch != batch; });
+		if (mStopDecode)
+		{
+			break;
+		}
+
+		batch = mDecodeBatch;
+		lock.unlock();
+		DecodeBatch();
+		lock.lock();
+		if (--mDecodeBusy == 0)
+		{
+			mDecodeDone.notify_one();
+		}
+	}
+}
+
+// Claims the lowest-numbered free channel in constant time
+// Returns -1 if every channel is in use
+int AudioSystem::ClaimFreeChannel()
+{
+	for (size_t i = 0; i < mFreeChannelSummary.size(); i++)
+	{
+		if (mFreeChannelSummary[i] != 0)
+		{
+			size_t word = i * 64 + std::countr_zero(mFreeChannelSummary[i]);
+			int bit = std::countr_zero(mFreeChannelBits[word]);
+			mFreeChannelBits[word] &= ~(uint64_t{1} << bit);
+			if (mFreeChannelBits[word] == 0)
+			{
+				mFreeChannelSummary[i] &= ~(uint64_t{1} << (word % 64));
+			}
+			return static_cast<int>(word * 64 + bit);
+		}
+	}
+	return -1;
+}
 
-// Create the AudioSystem with specified number of channels
-// (Defaults to 8 channels)
-AudioSystem::AudioSystem(int numChannels)
+// Flags the channel as free again so ClaimFreeChannel can hand it out
+void AudioSystem::ReleaseChannel(int channel)
 {
+	size_t word = static_cast<size_t>(channel) / 64;
+	mFreeChannelBits[word] |= uint64_t{1} << (channel % 64);
+	mFreeChannelSummary[word / 64] |= uint64_t{1} << (word % 64);
+}
 
-	Mix_OpenAudio(0, nullptr);
-	Mix_AllocateChannels(numChannels);
-	mChannels.resize(numChannels);
+// Resets the free channel bitmask so every channel is free
+void AudioSystem::ResetFreeChannels()
+{
+	size_t numWords = (mChannels.size() + 63) / 64;
+	mFreeChannelBits.assign(numWords, 0);
+	mFreeChannelSummary.assign((numWords + 63) / 64, 0);
+	for (int i = 0; i < static_cast<int>(mChannels.size()); i++)
+	{
+		ReleaseChannel(i);
+	}
 }
 
-// Destroy the AudioSystem
-AudioSystem::~AudioSystem()
+// Frees the channel and gives it to a virtual voice if there is one
+void AudioSystem::FreeChannel(int channel)
 {
-	for (auto const& [s, m] : mSounds)
+	mChannels[channel].Reset();
+	ReleaseChannel(channel);
+	if (!mVirtualVoices.empty())
 	{
-		Mix_FreeChunk(m);
+		PromoteVirtualVoices();
 	}
-	mSounds.clear();
-	Mix_CloseAudio();
 }
 
-// Updates the status of all the active sounds every frame
-void AudioSystem::Update(float deltaTime)
+// Plays the voice on the channel, starting from where it is in the sound
+void AudioSystem::StartVoice(int channel, HandleInfo& info)
 {
-	// Every frame, you need to do a regular for loop over mChannels.
-	// For any indices which have an IsValid() SoundHandle, use Mix_Playing
-	// to see if that sound is still playing on its corresponding SDL channel number.
+	// A voice of a sound that's still loading is started by FinishLoad
+	Mix_Chunk* chunk = info.mChunk;
+	if (chunk == nullptr)
+	{
+		return;
+	}
+	int loops = info.mIsLooping ? -1 : 0;
 
-	std::vector<SoundHandle> toRemove = {};
-	for (int i = 0; i < mChannels.size(); i++)
+	// One-shots pick up where they are using a view into the cached chunk.
+	// Loops restart from the top, since SDL_mixer can only loop a whole chunk.
+	Uint32 offset = 0;
+	if (!info.mIsLooping)
 	{
-		if (mChannels[i].IsValid())
+		offset = static_cast<Uint32>(GetPlayPosition(info) * mBytesPerSecond);
+		offset -= offset % mFrameSize;
+	}
+	else
+	{
+		info.mStartTime = info.mIsPaused ? info.mPauseTime : mTime;
+	}
+
+	// A compressed sound is decoded into the voice's own buffers as it plays
+	if (!info.mSound->mAdpcm.empty())
+	{
+		auto stream = std::make_unique<StreamInfo>();
+		stream->mIsLooping = info.mIsLooping;
+		OpenStream(*stream, *info.mSound);
+		stream->mReadPos = std::min<uint64_t>(offset, stream->mDataLength);
+		PrimeStream(*stream);
+		StartStream(channel, info, std::move(stream));
+		return;
+	}
+	if (offset > 0 && offset < chunk->alen)
+	{
+		Mix_Chunk& view = mChannelViews[channel];
+		view = *chunk;
+		view.allocated = 0;
+		view.abuf += offset;
+		view.alen -= offset;
+		chunk = &view;
+	}
+
+	SetChannelVolume(channel, info.mVolume);
+	SetChannelPan(channel, info.mPan);
+	PlayChannel(channel, chunk, loops);
+	if (info.mIsPaused)
+	{
+		PauseChannel(channel);
+	}
+}
+
+// Takes the channel of the lowest priority voice (making it virtual) if
+// it's a lower priority than the one specified
+// Returns -1 if no voice is a lower priority
+int AudioSystem::DemoteVoice(int priority)
+{
+	if (mDemotableVoices.empty())
+	{
+		return -1;
+	}
+	auto victim = mHandleMap.at_slot(mDemotableVoices[0]);
+	if (victim->second.mPriority >= priority)
+	{
+		return -1;
+	}
+
+	int channel = victim->second.mChannel;
+	HaltChannel(channel);
+	UnbindVoice(victim->first, victim->second);
+	AddVirtualVoice(victim->second, victim->first);
+	return channel;
+}
+
+// Adds/removes the voice from the list of virtual voices
+// Adding one past MAX_VIRTUAL_VOICES stops the lowest priority virtual voice
+void AudioSystem::AddVirtualVoice(HandleInfo& info, SoundHandle sound)
+{
+	info.mChannel = -1;
+	HeapPush<&HandleInfo::mVirtualIndex, false>(mVirtualVoices, sound.GetIndex());
+	HeapPush<&HandleInfo::mVictimIndex, true>(mVirtualVictims, sound.GetIndex());
+	if (mVirtualVoices.size() <= MAX_VIRTUAL_VOICES)
+	{
+		return;
+	}
+
+	// Same order DemoteVoice picks its victim in
+	auto victim = mHandleMap.at_slot(mVirtualVictims[0]);
+	RemoveVirtualVoice(victim->second);
+	EraseVoice(victim);
+}
+
+void AudioSystem::RemoveVirtualVoice(HandleInfo& info)
+{
+	HeapRemove<&HandleInfo::mVirtualIndex, false>(mVirtualVoices, info);
+	HeapRemove<&HandleInfo::mVictimIndex, true>(mVirtualVictims, info);
+}
+
+// Gives free channels to the highest priority virtual voices
+void AudioSystem::PromoteVirtualVoices()
+{
+	while (!mVirtualVoices.empty())
+	{
+		auto best = mHandleMap.at_slot(mVirtualVoices[0]);
+
+		// A one-shot that already ended just gets dropped
+		HandleInfo& info = best->second;
+		if (!info.mIsLooping && GetPlayPosition(info) >= GetSoundLength(*info.mSound))
 		{
-			int playing = Mix_Playing(i);
-			//If the sound is NOT playing anymore, this means you need to remove that SoundHandle
-			//from the mHandleMap and you should reset that index in mChannels with
-			//.Reset() as the channel should be flagged as available again.
-			if (playing == 0) // 0 = not playing
-			{
-				auto iter = mHandleMap.find(mChannels[i]); // Make a new one so don't dereference
-				mHandleMap.erase(iter);
-				mChannels[i].Reset();
-			}
+			RemoveVirtualVoice(info);
+			EraseVoice(best);
+			continue;
+		}
+
+		int channel = ClaimFreeChannel();
+		if (channel == -1)
+		{
+			return;
 		}
+
+		RemoveVirtualVoice(info);
+		BindVoice(channel, best->first, info);
+		StartVoice(channel, info);
 	}
 }
 
-// Plays the sound with the specified name and loops if looping is true
-// Returns the SoundHandle which is used to perform any other actions on the
-// sound when active
-// NOTE: The soundName is without the "Assets/Sounds/" part of the file
-//       For example, pass in "ChompLoop.wav" rather than
-//       "Assets/Sounds/ChompLoop.wav".
-SoundHandle AudioSystem::PlaySound(const std::string& soundName, bool looping)
+// Stops virtual one-shots that have reached the end of their sound
+void AudioSystem::UpdateVirtualVoices()
 {
-	Mix_Chunk* sound = GetSound(soundName);
-	if (sound == nullptr)
+	// Removing from the heap reorders it, so the ended ones are found first
+	mEndedVoices.clear();
+	for (uint32_t index : mVirtualVoices)
+	{
+		const HandleInfo& info = mHandleMap.at_slot(index)->second;
+		if (!info.mIsLooping && !info.mIsPaused &&
+			GetPlayPosition(info) >= GetSoundLength(*info.mSound))
+		{
+			mEndedVoices.emplace_back(index);
+		}
+	}
+	for (uint32_t index : mEndedVoices)
+	{
+		auto iter = mHandleMap.at_slot(index);
+		RemoveVirtualVoice(iter->second);
+		EraseVoice(iter);
+	}
+}
+
+// Returns the voice a new PlaySound of the sound should be merged into
+// because of its SoundPolicy (after applying the volume boost), or an
+// invalid handle if it should start a new voice
+SoundHandle AudioSystem::MergeVoice(SoundInfo* soundInfo, bool looping)
+{
+	const SoundPolicy& policy = soundInfo->mPolicy;
+	bool atMax = policy.mMaxInstances > 0 && soundInfo->mNumVoices >= policy.mMaxInstances;
+	bool tooSoon = mTime - soundInfo->mLastStartTime < policy.mMinRetriggerInterval;
+	if (!atMax && !tooSoon)
 	{
-		SDL_Log("[AudioSystem] PlaySound couldn't find sound for %s", soundName.c_str());
 		return SoundHandle::Invalid;
 	}
-	//Find the first available channel
-	int firstAvailChannel = -1; //-1 for not yet set
-	for (int i = 0; i < mChannels.size(); i++)
+
+	// Merge into the newest voice, or the newest one with a channel if that
+	// one already stopped. A loop and a one-shot never merge, since one
+	// would play for the wrong length, so then it's a new voice after all.
+	auto iter = mHandleMap.find(soundInfo->mLastVoice);
+	if (iter != mHandleMap.end() && iter->second.mIsLooping != looping)
+	{
+		iter = mHandleMap.end();
+	}
+	if (iter == mHandleMap.end() && atMax)
 	{
-		if (firstAvailChannel == -1)
+		for (uint32_t slot = soundInfo->mVoices.mTail; slot != NO_SLOT;)
 		{
-			if (!mChannels[i].IsValid())
+			auto voice = mHandleMap.at_slot(slot);
+			if (voice->second.mIsLooping == looping)
 			{
-				firstAvailChannel = i;
+				iter = voice;
+				break;
 			}
+			slot = voice->second.mSoundLink.mPrev;
 		}
 	}
+	if (iter == mHandleMap.end())
+	{
+		return SoundHandle::Invalid;
+	}
 
-	//Increment
-	++mLastHandle;
-	SoundHandle soundHandle = SoundHandle(mLastHandle);
-
-	//Handle info
-	HandleInfo handleInfo = HandleInfo(soundName, firstAvailChannel, looping, false);
+	HandleInfo& info = iter->second;
+	if (policy.mMergeVolumeBoost != 0)
+	{
+		info.mVolume = std::clamp(info.mVolume + policy.mMergeVolumeBoost, 0, MIX_MAX_VOLUME);
+		if (info.mChannel != -1)
+		{
+			SetChannelVolume(info.mChannel, info.mVolume);
+		}
+	}
+	return iter->first;
+}
 
-	//Put in map
-	mHandleMap.emplace(soundHandle, handleInfo);
-	mChannels[firstAvailChannel] = soundHandle;
+// Stops the voice and erases its handle
+void AudioSystem::StopVoice(HandleMap<HandleInfo>::iterator iter)
+{
+	int channel = iter->second.mChannel;
+	if (channel == -1)
+	{
+		RemoveVirtualVoice(iter->second);
+		EraseVoice(iter);
+	}
+	else
+	{
+		HaltChannel(channel);
+		UnbindVoice(iter->first, iter->second);
+		EraseVoice(iter);
+		FreeChannel(channel);
+	}
+}
 
-	//Play the sound
-	int loopInt = (looping) ? -1 : 0;
-	Mix_PlayChannel(firstAvailChannel, sound, loopInt);
+// Channel operations, which go to the software mixer if it's on, or else
+// SDL_mixer
+void AudioSystem::HaltChannel(int channel)
+{
+	if (mSoftwareMixer)
+	{
+		mSoftwareMixer->HaltChannel(channel);
+	}
+	else
+	{
+		Mix_HaltChannel(channel);
+	}
+}
 
-	return soundHandle;
+void AudioSystem::PlayChannel(int channel, Mix_Chunk* chunk, int loops)
+{
+	if (mSoftwareMixer)
+	{
+		mSoftwareMixer->PlayChannel(channel, chunk, loops);
+	}
+	else
+	{
+		Mix_PlayChannel(channel, chunk, loops);
+	}
 }
 
-// Stops the sound if it is currently playing
-void AudioSystem::StopSound(SoundHandle sound)
+void AudioSystem::PauseChannel(int channel)
 {
-	auto iter = mHandleMap.find(sound);
-	if (iter == mHandleMap.end())
+	if (mSoftwareMixer)
 	{
-		SDL_Log("[AudioSystem] StopSound couldn't find handle %s", sound.GetDebugStr());
+		mSoftwareMixer->Pause(channel);
 	}
 	else
 	{
-		Mix_HaltChannel(iter->second.mChannel);
-		mChannels[iter->second.mChannel].Reset();
-		mHandleMap.erase(iter);
+		Mix_Pause(channel);
 	}
 }
 
-// Pauses the sound if it is currently playing
-void AudioSystem::PauseSound(SoundHandle sound)
+void AudioSystem::ResumeChannel(int channel)
 {
-	auto iter = mHandleMap.find(sound);
-	if (iter == mHandleMap.end())
+	if (mSoftwareMixer)
 	{
-		SDL_Log("[AudioSystem] PauseSound couldn't find handle %s", sound.GetDebugStr());
+		mSoftwareMixer->Resume(channel);
 	}
 	else
 	{
-		HandleInfo info = iter->second;
-		if (!info.mIsPaused) // If not yet paused
-		{
-			Mix_Pause(info.mChannel);
-			//Would use info.mIsPaused here, but I think it's not actually setting the value
-			iter->second.mIsPaused = true;
-		}
+		Mix_Resume(channel);
 	}
 }
 
-// Resumes the sound if it is currently paused
-void AudioSystem::ResumeSound(SoundHandle sound)
+bool AudioSystem::IsChannelPlaying(int channel) const
 {
-	auto iter = mHandleMap.find(sound);
-	if (iter == mHandleMap.end())
+	return mSoftwareMixer ? mSoftwareMixer->IsPlaying(channel) : Mix_Playing(channel) != 0;
+}
+
+void AudioSystem::RegisterEffect(int channel, Mix_EffectFunc_t effect, void* userData)
+{
+	if (mSoftwareMixer)
 	{
-		SDL_Log("[AudioSystem] PauseSound couldn't find handle %s", sound.GetDebugStr());
+		mSoftwareMixer->RegisterEffect(channel, effect, nullptr, userData);
 	}
 	else
 	{
-		HandleInfo info = iter->second;
-		if (info.mIsPaused) // If not yet paused
+		Mix_RegisterEffect(channel, effect, nullptr, userData);
+	}
+}
+
+// Pauses/resumes the voice if it isn't already
+void AudioSystem::PauseVoice(HandleInfo& info)
+{
+	if (!info.mIsPaused)
+	{
+		if (info.mChannel != -1)
 		{
-			Mix_Resume(info.mChannel);
-			//Would use info.mIsPaused here, but I think it's not actually setting the value
-			iter->second.mIsPaused = false;
+			PauseChannel(info.mChannel);
 		}
+		info.mIsPaused = true;
+		info.mPauseTime = mTime;
 	}
 }
 
-// Returns the current state of the sound
-SoundState AudioSystem::GetSoundState(SoundHandle sound) const
+void AudioSystem::ResumeVoice(HandleInfo& info)
 {
-	auto iter = mHandleMap.find(sound);
-	if (iter == mHandleMap.end())
+	if (info.mIsPaused)
 	{
-		return SoundState::Stopped;
+		if (info.mChannel != -1)
+		{
+			ResumeChannel(info.mChannel);
+		}
+		info.mIsPaused = false;
+		info.mStartTime += mTime - info.mPauseTime;
 	}
-	//Referenced Process input
-	if (iter->second.mIsPaused)
+}
+
+// Erases the handle of a voice that has stopped (freeing its sound if it
+// was the last voice and UnloadSound asked for it)
+void AudioSystem::EraseVoice(HandleMap<HandleInfo>::iterator iter)
+{
+	HandleInfo& info = iter->second;
+	SoundInfo* soundInfo = info.mSound;
+	soundInfo->mNumVoices--;
+	if (info.mBus != nullptr)
 	{
-		return SoundState::Paused;
+		Unlink<&HandleInfo::mBusLink>(info.mBus->mVoices, iter->first.GetIndex());
 	}
-	return SoundState::Playing;
+	if (info.mStream != nullptr)
+	{
+		RemoveStream(info.mStream);
+	}
+	mHandleMap.erase(iter);
+	ReleaseIfUnused(*soundInfo);
 }
 
-// Stops all sounds on all channels
-void AudioSystem::StopAllSounds()
+// Sets the channel's volume, ramping to it over rampTime seconds if the
+// software mixer is on
+void AudioSystem::SetChannelVolume(int channel, int volume, float rampTime)
 {
-	Mix_HaltChannel(-1);
-	for (SoundHandle handle : mChannels)
+	if (mSoftwareMixer)
 	{
-		handle.Reset();
+		mChannelVolumes[channel] = volume;
+		mSoftwareMixer->SetVolume(channel, volume, GetRampFrames(rampTime));
+	}
+	else if (mChannelVolumes[channel] != volume)
+	{
+		mChannelVolumes[channel] = volume;
+		Mix_Volume(channel, volume);
 	}
-	mHandleMap.clear();
 }
 
-// Cache all sounds under Assets/Sounds
-void AudioSystem::CacheAllSounds()
+// Sets the channel's pan, ramping to it over rampTime seconds if the
+// software mixer is on
+void AudioSystem::SetChannelPan(int channel, float pan, float rampTime)
 {
-#ifndef __clang_analyzer__
-	std::error_code ec{};
-	for (const auto& rootDirEntry : std::filesystem::directory_iterator{"Assets/Sounds", ec})
+	if (mSoftwareMixer)
 	{
-		std::string extension = rootDirEntry.path().extension().string();
-		if (extension == ".ogg" || extension == ".wav")
-		{
-			std::string fileName = rootDirEntry.path().stem().string();
-			fileName += extension;
-			CacheSound(fileName);
-		}
+		mChannelPans[channel] = pan;
+		mSoftwareMixer->SetPan(channel, pan, GetRampFrames(rampTime));
+	}
+	else if (mChannelPans[channel] != pan)
+	{
+		mChannelPans[channel] = pan;
+		SetMixPanning(channel, pan);
 	}
-#endif
 }
 
-// Used to preload the sound data of a sound
-// NOTE: The soundName is without the "Assets/Sounds/" part of the file
-//       For example, pass in "ChompLoop.wav" rather than
-//       "Assets/Sounds/ChompLoop.wav".
-void AudioSystem::CacheSound(const std::string& soundName)
+// Calls Mix_SetPanning with the levels for the pan
+void AudioSystem::SetMixPanning(int channel, float pan)
 {
-	GetSound(soundName);
+	// Same as the software mixer, the far speaker fades out
+	auto toLevel = [](float gain) { return static_cast<Uint8>(std::lround(gain * 255.0f)); };
+	Mix_SetPanning(channel, toLevel(std::min(1.0f, 1.0f - pan)),
+				   toLevel(std::min(1.0f, 1.0f + pan)));
 }
 
-// If the sound is already loaded, returns Mix_Chunk from the map.
-// Otherwise, will attempt to load the file and save it in the map.
-// Returns nullptr if sound is not found.
-// NOTE: The soundName is without the "Assets/Sounds/" part of the file
-//       For example, pass in "ChompLoop.wav" rather than
-//       "Assets/Sounds/ChompLoop.wav".
-Mix_Chunk* AudioSystem::GetSound(const std::string& soundName)
+// Returns the software mixer's frames in rampTime seconds
+size_t AudioSystem::GetRampFrames(float rampTime) const
 {
-	std::string fileName = "Assets/Sounds/";
-	fileName += soundName;
+	double frames = std::max(static_cast<double>(rampTime), 0.0) * mSoftwareMixer->GetFrequency();
+	return static_cast<size_t>(std::llround(frames));
+}
 
-	Mix_Chunk* chunk = nullptr;
-	auto iter = mSounds.find(fileName);
-	if (iter != mSounds.end())
+// Gives the channel to the voice and adds it to the age lists (and
+// mDemotableVoices)
+void AudioSystem::BindVoice(int channel, SoundHandle sound, HandleInfo& info)
+{
+	info.mChannel = channel;
+	mChannels[channel] = sound;
+	PushBack<&HandleInfo::mSoundLink>(info.mSound->mVoices, sound.GetIndex());
+	PushBack<&HandleInfo::mLoopLink>(info.mIsLooping ? mLoopingVoices : mOneShotVoices,
+									 sound.GetIndex());
+	if (info.mStream == nullptr)
+	{
+		HeapPush<&HandleInfo::mDemotableIndex, true>(mDemotableVoices, sound.GetIndex());
+	}
+}
+
+// Takes the channel away from the voice and removes it from the age
+// lists and mDemotableVoices (the channel is not released)
+void AudioSystem::UnbindVoice(SoundHandle sound, HandleInfo& info)
+{
+	Unlink<&HandleInfo::mSoundLink>(info.mSound->mVoices, sound.GetIndex());
+	Unlink<&HandleInfo::mLoopLink>(info.mIsLooping ? mLoopingVoices : mOneShotVoices,
+								   sound.GetIndex());
+	if (info.mDemotableIndex != NO_SLOT)
+	{
+		HeapRemove<&HandleInfo::mDemotableIndex, true>(mDemotableVoices, info);
+	}
+	mChannels[info.mChannel].Reset();
+	info.mChannel = -1;
+}
+
+// Stops the voice to steal from when every channel is busy, which is
+// the oldest instance of the same sound, then the oldest non-looping
+// sound, then the oldest sound. Returns the stolen channel.
+int AudioSystem::StealChannel(SoundInfo* sound)
+{
+	uint32_t victim = sound->mVoices.mHead;
+	if (victim == NO_SLOT)
+	{
+		victim = mOneShotVoices.mHead;
+	}
+	if (victim == NO_SLOT)
+	{
+		// Everything left is looping, so this is the oldest sound
+		victim = mLoopingVoices.mHead;
+	}
+	if (victim == NO_SLOT)
+	{
+		return -1;
+	}
+
+	auto iter = mHandleMap.at_slot(victim);
+	int channel = iter->second.mChannel;
+	HaltChannel(channel);
+	UnbindVoice(iter->first, iter->second);
+	EraseVoice(iter);
+	return channel;
+}
+
+// Intrusive age list operations for the specified link member
+template <AudioSystem::AgeLink AudioSystem::HandleInfo::*Link>
+void AudioSystem::PushBack(AgeList& list, uint32_t index)
+{
+	AgeLink& link = mHandleMap.at_slot(index)->second.*Link;
+	link.mPrev = list.mTail;
+	link.mNext = NO_SLOT;
+	if (list.mTail != NO_SLOT)
+	{
+		(mHandleMap.at_slot(list.mTail)->second.*Link).mNext = index;
+	}
+	else
+	{
+		list.mHead = index;
+	}
+	list.mTail = index;
+}
+
+template <AudioSystem::AgeLink AudioSystem::HandleInfo::*Link>
+void AudioSystem::Unlink(AgeList& list, uint32_t index)
+{
+	AgeLink& link = mHandleMap.at_slot(index)->second.*Link;
+	if (link.mPrev != NO_SLOT)
+	{
+		(mHandleMap.at_slot(link.mPrev)->second.*Link).mNext = link.mNext;
+	}
+	else
 	{
-		chunk = iter->second;
+		list.mHead = link.mNext;
+	}
+	if (link.mNext != NO_SLOT)
+	{
+		(mHandleMap.at_slot(link.mNext)->second.*Link).mPrev = link.mPrev;
 	}
 	else
 	{
-		chunk = Mix_LoadWAV(fileName.c_str());
-		if (!chunk)
+		list.mTail = link.mPrev;
+	}
+	link = AgeLink();
+}
+
+template <uint32_t AudioSystem::HandleInfo::*Index, bool LowestFirst>
+void AudioSystem::HeapPush(std::vector<uint32_t>& heap, uint32_t index)
+{
+	heap.emplace_back(index);
+	HeapSift<Index, LowestFirst>(heap, static_cast<uint32_t>(heap.size() - 1));
+}
+
+template <uint32_t AudioSystem::HandleInfo::*Index, bool LowestFirst>
+void AudioSystem::HeapRemove(std::vector<uint32_t>& heap, HandleInfo& info)
+{
+	// The last voice fills the hole, and is moved up or down from there
+	uint32_t pos = info.*Index;
+	info.*Index = NO_SLOT;
+	uint32_t last = heap.back();
+	heap.pop_back();
+	if (pos < heap.size())
+	{
+		heap[pos] = last;
+		HeapSift<Index, LowestFirst>(heap, pos);
+	}
+}
+
+// Moves the voice at pos up or down to where it belongs in the heap
+template <uint32_t AudioSystem::HandleInfo::*Index, bool LowestFirst>
+void AudioSystem::HeapSift(std::vector<uint32_t>& heap, uint32_t pos)
+{
+	auto isAbove = [this](uint32_t a, uint32_t b) {
+		const HandleInfo& infoA = mHandleMap.at_slot(a)->second;
+		const HandleInfo& infoB = mHandleMap.at_slot(b)->second;
+		if (infoA.mPriority != infoB.mPriority)
+		{
+			return (infoA.mPriority < infoB.mPriority) == LowestFirst;
+		}
+		return infoA.mPlayOrder < infoB.mPlayOrder;
+	};
+	auto place = [this, &heap](uint32_t pos, uint32_t index) {
+		heap[pos] = index;
+		mHandleMap.at_slot(index)->second.*Index = pos;
+	};
+
+	uint32_t index = heap[pos];
+	while (pos > 0 && isAbove(index, heap[(pos - 1) / 2]))
+	{
+		place(pos, heap[(pos - 1) / 2]);
+		pos = (pos - 1) / 2;
+	}
+	while (true)
+	{
+		size_t child = 2 * static_cast<size_t>(pos) + 1;
+		if (child >= heap.size())
 		{
-			SDL_Log("[AudioSystem] Failed to load sound file %s", fileName.c_str());
-			return nullptr;
+			break;
 		}
+		if (child + 1 < heap.size() && isAbove(heap[child + 1], heap[child]))
+		{
+			child++;
+		}
+		if (!isAbove(heap[child], index))
+		{
+			break;
+		}
+		place(pos, heap[child]);
+		pos = static_cast<uint32_t>(child);
+	}
+	place(pos, index);
+}
+
+// How far (in seconds) the voice is into its sound
+double AudioSystem::GetPlayPosition(const HandleInfo& info) const
+{
+	double now = info.mIsPaused ? info.mPauseTime : mTime;
+	return now - info.mStartTime;
+}
 
-		mSounds.emplace(fileName, chunk);
+// Length (in seconds) of the sound once it's decoded
+double AudioSystem::GetSoundLength(const SoundInfo& soundInfo) const
+{
+	// A sound that's still loading doesn't end until it has started
+	if (soundInfo.mChunk == nullptr)
+	{
+		return std::numeric_limits<double>::infinity();
+	}
+	if (!soundInfo.mAdpcm.empty())
+	{
+		return static_cast<double>(soundInfo.mPcmLength) / mBytesPerSecond;
 	}
-	return chunk;
+	return static_cast<double>(soundInfo.mChunk->alen) / mBytesPerSecond;
 }
 
 // Input for debugging purposes
@@ -252,9 +3201,10 @@ void AudioSystem::ProcessInput(const bool keys[])
 				if (iter != mHandleMap.end())
 				{
 					HandleInfo& hi = iter->second;
-					SDL_Log("Channel %d: %s, %s, looping = %d, paused = %d",
+					SDL_Log("Channel %d: %s, %.*s, looping = %d, paused = %d",
 							static_cast<unsigned>(i), mChannels[i].GetDebugStr(),
-							hi.mSoundName.c_str(), hi.mIsLooping, hi.mIsPaused);
+							static_cast<int>(hi.mSoundName.size()), hi.mSoundName.data(),
+							hi.mIsLooping, hi.mIsPaused);
 				}
 				else
 				{
@@ -263,6 +3213,12 @@ void AudioSystem::ProcessInput(const bool keys[])
 				}
 			}
 		}
+
+		// Virtual voices don't show up in mChannels
+		if (!mVirtualVoices.empty())
+		{
+			SDL_Log("Virtual voices: %d", static_cast<int>(mVirtualVoices.size()));
+		}
 	}
 
 	mLastDebugKey = keys[SDL_SCANCODE_PERIOD];
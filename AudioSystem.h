@@ -1,14 +1,41 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <span>
 #include <unordered_map>
-#include <map>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
+#include "SDL3/SDL.h"
 #include "SDL3_mixer/SDL_mixer.h"
+#include "SoftwareMixer.h"
+#include "SoundBank.h"
 
 // SoundHandles are used to operate on active sounds
+// The ID packs the HandleMap slot index in the low 16 bits and the slot's
+// generation in the high 16 bits, so a handle to a slot that has since been
+// reused no longer matches.
 class SoundHandle
 {
 public:
+	SoundHandle() = default;
+	SoundHandle(uint32_t index, uint32_t generation)
+	: mID((generation << INDEX_BITS) | index)
+	{
+	}
+
+	// Slot index and generation encoded in this handle
+	uint32_t GetIndex() const { return mID & INDEX_MASK; }
+	uint32_t GetGeneration() const { return mID >> INDEX_BITS; }
+
 	// Returns true if this is an active sound handle
 	bool IsValid() const { return mID != 0; }
 
@@ -46,16 +73,253 @@ public:
 
 	static SoundHandle Invalid;
 
+	static constexpr uint32_t INDEX_BITS = 16;
+	static constexpr uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+	static constexpr uint32_t MAX_GENERATION = 0xFFFFu;
+
 private:
 	unsigned int mID = 0;
 };
 
+// SoundIds are returned by AudioSystem::RegisterSound, and let PlaySound
+// and CacheSound find a sound without building or hashing its name
+class SoundId
+{
+public:
+	SoundId() = default;
+	explicit SoundId(uint32_t index)
+	: mIndex(index)
+	{
+	}
+
+	// Returns true if this is a registered sound
+	bool IsValid() const { return mIndex != INVALID_INDEX; }
+
+	// Index of the sound in the AudioSystem's sound table
+	uint32_t GetIndex() const { return mIndex; }
+
+	bool operator==(const SoundId& rhs) const { return mIndex == rhs.mIndex; }
+	bool operator!=(const SoundId& rhs) const { return mIndex != rhs.mIndex; }
+
+	static SoundId Invalid;
+
+private:
+	static constexpr uint32_t INVALID_INDEX = 0xFFFFFFFFu;
+	uint32_t mIndex = INVALID_INDEX;
+};
+
+// LoadTickets are returned by AudioSystem::CacheSoundAsync, and can be
+// polled or waited on to find out when the sound has been decoded.
+// The decoded sound is handed to the AudioSystem on its next Update.
+class LoadTicket
+{
+public:
+	LoadTicket() = default;
+
+	// Returns true if this ticket is for a load
+	bool IsValid() const { return mChunk.valid(); }
+
+	// Returns true once the sound has been decoded (or failed to load)
+	bool IsReady() const
+	{
+		return mChunk.valid() &&
+			   mChunk.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}
+
+	// Blocks until the sound has been decoded (or failed to load)
+	void Wait() const
+	{
+		if (mChunk.valid())
+		{
+			mChunk.wait();
+		}
+	}
+
+private:
+	friend class AudioSystem;
+	explicit LoadTicket(std::shared_future<Mix_Chunk*> chunk)
+	: mChunk(std::move(chunk))
+	{
+	}
+
+	std::shared_future<Mix_Chunk*> mChunk;
+};
+
+// Slot map from SoundHandle to T. Values live in one contiguous array
+// indexed by the handle's slot index, so lookups are O(1) and stale
+// handles are rejected by comparing the generation. Freed slots go on a
+// free list, so once the table has grown to its peak size inserting and
+// erasing never allocate.
+// It keeps the parts of the std::map interface AudioSystem uses, where
+// end() is a null iterator.
+template <typename T>
+class HandleMap
+{
+public:
+	using value_type = std::pair<SoundHandle, T>;
+	using iterator = value_type*;
+	using const_iterator = const value_type*;
+
+	// Most live handles the map can hold, since a handle only has
+	// INDEX_BITS for its slot index
+	static constexpr size_t MAX_SIZE = size_t{1} << SoundHandle::INDEX_BITS;
+
+	// Preallocates space for the specified number of live handles
+	void reserve(size_t count)
+	{
+		mSlots.reserve(count);
+		mGenerations.reserve(count);
+		mFreeSlots.reserve(count);
+	}
+
+	// Adds the value under a new handle and returns an iterator to it
+	// The map must not be full()
+	iterator emplace(const T& value)
+	{
+		SDL_assert(!full());
+		uint32_t index = 0;
+		if (!mFreeSlots.empty())
+		{
+			index = mFreeSlots.back();
+			mFreeSlots.pop_back();
+		}
+		else
+		{
+			index = static_cast<uint32_t>(mSlots.size());
+			mSlots.emplace_back();
+			mGenerations.emplace_back(0);
+		}
+
+		// Generation 0 is never used so a handle can't have an ID of 0
+		uint32_t& generation = mGenerations[index];
+		generation = (generation == SoundHandle::MAX_GENERATION) ? 1 : generation + 1;
+
+		mSlots[index].first = SoundHandle(index, generation);
+		mSlots[index].second = value;
+		mSize++;
+		return &mSlots[index];
+	}
+
+	// Returns the entry for the handle, or end() if it's not live
+	iterator find(SoundHandle handle)
+	{
+		uint32_t index = handle.GetIndex();
+		if (handle.IsValid() && index < mSlots.size() && mSlots[index].first == handle)
+		{
+			return &mSlots[index];
+		}
+		return end();
+	}
+
+	const_iterator find(SoundHandle handle) const
+	{
+		return const_cast<HandleMap*>(this)->find(handle);
+	}
+
+	iterator end() { return nullptr; }
+	const_iterator end() const { return nullptr; }
+
+	// Returns the value for a live handle
+	T& operator[](SoundHandle handle) { return find(handle)->second; }
+
+	// Returns the entry in the slot (which must be live)
+	iterator at_slot(uint32_t index) { return &mSlots[index]; }
+
+	// Frees the slot so its handle is no longer found
+	void erase(iterator iter)
+	{
+		uint32_t index = iter->first.GetIndex();
+		iter->first.Reset();
+		iter->second = T{};
+		mFreeSlots.emplace_back(index);
+		mSize--;
+	}
+
+	// Frees every slot (generations are kept so old handles stay stale)
+	void clear()
+	{
+		for (value_type& slot : mSlots)
+		{
+			if (slot.first.IsValid())
+			{
+				erase(&slot);
+			}
+		}
+	}
+
+	size_t size() const { return mSize; }
+	bool empty() const { return mSize == 0; }
+
+	// Returns true if every slot has a live handle
+	bool full() const { return mSize >= MAX_SIZE; }
+
+private:
+	std::vector<value_type> mSlots;
+	std::vector<uint32_t> mGenerations;
+	std::vector<uint32_t> mFreeSlots;
+	size_t mSize = 0;
+};
+
 // Used to get information about state of sound
 enum class SoundState
 {
 	Stopped,
 	Playing,
-	Paused
+	Paused,
+	// Started before its sound finished loading (see CacheSoundAsync)
+	Loading
+};
+
+// One sound to play with AudioSystem::PlaySounds
+struct SoundRequest
+{
+	std::string_view mSoundName;
+	bool mLooping = false;
+	int mPriority = 0;
+};
+
+// Limits on how many voices of a sound can play at once
+// A PlaySound that would go over a limit is merged into the sound's most
+// recent voice that loops the same way (returning its handle) rather than
+// starting a new voice. If no voice loops the same way, it starts a new one.
+struct SoundPolicy
+{
+	// Max number of voices of the sound at once (0 for no limit)
+	int mMaxInstances = 0;
+	// PlaySound within this many seconds of the last voice starting is merged
+	// into that voice (so 0.0f never merges, and any small positive value
+	// merges sounds started on the same frame)
+	float mMinRetriggerInterval = 0.0f;
+	// Volume voices of the sound start at (0 to MIX_MAX_VOLUME)
+	int mVolume = MIX_MAX_VOLUME;
+	// Volume added to a voice each time a PlaySound is merged into it
+	int mMergeVolumeBoost = 0;
+};
+
+// What the AudioSystem knows about a sound without loading it
+struct SoundMetadata
+{
+	// Size of the sound's file, and its length in seconds (0 if unknown)
+	uint64_t mFileSize = 0;
+	double mDuration = 0.0;
+	// Whether the sound is decoded and in the cache
+	bool mIsLoaded = false;
+};
+
+// Counters for the AudioSystem's cache of decoded sounds
+struct SoundCacheStats
+{
+	// Bytes of decoded audio currently loaded (sounds from the sound bank
+	// are mapped, and don't count)
+	size_t mResidentBytes = 0;
+	// Times a sound was needed and already loaded, or had to be loaded
+	uint64_t mHits = 0;
+	uint64_t mMisses = 0;
+	// Sounds unloaded to stay under the budget
+	uint64_t mEvictions = 0;
+	// Bytes that aren't loaded because sounds with identical samples share
+	// one chunk (see SetSoundSharing)
+	size_t mSharedBytes = 0;
 };
 
 // Manages playing audio through SDL_mixer
@@ -65,6 +329,9 @@ public:
 	// Create the AudioSystem with specified number of channels
 	// (Defaults to 8 channels)
 	AudioSystem(int numChannels = 8);
+	// Same, but registers the given sounds in place of SoundManifest.h's,
+	// so they get the first SoundIds and are the ones CacheAllSounds loads
+	AudioSystem(int numChannels, std::span<const std::string_view> manifest);
 	// Destroy the AudioSystem
 	~AudioSystem();
 
@@ -76,10 +343,29 @@ public:
 	// Plays the sound with the specified name and loops if looping is true
 	// Returns the SoundHandle which is used to perform any other actions on the
 	// sound when active
+	// When virtual voices are enabled, only the highest priority voices are
+	// given a real channel
 	// NOTE: The soundName is without the "Assets/Sounds/" part of the file
 	//       For example, pass in "ChompLoop.wav" rather than
 	//       "Assets/Sounds/ChompLoop.wav".
-	SoundHandle PlaySound(const std::string& soundName, bool looping = false);
+	SoundHandle PlaySound(const std::string& soundName, bool looping = false, int priority = 0);
+
+	// Same as above, but for a sound from RegisterSound. Once the sound is
+	// cached this doesn't allocate or hash anything.
+	SoundHandle PlaySound(SoundId sound, bool looping = false, int priority = 0);
+
+	// Plays the sound by streaming it through a few small buffers instead
+	// of loading all of it, for long music and ambience. The handle works
+	// like any other (looping, pause, resume, GetSoundState, buses).
+	// The sound must be in the sound bank or a WAV file in the mixer's
+	// output format (which the sound bank builder produces).
+	// NOTE: The soundName is without the "Assets/Sounds/" part of the file
+	SoundHandle PlayStream(const std::string& soundName, bool looping = false, int priority = 0);
+
+	// Plays a batch of sounds that start on the same frame, in order, as if
+	// PlaySound was called for each one. Returns the handles in the same
+	// order, which stay valid until the next call to PlaySounds.
+	std::span<const SoundHandle> PlaySounds(std::span<const SoundRequest> requests);
 
 	// Stops the sound if it is currently playing
 	void StopSound(SoundHandle sound);
@@ -90,53 +376,811 @@ public:
 	// Resumes the sound if it is currently paused
 	void ResumeSound(SoundHandle sound);
 
+	// Sets the volume of the sound (0 to MIX_MAX_VOLUME), fading to it over
+	// rampTime seconds. With the software mixer on, the fade is a per-sample
+	// ramp so it doesn't click. SDL_mixer can't ramp, so there it steps
+	// straight to the new volume.
+	void SetVolume(SoundHandle sound, int volume, float rampTime = 0.0f);
+
+	// Seconds a pan change takes with the software mixer
+	static constexpr float PAN_RAMP_TIME = 0.01f;
+
+	// Sets where the sound is between the left (-1) and right (1) speakers,
+	// with 0 for the middle. Panning fades out the far speaker and leaves
+	// the near one alone. With the software mixer on, it ramps over
+	// PAN_RAMP_TIME so it doesn't click.
+	void SetPan(SoundHandle sound, float pan);
+
 	// Returns the current state of the sound
 	SoundState GetSoundState(SoundHandle sound) const;
 
 	// Stops all sounds on all channels
 	void StopAllSounds();
 
+	// Puts the sound on the named bus (taking it off any bus it was on)
+	// Buses are created the first time they're used
+	void SetSoundBus(SoundHandle sound, const std::string& busName);
+
+	// Pauses, resumes or stops every sound on the bus
+	void PauseBus(const std::string& busName);
+	void ResumeBus(const std::string& busName);
+	void StopBus(const std::string& busName);
+
+	// Sets the limits for the sound (loading it if it's not cached yet)
+	// NOTE: The soundName is without the "Assets/Sounds/" part of the file
+	void SetSoundPolicy(const std::string& soundName, const SoundPolicy& policy);
+
+	// Turns voice virtualization on or off (off by default)
+	// When on, PlaySound always returns a valid handle. If every channel is
+	// busy, the new voice takes the channel of the lowest priority voice when
+	// it has a higher priority. Otherwise it starts as a virtual voice, which
+	// has no channel but keeps its place in the sound and gets a channel
+	// once one frees up. At most MAX_VIRTUAL_VOICES are kept, and past
+	// that the lowest priority one (the oldest, if there's a tie) is
+	// stopped, so PlaySound only fails if that's the new voice.
+	// Turning it off stops any virtual voices.
+	void SetVirtualVoicesEnabled(bool enabled);
+
+	// Most virtual voices kept at once (see SetVirtualVoicesEnabled)
+	static constexpr size_t MAX_VIRTUAL_VOICES = 4096;
+
+	// Turns lazy caching on or off (off by default)
+	// When on, CacheAllSounds only indexes the sounds (their file size and
+	// duration) instead of decoding them, and each sound is decoded the
+	// first time it's played or cached. CacheSoundAsync can be used as a
+	// hint to decode a sound ahead of when it's needed.
+	void SetLazyCaching(bool enabled);
+
+	// Turns sharing of identical sounds on or off (off by default)
+	// When on, each newly loaded sound's samples are hashed, and a sound
+	// whose samples match one that's already loaded (such as a copy of a
+	// file under another name) uses that sound's chunk instead of keeping
+	// its own. The bytes this saves are in GetSoundCacheStats.
+	void SetSoundSharing(bool enabled);
+
+	// Turns compressed storage on or off (off by default)
+	// When on, sounds loaded from then on are kept in memory as IMA-ADPCM
+	// (about a quarter the size of 16-bit PCM), and each voice decodes its
+	// sound a block at a time into a few small buffers as it plays. This
+	// only applies when the mixer's format is 16-bit, and not to sounds in
+	// the sound bank. Sounds no longer than a voice's buffers (a second)
+	// stay PCM, since they'd save nothing once played. GetSound returns
+	// nullptr for the sounds that are compressed.
+	void SetCompressedStorage(bool enabled);
+
 	// Cache all sounds under Assets/Sounds
+	// (using the list in SoundManifest.h, which is generated at build time,
+	// or the one passed to the constructor)
 	void CacheAllSounds();
 
+	// Sets a file for CacheAllSounds to keep an index of Assets/Sounds in
+	// (none by default), with each sound's name, file size, modification
+	// time and duration. While Assets/Sounds hasn't changed since the index
+	// was written, CacheAllSounds takes the list of sounds from it instead of
+	// going through the folder, and lazy caching takes the size and duration
+	// of each unchanged file from it instead of opening the file. The index
+	// is written again whenever it's out of date. With a manifest, which
+	// already lists the sounds, the index only supplies their size and
+	// duration.
+	void SetSoundIndexPath(const std::string& path);
+
+	// Returns the file size and duration of the sound, from CacheAllSounds's
+	// index (or the decoded sound, if it's loaded). Returns all zeros for a
+	// sound that hasn't been indexed or loaded.
+	// NOTE: The soundName is without the "Assets/Sounds/" part of the file
+	SoundMetadata GetSoundMetadata(const std::string& soundName);
+
 	// Used to preload the sound data of a sound
+	// (does nothing for a sound CacheSoundAsync is loading, rather than wait)
 	// NOTE: The soundName is without the "Assets/Sounds/" part of the file
 	//       For example, pass in "ChompLoop.wav" rather than
 	//       "Assets/Sounds/ChompLoop.wav".
 	void CacheSound(const std::string& soundName);
 
+	// Same as above, but for a sound from RegisterSound
+	void CacheSound(SoundId sound);
+
+	// Starts loading the sound on a background thread and returns right
+	// away. PlaySound on the sound before it has loaded returns a handle in
+	// the Loading state, which starts playing on the Update after the sound
+	// lands (or stops, if it couldn't be loaded).
+	// NOTE: The soundName is without the "Assets/Sounds/" part of the file
+	LoadTicket CacheSoundAsync(const std::string& soundName);
+
+	// Same as above, but for a sound from RegisterSound
+	LoadTicket CacheSoundAsync(SoundId sound);
+
+	// Returns the SoundId for the sound, which can be passed to PlaySound
+	// and CacheSound in place of its name. This doesn't load the sound.
+	// NOTE: The soundName is without the "Assets/Sounds/" part of the file
+	SoundId RegisterSound(const std::string& soundName);
+
+	// Limits how many bytes of decoded sounds are kept loaded (0, the
+	// default, for no limit). Whenever a load goes over the budget, sounds
+	// that aren't playing are unloaded, least recently played first, and
+	// are loaded again the next time they're needed. Sounds from the sound
+	// bank don't count, and CacheAllSounds stops loading once it's full.
+	void SetSoundCacheBudget(size_t bytes);
+
+	// Returns the resident bytes and hit/miss/eviction counts of the cache
+	const SoundCacheStats& GetSoundCacheStats() const;
+
+	// Frees the sound's data once no voice is using it (right away if none
+	// are). Playing or caching the sound again before then cancels this.
+	// NOTE: The soundName is without the "Assets/Sounds/" part of the file
+	void UnloadSound(const std::string& soundName);
+
+	// Same as above, but for a sound from RegisterSound
+	void UnloadSound(SoundId sound);
+
+	// Frees the data of every sound that isn't playing
+	void UnloadUnused();
+
+	// Maps a sound bank file (see SoundBank.h). Sounds in the bank are then
+	// played straight from the mapping with no copy or decode, and sounds
+	// that aren't in it are still loaded from Assets/Sounds.
+	// Only one bank can be open, and it stays mapped until ~AudioSystem.
+	// Returns false if the file isn't a valid bank in the mixer's format.
+	bool OpenSoundBank(const std::string& path);
+
+	// Turns hot reloading on or off (off by default)
+	// When on, Assets/Sounds (and the folders in it) are watched for files
+	// that change, and the next Update loads any cached sound whose file
+	// changed again, moving its voices over to the new data where they are.
+	// Only supported on Linux, using inotify.
+	// Returns false if the folder couldn't be watched.
+	bool SetHotReload(bool enabled);
+
+	// Turns the software mixer on or off (off by default)
+	// When on, sounds are mixed in process by a SoftwareMixer (with SIMD
+	// kernels picked for the CPU) instead of by SDL_mixer, and each Update
+	// mixes deltaTime's worth of audio into a null output that nothing
+	// hears. This is for running headless, such as to measure the cost of
+	// mixing on build machines. Turning it on or off stops every sound.
+	// Returns false if the mixer's format isn't S16 or F32.
+	bool SetSoftwareMixer(bool enabled);
+
+	// Renders the next seconds of audio as fast as the CPU allows, adding
+	// it to the end of samples (interleaved floats at the mixer's frequency
+	// and channels). It runs Update in steps of updateTime on a simulated
+	// clock, so voices start, finish and stream just as they would live,
+	// and PlaySound or StopSound calls between renders land at that point
+	// in the audio. Needs the software mixer on (see SetSoftwareMixer).
+	// Returns false if it isn't.
+	bool RenderOffline(float seconds, std::vector<float>& samples,
+					   float updateTime = 1.0f / 60.0f);
+
+	// Same as RenderOffline, but writes the audio to a 16-bit WAV file.
+	// Returns false if it couldn't render or write the file.
+	bool RenderOfflineToWav(float seconds, const std::string& fileName,
+							float updateTime = 1.0f / 60.0f);
+
 private:
 	// If the sound is already loaded, returns Mix_Chunk from the map.
 	// Otherwise, will attempt to load the file and save it in the map.
-	// Returns nullptr if sound is not found.
+	// Returns nullptr while CacheSoundAsync is still loading it, rather
+	// than waiting (it lands on the Update after it's decoded).
+	// Returns nullptr if sound is not found, or if it's kept compressed
+	// (see SetCompressedStorage), since then there's no PCM chunk for it.
 	// NOTE: The soundName is without the "Assets/Sounds/" part of the file
 	//       For example, pass in "ChompLoop.wav" rather than
 	//       "Assets/Sounds/ChompLoop.wav".
 	Mix_Chunk* GetSound(const std::string& soundName);
 
+	// Claims the lowest-numbered free channel in constant time
+	// Returns -1 if every channel is in use
+	int ClaimFreeChannel();
+
+	// Flags the channel as free again so ClaimFreeChannel can hand it out
+	void ReleaseChannel(int channel);
+
+	// Resets the free channel bitmask so every channel is free
+	void ResetFreeChannels();
+
+	// Registered with Mix_ChannelFinished. SDL_mixer calls this from the
+	// audio thread (or from Mix_HaltChannel), so it only queues the channel
+	// for the next Update.
+	static void OnChannelFinished(int channel);
+
+	// Frees the channel and its handle if the channel isn't playing anymore
+	void ProcessFinishedChannel(int channel);
+
+	// Links for an intrusive doubly linked list of voices, threaded through
+	// the HandleMap slot indices. Lists are oldest first.
+	static constexpr uint32_t NO_SLOT = 0xFFFFFFFFu;
+	struct AgeLink
+	{
+		uint32_t mPrev = NO_SLOT;
+		uint32_t mNext = NO_SLOT;
+	};
+	struct AgeList
+	{
+		uint32_t mHead = NO_SLOT;
+		uint32_t mTail = NO_SLOT;
+	};
+
+	// Cached sound data, and the voices playing it
+	struct SoundInfo
+	{
+		// nullptr until the sound is loaded
+		Mix_Chunk* mChunk = nullptr;
+		// Valid while the sound is loading on the loader thread
+		std::shared_future<Mix_Chunk*> mLoad;
+		// Views into the key in mSounds, with and without "Assets/Sounds/"
+		std::string_view mPath;
+		std::string_view mName;
+		SoundId mId;
+		// Voices with a channel
+		AgeList mVoices;
+		SoundPolicy mPolicy;
+		// All voices, including virtual ones. This is the chunk's reference
+		// count, so it's only freed once it drops to 0.
+		int mNumVoices = 0;
+		// Set by UnloadSound to free the chunk when mNumVoices drops to 0
+		bool mUnloadRequested = false;
+		// Set by CacheSoundAsync on a sound it added, so FinishLoad removes
+		// it from mSounds if it doesn't load
+		bool mRemoveIfLoadFails = false;
+		// Most recently started voice, and mTime when it started
+		SoundHandle mLastVoice;
+		double mLastStartTime = 0.0;
+		// From IndexSound, so it's known without loading the sound
+		uint64_t mFileSize = 0;
+		double mDuration = 0.0;
+		// HashSamples of the chunk, if it's in mSharedChunks
+		uint64_t mSamplesHash = 0;
+		// IMA-ADPCM blocks, and the length of the PCM they decode to, if the
+		// sound is compressed (mChunk points at the blocks)
+		std::vector<uint8_t> mAdpcm;
+		uint32_t mPcmLength = 0;
+		// Links in the cache's list of loaded sounds, least recently
+		// played first
+		SoundInfo* mCachePrev = nullptr;
+		SoundInfo* mCacheNext = nullptr;
+	};
+
+	// Layout of the file from SetSoundIndexPath:
+	//   SoundIndexHeader
+	//   SoundIndexEntry[mNumSounds]
+	//   Names (not null-terminated), which the entries' offsets are into
+	// Times are std::filesystem::file_time_type counts.
+	struct SoundIndexHeader
+	{
+		char mMagic[4] = {'S', 'I', 'D', 'X'};
+		uint32_t mVersion = 1;
+		uint32_t mNumSounds = 0;
+		uint32_t mReserved = 0;
+		// Modification time of Assets/Sounds when the index was written
+		int64_t mFolderTime = 0;
+	};
+	struct SoundIndexEntry
+	{
+		uint64_t mFileSize = 0;
+		int64_t mFileTime = 0;
+		double mDuration = 0.0;
+		uint32_t mNameOffset = 0;
+		uint32_t mNameLength = 0;
+	};
+
+	// A voice that's streaming its sound through a ring of buffers. Buffers
+	// are refilled in Update, ahead of StreamEffect playing them on the
+	// audio thread.
+	static constexpr size_t NUM_STREAM_BUFFERS = 4;
+	struct StreamInfo
+	{
+		SoundHandle mHandle;
+		int mChannel = -1;
+		bool mIsLooping = false;
+		// Index in mStreams
+		size_t mIndex = 0;
+		// The PCM is either in the sound bank, in a WAV file, or decoded
+		// from a compressed sound
+		const uint8_t* mBankData = nullptr;
+		std::ifstream mFile;
+		const uint8_t* mAdpcm = nullptr;
+		// The last block decoded from mAdpcm
+		std::vector<int16_t> mBlock;
+		uint64_t mBlockIndex = UINT64_MAX;
+		uint64_t mDataOffset = 0;
+		uint64_t mDataLength = 0;
+		// Bytes into the PCM the next refill reads from
+		uint64_t mReadPos = 0;
+		bool mEnded = false;
+		// Ring of buffers. Update only moves mNumFilled on and StreamEffect
+		// only moves mNumPlayed on, so neither side needs a lock.
+		std::vector<Uint8> mBuffers[NUM_STREAM_BUFFERS];
+		size_t mLengths[NUM_STREAM_BUFFERS] = {};
+		std::atomic<uint64_t> mNumFilled = 0;
+		std::atomic<uint64_t> mNumPlayed = 0;
+		// Bytes StreamEffect has played of the buffer it's on (only touched
+		// on the audio thread)
+		size_t mPlayOffset = 0;
+		// Byte StreamEffect plays when the ring runs dry
+		Uint8 mSilence = 0;
+	};
+
+	// The voices on a bus
+	struct BusInfo
+	{
+		AgeList mVoices;
+	};
+
 	// Internal struct used to track the properties of active sound handles
 	struct HandleInfo
 	{
-		std::string mSoundName;
+		// View of SoundInfo::mName
+		std::string_view mSoundName;
+		SoundId mSoundId;
+		// -1 for a virtual voice
 		int mChannel = -1;
 		bool mIsLooping = false;
 		bool mIsPaused = false;
+		// nullptr while the sound is still loading
+		Mix_Chunk* mChunk = nullptr;
+		int mVolume = MIX_MAX_VOLUME;
+		// -1 (left) to 1 (right)
+		float mPan = 0.0f;
+		int mPriority = 0;
+		// Increases with every PlaySound, so lower is older
+		uint64_t mPlayOrder = 0;
+		// mTime when the voice was at the start of the sound, and mTime when
+		// it was paused. Used to work out where a virtual voice is.
+		double mStartTime = 0.0;
+		double mPauseTime = 0.0;
+		// Positions in mVirtualVoices and mVirtualVictims while virtual, and
+		// in mDemotableVoices while it can be demoted (NO_SLOT otherwise)
+		uint32_t mVirtualIndex = NO_SLOT;
+		uint32_t mVictimIndex = NO_SLOT;
+		uint32_t mDemotableIndex = NO_SLOT;
+		SoundInfo* mSound = nullptr;
+		// Links in mSound->mVoices and in mLoopingVoices/mOneShotVoices,
+		// only used while the voice has a channel
+		AgeLink mSoundLink;
+		AgeLink mLoopLink;
+		// Bus the voice is on (if any), and its link in the bus's list
+		BusInfo* mBus = nullptr;
+		AgeLink mBusLink;
+		// Set for a voice from PlayStream
+		StreamInfo* mStream = nullptr;
 	};
 
+	// Same as GetSound, but returns the SoundInfo for the sound (which may
+	// still be loading). A sound that isn't in mSounds yet is only added
+	// if it loads.
+	SoundInfo* GetSoundInfo(std::string_view soundName);
+
+	// Returns the SoundInfo for the sound, or nullptr if it's not in
+	// mSounds
+	SoundInfo* FindSoundInfo(std::string_view soundName);
+
+	// Returns the SoundInfo for the sound, adding it (without loading it)
+	// if it's not in mSounds yet
+	SoundInfo* AddSoundInfo(std::string_view soundName);
+
+	// Takes a sound that was only just added back out of mSounds, since it
+	// turned out not to load
+	void RemoveSoundInfo(SoundInfo& soundInfo);
+
+	// Loads the chunk for the sound if it isn't loaded (or loading)
+	// Returns false if the file couldn't be loaded
+	bool LoadSound(SoundInfo& soundInfo);
+
+	// Returns a new chunk for the sound, pointing into the sound bank if
+	// it's in there, or else loaded from its file. This is called from the
+	// loader threads, so it doesn't change anything in the AudioSystem.
+	Mix_Chunk* DecodeSound(const SoundInfo& soundInfo) const;
+
+	// Returns the sound bank entry for the sound, or nullptr if it isn't in
+	// the bank (or there's no bank)
+	const SoundBank::Entry* FindBankEntry(std::string_view soundName) const;
+
+	// Returns whether the chunk points into the sound bank's mapping
+	bool IsBankChunk(const Mix_Chunk* chunk) const;
+
+	// Unmaps the sound bank
+	void CloseSoundBank();
+
+	// Watches the folder (relative to Assets/Sounds, ending in a / unless
+	// it's Assets/Sounds itself) and the folders in it for changed files
+	void WatchSoundFolder(const std::string& folder);
+
+	// Queues the cached sounds whose files changed since the last Update,
+	// and reloads them
+	void ReadSoundChanges();
+
+	// Loads the sound's file again and moves its voices over to the new
+	// chunk. Keeps the old chunk if the file can't be loaded.
+	void ReloadSound(SoundInfo& soundInfo);
+
+	// Queues the sound for the loader thread (starting it if needed)
+	LoadTicket LoadSoundAsync(SoundInfo& soundInfo);
+
+	// Runs on the loader thread, decoding queued sounds until shutdown
+	void RunLoader();
+
+	// Hands the decoded chunk from the loader thread to the sound, and
+	// starts the voices waiting on it
+	void FinishLoad(SoundInfo& soundInfo);
+
+	// Calls FinishLoad for the sounds the loader thread has decoded
+	void UpdateLoadingSounds();
+
+	// Keeps the sound's newly loaded chunk in the cache, unloading other
+	// sounds if that puts it over budget
+	void AddToCache(SoundInfo& soundInfo);
+
+	// Moves the sound to the most recently played end of the cache
+	void TouchCachedSound(SoundInfo& soundInfo);
+
+	// Takes the sound out of the cache's list (without freeing it)
+	void UnlinkCachedSound(SoundInfo& soundInfo);
+
+	// Unloads sounds that aren't playing, least recently played first,
+	// until the cache is back under budget (never unloading keep)
+	void EvictSounds(const SoundInfo* keep);
+
+	// Takes the sound out of the cache and frees its chunk
+	void FreeSoundChunk(SoundInfo& soundInfo);
+
+	// Frees the sound's chunk if UnloadSound asked for it and no voice
+	// is using it anymore
+	void ReleaseIfUnused(SoundInfo& soundInfo);
+
+	// Returns a 64-bit FNV-1a hash of the samples
+	static uint64_t HashSamples(const Uint8* samples, size_t length);
+
+	// Switches the sound's newly loaded chunk for the chunk of a sound with
+	// the same samples, if there is one. Returns true if it switched.
+	bool ShareChunk(SoundInfo& soundInfo);
+
+	// Lets go of the sound's chunk, freeing it unless other sounds are
+	// still sharing it. Returns true if it was freed.
+	bool ReleaseChunk(SoundInfo& soundInfo);
+
+	// Replaces the sound's newly loaded PCM chunk with a chunk of its
+	// IMA-ADPCM blocks (if the mixer's format is 16-bit)
+	void CompressSound(SoundInfo& soundInfo);
+
+	// Records the file size and duration of the sound from its file's
+	// header, without decoding it
+	void IndexSound(SoundInfo& soundInfo);
+
+	// Adds the sounds in the index from SetSoundIndexPath to sounds, if
+	// Assets/Sounds hasn't changed since it was written. The ones whose
+	// files haven't changed either get their size and duration from it,
+	// and are added to indexed. With a manifest, only the manifest's sounds
+	// get their size and duration from it (and none are added to sounds).
+	// Returns false if the index can't be used.
+	bool ReadSoundIndex(std::vector<SoundInfo*>& sounds, std::vector<SoundInfo*>& indexed);
+
+	// Writes an index of the sounds to the file from SetSoundIndexPath
+	void WriteSoundIndex(std::span<SoundInfo* const> sounds);
+
+	// Loads every sound that isn't loaded yet on the decode workers
+	void LoadSounds(std::span<SoundInfo* const> sounds);
+
+	// Decodes the rest of the current LoadSounds batch
+	void DecodeBatch();
+
+	// Runs on a decode worker started during the given batch
+	void RunDecodeWorker(uint64_t batch);
+
+	// Plays a voice of a loaded sound (shared by both PlaySound overloads)
+	SoundHandle PlayLoadedSound(SoundInfo* soundInfo, bool looping, int priority);
+
+	// Finds a channel for a new voice of the sound and adds its handle, but
+	// doesn't start it in SDL_mixer. Returns an invalid handle if there's no
+	// channel for it (and virtual voices are off).
+	SoundHandle RegisterVoice(SoundInfo* soundInfo, bool looping, int priority);
+
+	// Returns the voice a new PlaySound of the sound should be merged into
+	// because of its SoundPolicy (after applying the volume boost), or an
+	// invalid handle if it should start a new voice. Only a voice that
+	// loops the same way is merged into.
+	SoundHandle MergeVoice(SoundInfo* soundInfo, bool looping);
+
+	// Stops the voice and erases its handle
+	void StopVoice(HandleMap<HandleInfo>::iterator iter);
+
+	// Channel operations, which go to the software mixer if it's on, or
+	// else SDL_mixer
+	void HaltChannel(int channel);
+	void PlayChannel(int channel, Mix_Chunk* chunk, int loops);
+	void PauseChannel(int channel);
+	void ResumeChannel(int channel);
+	bool IsChannelPlaying(int channel) const;
+	void RegisterEffect(int channel, Mix_EffectFunc_t effect, void* userData);
+
+	// Mixes deltaTime's worth of audio with the software mixer, into its
+	// null output (or the offline render's samples)
+	void MixSoftware(float deltaTime);
+
+	// Writes interleaved float samples to a 16-bit WAV file
+	static bool WriteWav(const std::string& fileName, std::span<const float> samples,
+						 int frequency, int channels);
+
+	// Finds where the PCM of the sound is for streaming. Returns false if
+	// it isn't in the sound bank or a WAV file in the mixer's format.
+	bool OpenStream(StreamInfo& stream, const SoundInfo& soundInfo);
+
+	// Fills the next free buffer of the stream (wrapping around if it
+	// loops). Returns false if the stream has ended or every buffer is
+	// full.
+	bool FillStreamBuffer(StreamInfo& stream);
+
+	// Copies up to count bytes of PCM from the stream's compressed sound,
+	// decoding the block they're in if needed. Returns the bytes copied.
+	size_t ReadAdpcm(StreamInfo& stream, Uint8* dest, size_t count);
+
+	// Sizes the stream's buffers and fills as many as it can. Returns
+	// false if the stream has no data.
+	bool PrimeStream(StreamInfo& stream);
+
+	// Plays the stream on the voice's channel, and hands it to
+	// UpdateStreams to keep refilled
+	void StartStream(int channel, HandleInfo& info, std::unique_ptr<StreamInfo> stream);
+
+	// Refills the buffers of the streams that StreamEffect has played, and
+	// stops the ones that have played all the way through
+	void UpdateStreams();
+
+	// Registered with Mix_RegisterEffect on a stream's channel, which plays
+	// mStreamCarrier on a loop. SDL_mixer calls this on the audio thread
+	// with the mixer locked, so it only copies from the ring into the
+	// channel's audio and never calls back into SDL_mixer.
+	static void StreamEffect(int channel, void* data, int length, void* userData);
+
+	// Takes the stream out of mStreams (its channel has to be halted
+	// first, so StreamEffect is done with it)
+	void RemoveStream(StreamInfo* stream);
+
+	// Pauses/resumes the voice if it isn't already
+	void PauseVoice(HandleInfo& info);
+	void ResumeVoice(HandleInfo& info);
+
+	// Erases the handle of a voice that has stopped (freeing its sound if it
+	// was the last voice and UnloadSound asked for it)
+	void EraseVoice(HandleMap<HandleInfo>::iterator iter);
+
+	// Sets the channel's volume or pan, ramping to it over rampTime seconds
+	// if the software mixer is on. SDL_mixer is only called if the channel
+	// isn't already there, but the software mixer hears every call, since
+	// one with no ramp also cuts short a ramp that's still going.
+	void SetChannelVolume(int channel, int volume, float rampTime = 0.0f);
+	void SetChannelPan(int channel, float pan, float rampTime = 0.0f);
+
+	// Calls Mix_SetPanning with the levels for the pan
+	static void SetMixPanning(int channel, float pan);
+
+	// Returns the software mixer's frames in rampTime seconds
+	size_t GetRampFrames(float rampTime) const;
+
+	// Gives the channel to the voice and adds it to the age lists (and
+	// mDemotableVoices)
+	void BindVoice(int channel, SoundHandle sound, HandleInfo& info);
+
+	// Takes the channel away from the voice and removes it from the age
+	// lists and mDemotableVoices (the channel is not released)
+	void UnbindVoice(SoundHandle sound, HandleInfo& info);
+
+	// Stops the voice to steal from when every channel is busy, which is
+	// the oldest instance of the same sound, then the oldest non-looping
+	// sound, then the oldest sound. Returns the stolen channel.
+	int StealChannel(SoundInfo* sound);
+
+	// Intrusive age list operations for the specified link member
+	template <AgeLink HandleInfo::*Link>
+	void PushBack(AgeList& list, uint32_t index);
+	template <AgeLink HandleInfo::*Link>
+	void Unlink(AgeList& list, uint32_t index);
+
+	// Intrusive heap operations for a heap of voices (HandleMap slot
+	// indices), which keep their position in the specified member. The top
+	// is the lowest priority voice if LowestFirst is set, or else the
+	// highest, and the oldest of those.
+	template <uint32_t HandleInfo::*Index, bool LowestFirst>
+	void HeapPush(std::vector<uint32_t>& heap, uint32_t index);
+	template <uint32_t HandleInfo::*Index, bool LowestFirst>
+	void HeapRemove(std::vector<uint32_t>& heap, HandleInfo& info);
+	template <uint32_t HandleInfo::*Index, bool LowestFirst>
+	void HeapSift(std::vector<uint32_t>& heap, uint32_t pos);
+
+	// Frees the channel and gives it to a virtual voice if there is one
+	void FreeChannel(int channel);
+
+	// Plays the voice on the channel, starting from where it is in the sound
+	void StartVoice(int channel, HandleInfo& info);
+
+	// Takes the channel of the lowest priority voice (making it virtual) if
+	// it's a lower priority than the one specified
+	// Returns -1 if no voice is a lower priority
+	int DemoteVoice(int priority);
+
+	// Adds/removes the voice from the list of virtual voices
+	// Adding one past MAX_VIRTUAL_VOICES stops the lowest priority virtual
+	// voice, which can be the one just added.
+	void AddVirtualVoice(HandleInfo& info, SoundHandle sound);
+	void RemoveVirtualVoice(HandleInfo& info);
+
+	// Gives free channels to the highest priority virtual voices
+	void PromoteVirtualVoices();
+
+	// Stops virtual one-shots that have reached the end of their sound
+	void UpdateVirtualVoices();
+
+	// How far (in seconds) the voice is into its sound
+	double GetPlayPosition(const HandleInfo& info) const;
+
+	// Length (in seconds) of the sound once it's decoded
+	double GetSoundLength(const SoundInfo& soundInfo) const;
+
 	// Tracks the active SoundHandle for each channel
 	// An Invalid SoundHandle means the channel is free, otherwise
 	// it's an active handle.
 	std::vector<SoundHandle> mChannels;
 
+	// Bitmask of free channels (a set bit means the channel is free).
+	// mFreeChannelSummary has one bit per word of mFreeChannelBits that still
+	// has a free channel in it, so finding a free channel is two
+	// find-first-set operations for up to 4096 channels.
+	std::vector<uint64_t> mFreeChannelBits;
+	std::vector<uint64_t> mFreeChannelSummary;
+
 	// Maps all the active SoundHandles to their HandleInfo
-	std::map<SoundHandle, HandleInfo> mHandleMap;
+	HandleMap<HandleInfo> mHandleMap;
 
-	// Map to store the Mix_Chunk data for all the files
-	std::unordered_map<std::string, Mix_Chunk*> mSounds;
+	// Channels reported by OnChannelFinished that Update hasn't handled
+	// yet, in a ring with a slot for every channel. A channel's flag is set
+	// while it's in the ring, so it's never in there twice. Only Update
+	// moves mFinishedHead on, and only OnChannelFinished mFinishedTail.
+	std::unique_ptr<int[]> mFinishedRing;
+	std::unique_ptr<std::atomic<bool>[]> mFinishedFlags;
+	std::atomic<size_t> mFinishedHead = 0;
+	std::atomic<size_t> mFinishedTail = 0;
+
+	// The AudioSystem that OnChannelFinished reports to
+	static AudioSystem* sActiveSystem;
 
-	// Used to track the last audio handle value used
-	// Will increment prior to playing a new sound
-	SoundHandle mLastHandle;
+	// Voices with a channel, oldest first, split by whether they loop
+	AgeList mLoopingVoices;
+	AgeList mOneShotVoices;
+
+	// Voices that currently don't have a channel, highest priority first
+	// (for PromoteVirtualVoices), and lowest first (for AddVirtualVoice)
+	std::vector<uint32_t> mVirtualVoices;
+	std::vector<uint32_t> mVirtualVictims;
+	// Voices with a channel that DemoteVoice can take, lowest priority
+	// first. Streams can't be virtual, so they're left out.
+	std::vector<uint32_t> mDemotableVoices;
+	// Scratch for UpdateVirtualVoices, so it doesn't allocate every Update
+	std::vector<uint32_t> mEndedVoices;
+	bool mVirtualVoicesEnabled = false;
+
+	// Whether CacheAllSounds only indexes sounds (see SetLazyCaching)
+	bool mLazyCaching = false;
+
+	// File for CacheAllSounds to keep its index in (see SetSoundIndexPath)
+	std::string mSoundIndexPath;
+
+	// Per-channel chunks that point partway into a cached chunk, used when
+	// a virtual voice gets a channel partway through its sound
+	std::vector<Mix_Chunk> mChannelViews;
+
+	// Total time passed to Update, in seconds
+	double mTime = 0.0;
+
+	// Next HandleInfo::mPlayOrder
+	uint64_t mNextPlayOrder = 0;
+
+	// Loaded sounds, least recently played first, and the byte budget for
+	// them (0 for no limit)
+	SoundInfo* mCacheHead = nullptr;
+	SoundInfo* mCacheTail = nullptr;
+	size_t mCacheBudget = 0;
+	SoundCacheStats mCacheStats;
+
+	// Chunks that sounds can share, by HashSamples of their samples, and
+	// how many sounds are using each (see SetSoundSharing)
+	struct SharedChunk
+	{
+		Mix_Chunk* mChunk = nullptr;
+		int mNumSounds = 0;
+	};
+	std::unordered_map<uint64_t, SharedChunk> mSharedChunks;
+	bool mShareSounds = false;
+
+	// Whether newly loaded sounds are compressed (see SetCompressedStorage)
+	bool mCompressSounds = false;
+
+	// The mapped sound bank file, and its entries (sorted by name hash)
+	const uint8_t* mBankData = nullptr;
+	size_t mBankSize = 0;
+	std::span<const SoundBank::Entry> mBankEntries;
+
+	// Sounds queued for the loader thread, which is started by the first
+	// CacheSoundAsync
+	std::thread mLoaderThread;
+	std::mutex mLoadMutex;
+	std::condition_variable mLoadQueued;
+	std::deque<std::pair<SoundInfo*, std::promise<Mix_Chunk*>>> mLoadQueue;
+	bool mStopLoader = false;
+
+	// Worker threads for LoadSounds, started by the first call that has
+	// more than one sound to decode. Each batch sets the sounds, their
+	// chunks, mDecodeNext and the bytes they may take up, bumps
+	// mDecodeBatch to wake the workers, and waits for mDecodeBusy to count
+	// down to zero.
+	std::vector<std::thread> mDecodeWorkers;
+	std::mutex mDecodeMutex;
+	std::condition_variable mDecodeStart;
+	std::condition_variable mDecodeDone;
+	std::span<SoundInfo* const> mDecodeSounds;
+	Mix_Chunk** mDecodeChunks = nullptr;
+	std::atomic<size_t> mDecodeNext = 0;
+	std::atomic<size_t> mDecodeBytes = 0;
+	size_t mDecodeRoom = 0;
+	uint64_t mDecodeBatch = 0;
+	size_t mDecodeBusy = 0;
+	bool mStopDecode = false;
+
+	// Sounds that are loading, and voices of them waiting to start
+	std::vector<SoundInfo*> mLoadingSounds;
+	std::vector<SoundHandle> mLoadingVoices;
+
+	// inotify instance watching Assets/Sounds (-1 when hot reload is off),
+	// the folder each of its watches is for, and the sounds whose files
+	// changed
+	int mWatchFd = -1;
+	std::unordered_map<int, std::string> mWatchFolders;
+	std::vector<SoundInfo*> mChangedSounds;
+
+	// Voices from PlayStream, and the silent chunk their channels loop
+	// while StreamEffect swaps in the ring's audio
+	std::vector<std::unique_ptr<StreamInfo>> mStreams;
+	std::vector<Uint8> mStreamSilence;
+	Mix_Chunk mStreamCarrier;
+
+	// The software mixer (see SetSoftwareMixer), the block it mixes into,
+	// and the part of a frame it's behind Update by
+	static constexpr size_t MIX_BLOCK_FRAMES = 1024;
+	std::unique_ptr<SoftwareMixer> mSoftwareMixer;
+	std::vector<float> mMixBlock;
+	double mMixFrames = 0.0;
+
+	// Where RenderOffline wants the mix, and how many more frames it wants
+	std::vector<float>* mRenderOutput = nullptr;
+	size_t mRenderFramesLeft = 0;
+
+	// Mixer output format, from Mix_QuerySpec
+	int mFrameSize = 4;
+	int mBytesPerSecond = 44100 * 4;
+
+	// Handles returned by PlaySounds, and the ones PlaySounds has to start
+	std::vector<SoundHandle> mBatchHandles;
+	std::vector<SoundHandle> mBatchStarts;
+
+	// Buses by name
+	std::unordered_map<std::string, BusInfo> mBuses;
+
+	// Handles StopBus is going to stop
+	std::vector<SoundHandle> mBusScratch;
+
+	// Volume and pan last set on each channel with SetChannelVolume and
+	// SetChannelPan
+	std::vector<int> mChannelVolumes;
+	std::vector<float> mChannelPans;
+
+	// Reused to build "Assets/Sounds/..." paths without allocating
+	std::string mPathBuffer;
+
+	// SoundInfo for each SoundId
+	std::vector<SoundInfo*> mSoundIds;
+
+	// How many of the first SoundIds came from the manifest
+	size_t mNumManifestSounds = 0;
+
+	// Map to store the Mix_Chunk data for all the files
+	std::unordered_map<std::string, SoundInfo> mSounds;
 
 	// Used for debug input in ProcessInput
 	bool mLastDebugKey = false;
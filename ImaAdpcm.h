@@ -0,0 +1,180 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// IMA-ADPCM compression of 16-bit PCM, used by AudioSystem to keep sounds
+// in memory at about a quarter of their size and decode them while they
+// play.
+//
+// The samples are split into blocks of FRAMES_PER_BLOCK frames, so any
+// block can be decoded on its own. Each block has, for each channel:
+//   int16_t  first sample
+//   uint8_t  step index
+//   uint8_t  (unused)
+//   uint8_t  nibbles for the other FRAMES_PER_BLOCK - 1 samples, two per
+//            byte (low nibble first)
+// The last block is padded out by repeating the last frame.
+namespace ImaAdpcm
+{
+	inline constexpr size_t FRAMES_PER_BLOCK = 1025;
+	inline constexpr size_t HEADER_SIZE = 4;
+	inline constexpr size_t NIBBLE_BYTES = (FRAMES_PER_BLOCK - 1) / 2;
+
+	inline constexpr int16_t STEP_SIZES[89] = {
+		7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21,
+		23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66,
+		73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209,
+		230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+		724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+		2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+		7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350,
+		22385, 24623, 27086, 29794, 32767};
+
+	inline constexpr int8_t INDEX_CHANGES[16] = {
+		-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+	// Bytes of one block of compressed data
+	constexpr size_t BlockSize(int channels)
+	{
+		return (HEADER_SIZE + NIBBLE_BYTES) * static_cast<size_t>(channels);
+	}
+
+	// Predictor for one channel, shared by the encoder and decoder so they
+	// stay in step
+	struct Channel
+	{
+		int mPredictor = 0;
+		int mIndex = 0;
+
+		// Returns the next sample for the nibble
+		int16_t Decode(uint8_t nibble)
+		{
+			int step = STEP_SIZES[mIndex];
+			int diff = step >> 3;
+			if (nibble & 4)
+			{
+				diff += step;
+			}
+			if (nibble & 2)
+			{
+				diff += step >> 1;
+			}
+			if (nibble & 1)
+			{
+				diff += step >> 2;
+			}
+			mPredictor += (nibble & 8) ? -diff : diff;
+			mPredictor = std::clamp(mPredictor, -32768, 32767);
+			mIndex = std::clamp(mIndex + INDEX_CHANGES[nibble], 0, 88);
+			return static_cast<int16_t>(mPredictor);
+		}
+
+		// Returns the nibble that gets closest to the sample (and moves on to
+		// it like Decode does)
+		uint8_t Encode(int16_t sample)
+		{
+			int step = STEP_SIZES[mIndex];
+			int diff = sample - mPredictor;
+			uint8_t nibble = 0;
+			if (diff < 0)
+			{
+				nibble = 8;
+				diff = -diff;
+			}
+			if (diff >= step)
+			{
+				nibble |= 4;
+				diff -= step;
+			}
+			if (diff >= step >> 1)
+			{
+				nibble |= 2;
+				diff -= step >> 1;
+			}
+			if (diff >= step >> 2)
+			{
+				nibble |= 1;
+			}
+			Decode(nibble);
+			return nibble;
+		}
+	};
+
+	// Compresses interleaved 16-bit samples
+	inline std::vector<uint8_t> Encode(const int16_t* samples, size_t numFrames, int channels)
+	{
+		size_t numBlocks = (numFrames + FRAMES_PER_BLOCK - 1) / FRAMES_PER_BLOCK;
+		std::vector<uint8_t> blocks(numBlocks * BlockSize(channels));
+		// Start with a step that fits the first change in each channel, so
+		// the start of the sound doesn't lag while the step grows
+		std::vector<Channel> state(static_cast<size_t>(channels));
+		for (int c = 0; numFrames > 1 && c < channels; c++)
+		{
+			int diff = std::abs(samples[channels + c] - samples[c]);
+			while (state[c].mIndex < 88 && STEP_SIZES[state[c].mIndex] < diff)
+			{
+				state[c].mIndex++;
+			}
+		}
+
+		for (size_t block = 0; block < numBlocks; block++)
+		{
+			size_t firstFrame = block * FRAMES_PER_BLOCK;
+			auto sampleAt = [&](size_t frame, int channel) {
+				frame = std::min(firstFrame + frame, numFrames - 1);
+				return samples[frame * channels + channel];
+			};
+
+			uint8_t* out = blocks.data() + block * BlockSize(channels);
+			for (int c = 0; c < channels; c++)
+			{
+				// Each block starts exactly on its first sample, keeping the
+				// step index from the end of the last block
+				Channel& channel = state[c];
+				int16_t first = sampleAt(0, c);
+				channel.mPredictor = first;
+				std::memcpy(out, &first, sizeof(first));
+				out[2] = static_cast<uint8_t>(channel.mIndex);
+				out[3] = 0;
+				out += HEADER_SIZE;
+
+				for (size_t i = 0; i < NIBBLE_BYTES; i++)
+				{
+					uint8_t low = channel.Encode(sampleAt(1 + i * 2, c));
+					uint8_t high = channel.Encode(sampleAt(2 + i * 2, c));
+					*out++ = static_cast<uint8_t>(low | (high << 4));
+				}
+			}
+		}
+		return blocks;
+	}
+
+	// Decodes one block into FRAMES_PER_BLOCK interleaved frames
+	inline void DecodeBlock(const uint8_t* block, int channels, int16_t* frames)
+	{
+		for (int c = 0; c < channels; c++)
+		{
+			Channel channel;
+			int16_t first = 0;
+			std::memcpy(&first, block, sizeof(first));
+			channel.mPredictor = first;
+			channel.mIndex = std::min<int>(block[2], 88);
+			block += HEADER_SIZE;
+
+			int16_t* out = frames + c;
+			*out = first;
+			for (size_t i = 0; i < NIBBLE_BYTES; i++)
+			{
+				out += channels;
+				*out = channel.Decode(block[i] & 0x0F);
+				out += channels;
+				*out = channel.Decode(block[i] >> 4);
+			}
+			block += NIBBLE_BYTES;
+		}
+	}
+}
@@ -1,4 +1,5 @@
 #define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include "catch.hpp"
 #include "catch_reporter_github.hpp"
 // Some Windows BS I guess included by Catch?
@@ -12,6 +13,15 @@
 // This is janky but doing it this way to account for weird include
 // dependencies people may have introduced into CollisionComponent.cpp
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <tuple>
 #include <vector>
 // Create dummy implementations for a few SDL functions/macros
 #ifdef SDL_assert
@@ -28,6 +38,9 @@
 #define protected public
 
 #include "AudioSystem.h"
+#include "ImaAdpcm.h"
+#include "SoundBankBuilder.h"
+#include "SoundManifest.h"
 
 Mock Mock::Mixer;
 
@@ -36,8 +49,129 @@ void SDL_Log(...)
 {
 }
 
+// Counts heap allocations, so tests can check a code path doesn't allocate
+static std::atomic<size_t> sNumAllocations = 0;
+
+void* operator new(size_t size)
+{
+	sNumAllocations++;
+	if (void* ptr = std::malloc(size == 0 ? 1 : size))
+	{
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+// GCC takes the free in these for a mismatch with operator new once they're
+// inlined into a delete, though the two are a pair
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	std::free(ptr);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
 const float DELTA_TIME = 0.016f;
 
+// Makes a fresh directory in the temp folder the current path, so
+// AudioSystem finds the sounds a test writes to its Assets/Sounds. The
+// old current path is put back and the directory deleted when it goes out
+// of scope, even if a REQUIRE fails partway through.
+class ScopedTempDir
+{
+public:
+	explicit ScopedTempDir(const std::string& name)
+	: mPath(std::filesystem::temp_directory_path() / name)
+	, mOldPath(std::filesystem::current_path())
+	{
+		std::filesystem::remove_all(mPath);
+		std::filesystem::create_directories(mPath);
+		std::filesystem::current_path(mPath);
+	}
+
+	~ScopedTempDir()
+	{
+		std::error_code ec{};
+		std::filesystem::current_path(mOldPath, ec);
+		std::filesystem::remove_all(mPath, ec);
+	}
+
+	ScopedTempDir(const ScopedTempDir&) = delete;
+	ScopedTempDir& operator=(const ScopedTempDir&) = delete;
+
+	const std::filesystem::path& GetPath() const { return mPath; }
+
+private:
+	std::filesystem::path mPath;
+	std::filesystem::path mOldPath;
+};
+
+// Writes numFiles sounds (alternating .wav and .ogg) of fileSize bytes each
+// to dir/Assets/Sounds
+static void WriteSoundCorpus(const std::filesystem::path& dir, int numFiles, size_t fileSize)
+{
+	std::filesystem::create_directories(dir / "Assets/Sounds");
+	std::string data(fileSize, '\0');
+	for (int i = 0; i < numFiles; i++)
+	{
+		std::fill(data.begin(), data.end(), static_cast<char>(i));
+		std::string fileName = std::to_string(i) + (i % 2 == 0 ? ".wav" : ".ogg");
+		std::ofstream(dir / "Assets/Sounds" / fileName, std::ios::binary) << data;
+	}
+}
+
+// Writes a WAV file in the mock mixer's format (44100 Hz, S16, stereo) with
+// the given samples, and any extra chunks (like a LIST chunk of tags)
+// between its fmt and data chunks
+static void WriteWav(const std::filesystem::path& path, const std::string& data,
+					 const std::string& extraChunks = "")
+{
+	auto writeU32 = [](std::ofstream& file, uint32_t value) {
+		file.write(reinterpret_cast<const char*>(&value), 4);
+	};
+	auto writeU16 = [](std::ofstream& file, uint16_t value) {
+		file.write(reinterpret_cast<const char*>(&value), 2);
+	};
+
+	std::filesystem::create_directories(path.parent_path());
+	std::ofstream file(path, std::ios::binary);
+	file.write("RIFF", 4);
+	writeU32(file, static_cast<uint32_t>(36 + extraChunks.size() + data.size()));
+	file.write("WAVEfmt ", 8);
+	writeU32(file, 16);
+	writeU16(file, 1);
+	writeU16(file, 2);
+	writeU32(file, 44100);
+	writeU32(file, 44100 * 4);
+	writeU16(file, 4);
+	writeU16(file, 16);
+	file << extraChunks;
+	file.write("data", 4);
+	writeU32(file, static_cast<uint32_t>(data.size()));
+	file << data;
+}
+
+// Writes a WAV file in the mock mixer's format whose data bytes are i % 251
+static void WriteStreamWav(const std::filesystem::path& path, uint32_t dataSize)
+{
+	std::string data(dataSize, '\0');
+	for (uint32_t i = 0; i < dataSize; i++)
+	{
+		data[i] = static_cast<char>(i % 251);
+	}
+	WriteWav(path, data);
+}
+
 TEST_CASE("AudioSystem tests")
 {
 	SECTION("Constructor")
@@ -301,6 +435,108 @@ TEST_CASE("AudioSystem tests")
 		REQUIRE(Mock::Mixer.mChannels[3].mChunk->mName == "Assets/Sounds/4.wav");
 	}
 	
+	SECTION("PlaySound reuses the lowest free channel first")
+	{
+		AudioSystem as(4);
+		as.CacheSound("1.wav");
+		as.CacheSound("2.wav");
+		as.CacheSound("3.wav");
+		as.CacheSound("4.wav");
+		as.CacheSound("5.wav");
+
+		SoundHandle snd = as.PlaySound("1.wav");
+		SoundHandle snd2 = as.PlaySound("2.wav");
+		SoundHandle snd3 = as.PlaySound("3.wav");
+		SoundHandle snd4 = as.PlaySound("4.wav");
+
+		// Free channels 3 and 1 (in that order)
+		as.StopSound(snd4);
+		as.StopSound(snd2);
+
+		SoundHandle snd5 = as.PlaySound("5.wav");
+		SoundHandle snd6 = as.PlaySound("1.wav");
+
+		// Channels should be in this order: snd, snd5, snd3, snd6
+		REQUIRE(as.mChannels[0] == snd);
+		REQUIRE(as.mChannels[1] == snd5);
+		REQUIRE(as.mChannels[2] == snd3);
+		REQUIRE(as.mChannels[3] == snd6);
+		REQUIRE(as.mHandleMap[snd5].mChannel == 1);
+		REQUIRE(as.mHandleMap[snd6].mChannel == 3);
+	}
+
+	SECTION("Update only looks at channels SDL_mixer reported as finished")
+	{
+		AudioSystem as(4);
+		as.CacheSound("1.wav");
+		as.CacheSound("2.wav");
+
+		SoundHandle snd = as.PlaySound("1.wav");
+		SoundHandle snd2 = as.PlaySound("2.wav");
+
+		// Mix_ChannelFinished should be hooked up
+		REQUIRE(Mock::Mixer.mChannelFinished != nullptr);
+
+		// Stopping without the callback is not noticed by Update
+		Mock::Mixer.mChannels[0].mPlaying = false;
+		as.Update(DELTA_TIME);
+		REQUIRE(as.mHandleMap.find(snd) != as.mHandleMap.end());
+		REQUIRE(as.mChannels[0] == snd);
+
+		// The callback queues the channel for the next Update
+		Mock::Mixer.mChannelFinished(0);
+		REQUIRE(as.mHandleMap.find(snd) != as.mHandleMap.end());
+		as.Update(DELTA_TIME);
+		REQUIRE(as.mHandleMap.find(snd) == as.mHandleMap.end());
+		REQUIRE(!as.mChannels[0].IsValid());
+		REQUIRE(as.mChannels[1] == snd2);
+		REQUIRE(as.mFinishedHead == as.mFinishedTail);
+	}
+
+	SECTION("Update - a channel that finishes again before Update is only queued once")
+	{
+		AudioSystem as(2);
+		as.CacheSound("1.wav");
+
+		// More reports than there are channels still fit in the ring
+		SoundHandle snd = as.PlaySound("1.wav");
+		for (int i = 0; i < 5; i++)
+		{
+			Mock::Mixer.mChannelFinished(0);
+			Mock::Mixer.mChannelFinished(1);
+		}
+		REQUIRE(as.mFinishedTail - as.mFinishedHead == 2);
+		REQUIRE(as.GetSoundState(snd) == SoundState::Playing);
+
+		// It's queued again once Update has handled it
+		Mock::Mixer.mChannels[0].mPlaying = false;
+		as.Update(DELTA_TIME);
+		REQUIRE(as.GetSoundState(snd) == SoundState::Stopped);
+		REQUIRE(as.mFinishedHead == as.mFinishedTail);
+		Mock::Mixer.mChannelFinished(1);
+		REQUIRE(as.mFinishedTail - as.mFinishedHead == 1);
+		REQUIRE(as.mFinishedRing[as.mFinishedHead % 2] == 1);
+	}
+
+	SECTION("Update ignores a finished channel that was reused before Update")
+	{
+		AudioSystem as(4);
+		as.CacheSound("1.wav");
+		as.CacheSound("2.wav");
+
+		SoundHandle snd = as.PlaySound("1.wav");
+		// StopSound halts the channel, which queues it as finished
+		as.StopSound(snd);
+		SoundHandle snd2 = as.PlaySound("2.wav");
+		REQUIRE(as.mChannels[0] == snd2);
+
+		as.Update(DELTA_TIME);
+
+		// The new sound should still be playing
+		REQUIRE(as.mChannels[0] == snd2);
+		REQUIRE(as.GetSoundState(snd2) == SoundState::Playing);
+	}
+
 	SECTION("PauseSound pauses a playing sound")
 	{
 		AudioSystem as(4);
@@ -573,118 +809,2094 @@ TEST_CASE("AudioSystem tests")
 		REQUIRE(as.mHandleMap.find(SoundHandle::Invalid) == as.mHandleMap.end());
 	}
 	
-	SECTION("PlaySound running out of channels priority 1 (oldest instance of same sound)")
+	SECTION("Stale SoundHandle is not found after its slot is reused")
 	{
 		AudioSystem as(4);
 		as.CacheSound("1.wav");
 		as.CacheSound("2.wav");
-		as.CacheSound("3.wav");
 
 		SoundHandle snd = as.PlaySound("1.wav");
+		as.StopSound(snd);
 		SoundHandle snd2 = as.PlaySound("2.wav");
+
+		// The new sound reuses the slot, but with a new generation
+		REQUIRE(snd2.GetIndex() == snd.GetIndex());
+		REQUIRE(snd2 != snd);
+		REQUIRE(as.mHandleMap.find(snd) == as.mHandleMap.end());
+		REQUIRE(as.GetSoundState(snd) == SoundState::Stopped);
+		REQUIRE(as.GetSoundState(snd2) == SoundState::Playing);
+
+		// Operating on the stale handle doesn't touch the new sound
+		as.PauseSound(snd);
+		as.StopSound(snd);
+		REQUIRE(as.GetSoundState(snd2) == SoundState::Playing);
+		REQUIRE(Mock::Mixer.mChannels[0].mPlaying);
+		REQUIRE(!Mock::Mixer.mChannels[0].mPaused);
+	}
+
+	SECTION("HandleMap is capped at the slots a handle can index")
+	{
+		HandleMap<int> map;
+		for (size_t i = 0; i < HandleMap<int>::MAX_SIZE; i++)
+		{
+			map.emplace(static_cast<int>(i));
+		}
+		REQUIRE(map.full());
+
+		// The last slot's index doesn't spill into the generation
+		SoundHandle last = map.at_slot(HandleMap<int>::MAX_SIZE - 1)->first;
+		REQUIRE(last.GetIndex() == HandleMap<int>::MAX_SIZE - 1);
+		REQUIRE(last.GetGeneration() == 1);
+		REQUIRE(map[last] == static_cast<int>(HandleMap<int>::MAX_SIZE - 1));
+
+		map.erase(map.find(last));
+		REQUIRE_FALSE(map.full());
+		REQUIRE(map.emplace(7)->first.GetIndex() == HandleMap<int>::MAX_SIZE - 1);
+	}
+
+	SECTION("PlaySound running out of channels skips stopped instances of the same sound")
+	{
+		AudioSystem as(4);
+		as.CacheSound("1.wav");
+		as.CacheSound("2.wav");
+		as.CacheSound("3.wav");
+
+		SoundHandle snd = as.PlaySound("2.wav");
+		SoundHandle snd2 = as.PlaySound("1.wav", true);
 		SoundHandle snd3 = as.PlaySound("2.wav");
 		SoundHandle snd4 = as.PlaySound("2.wav");
-		SoundHandle snd5 = as.PlaySound("2.wav");
 
-		// Channels should be in this order: snd, snd5, snd3, snd4
-		REQUIRE(as.mChannels[0] == snd);
-		REQUIRE(as.mChannels[1] == snd5);
-		REQUIRE(as.mChannels[2] == snd3);
-		REQUIRE(as.mChannels[3] == snd4);
+		// Stop the oldest 2.wav and fill its channel with a loop
+		as.StopSound(snd);
+		SoundHandle snd5 = as.PlaySound("1.wav", true);
+		REQUIRE(as.mChannels[0] == snd5);
 
-		// Make sure that snd2 is not in the map (and the others are)
-		REQUIRE(as.mHandleMap.find(snd2) == as.mHandleMap.end());
-		REQUIRE(as.mHandleMap.find(snd) != as.mHandleMap.end());
-		REQUIRE(as.mHandleMap.find(snd3) != as.mHandleMap.end());
-		REQUIRE(as.mHandleMap.find(snd4) != as.mHandleMap.end());
-		REQUIRE(as.mHandleMap.find(snd5) != as.mHandleMap.end());
+		// The oldest 2.wav still playing is now snd3
+		SoundHandle snd6 = as.PlaySound("2.wav");
+		REQUIRE(as.mChannels[2] == snd6);
+		REQUIRE(as.mHandleMap.find(snd3) == as.mHandleMap.end());
+
+		// Then snd4, since it's the oldest non-looping sound
+		SoundHandle snd7 = as.PlaySound("3.wav");
+		REQUIRE(as.mChannels[3] == snd7);
+		REQUIRE(as.mHandleMap.find(snd4) == as.mHandleMap.end());
+		REQUIRE(as.mChannels[1] == snd2);
+	}
+
+	SECTION("PlaySounds plays a batch of sounds")
+	{
+		AudioSystem as(4);
+		as.CacheSound("1.wav");
+		as.CacheSound("2.wav");
+
+		SoundRequest requests[] = {{"1.wav"}, {"2.wav", true}, {"2.wav"}};
+		std::span<const SoundHandle> handles = as.PlaySounds(requests);
+
+		REQUIRE(handles.size() == 3);
+		REQUIRE(handles[0].IsValid());
+		REQUIRE(handles[1].IsValid());
+		REQUIRE(handles[2].IsValid());
+
+		REQUIRE(as.mChannels[0] == handles[0]);
+		REQUIRE(as.mChannels[1] == handles[1]);
+		REQUIRE(as.mChannels[2] == handles[2]);
+		REQUIRE(as.mHandleMap[handles[1]].mSoundName == "2.wav");
+		REQUIRE(as.mHandleMap[handles[1]].mIsLooping);
 
-		// Make sure we have the correct sounds in SDL_Mixer
-		REQUIRE(Mock::Mixer.mChannels[0].mChunk != nullptr);
 		REQUIRE(Mock::Mixer.mChannels[0].mChunk->mName == "Assets/Sounds/1.wav");
-		REQUIRE(Mock::Mixer.mChannels[1].mChunk != nullptr);
 		REQUIRE(Mock::Mixer.mChannels[1].mChunk->mName == "Assets/Sounds/2.wav");
-		REQUIRE(Mock::Mixer.mChannels[2].mChunk != nullptr);
+		REQUIRE(Mock::Mixer.mChannels[1].mLoops == -1);
 		REQUIRE(Mock::Mixer.mChannels[2].mChunk->mName == "Assets/Sounds/2.wav");
-		REQUIRE(Mock::Mixer.mChannels[3].mChunk != nullptr);
-		REQUIRE(Mock::Mixer.mChannels[3].mChunk->mName == "Assets/Sounds/2.wav");
+		REQUIRE(Mock::Mixer.mChannels[2].mLoops == 0);
 	}
 
-	SECTION("PlaySound running out of channels priority 2 (oldest non-looping sound)")
+	SECTION("PlaySounds with more sounds than channels steals within the batch")
+	{
+		AudioSystem as(2);
+		as.CacheSound("1.wav");
+		as.CacheSound("2.wav");
+
+		SoundHandle snd = as.PlaySound("2.wav", true);
+		SoundRequest requests[] = {{"1.wav"}, {"1.wav"}, {"1.wav"}};
+		std::span<const SoundHandle> handles = as.PlaySounds(requests);
+
+		// Each request after the first steals the one before it, since that's
+		// the oldest instance of the same sound
+		REQUIRE(as.GetSoundState(snd) == SoundState::Playing);
+		REQUIRE(as.GetSoundState(handles[0]) == SoundState::Stopped);
+		REQUIRE(as.GetSoundState(handles[1]) == SoundState::Stopped);
+		REQUIRE(as.mChannels[0] == snd);
+		REQUIRE(as.mChannels[1] == handles[2]);
+		REQUIRE(Mock::Mixer.mChannels[0].mChunk->mName == "Assets/Sounds/2.wav");
+		REQUIRE(Mock::Mixer.mChannels[1].mChunk->mName == "Assets/Sounds/1.wav");
+	}
+
+	SECTION("SoundPolicy - max instances merges extra PlaySounds into the newest voice")
 	{
 		AudioSystem as(4);
 		as.CacheSound("1.wav");
 		as.CacheSound("2.wav");
-		as.CacheSound("3.wav");
-		as.CacheSound("4.wav");
-		as.CacheSound("5.wav");
+		SoundPolicy policy;
+		policy.mMaxInstances = 2;
+		as.SetSoundPolicy("1.wav", policy);
 
-		SoundHandle snd = as.PlaySound("1.wav", true);
-		SoundHandle snd2 = as.PlaySound("2.wav", true);
-		SoundHandle snd3 = as.PlaySound("3.wav");
-		SoundHandle snd4 = as.PlaySound("4.wav", true);
-		SoundHandle snd5 = as.PlaySound("5.wav");
+		SoundHandle snd = as.PlaySound("1.wav");
+		as.Update(DELTA_TIME);
+		SoundHandle snd2 = as.PlaySound("1.wav");
+		as.Update(DELTA_TIME);
+		SoundHandle snd3 = as.PlaySound("1.wav");
+		SoundHandle snd4 = as.PlaySound("2.wav");
 
-		// Channels should be in this order: snd, snd2, snd5, snd4
+		REQUIRE(snd != snd2);
+		REQUIRE(snd3 == snd2);
 		REQUIRE(as.mChannels[0] == snd);
 		REQUIRE(as.mChannels[1] == snd2);
-		REQUIRE(as.mChannels[2] == snd5);
-		REQUIRE(as.mChannels[3] == snd4);
+		REQUIRE(as.mChannels[2] == snd4);
+		REQUIRE(!as.mChannels[3].IsValid());
 
-		// Make sure that snd3 is not in the map (and the others are)
-		REQUIRE(as.mHandleMap.find(snd3) == as.mHandleMap.end());
-		REQUIRE(as.mHandleMap.find(snd) != as.mHandleMap.end());
-		REQUIRE(as.mHandleMap.find(snd2) != as.mHandleMap.end());
-		REQUIRE(as.mHandleMap.find(snd4) != as.mHandleMap.end());
-		REQUIRE(as.mHandleMap.find(snd5) != as.mHandleMap.end());
+		// Once one stops, a new voice can start again
+		as.StopSound(snd);
+		SoundHandle snd5 = as.PlaySound("1.wav");
+		REQUIRE(snd5 != snd2);
+		REQUIRE(as.mChannels[0] == snd5);
+	}
 
-		// Make sure we have the correct sounds in SDL_Mixer
-		REQUIRE(Mock::Mixer.mChannels[0].mChunk != nullptr);
-		REQUIRE(Mock::Mixer.mChannels[0].mChunk->mName == "Assets/Sounds/1.wav");
-		REQUIRE(Mock::Mixer.mChannels[1].mChunk != nullptr);
-		REQUIRE(Mock::Mixer.mChannels[1].mChunk->mName == "Assets/Sounds/2.wav");
-		REQUIRE(Mock::Mixer.mChannels[2].mChunk != nullptr);
-		REQUIRE(Mock::Mixer.mChannels[2].mChunk->mName == "Assets/Sounds/5.wav");
-		REQUIRE(Mock::Mixer.mChannels[3].mChunk != nullptr);
-		REQUIRE(Mock::Mixer.mChannels[3].mChunk->mName == "Assets/Sounds/4.wav");
+	SECTION("SoundPolicy - loops and one-shots of a sound never merge into each other")
+	{
+		AudioSystem as(4);
+		as.CacheSound("1.wav");
+		SoundPolicy policy;
+		policy.mMaxInstances = 2;
+		policy.mMinRetriggerInterval = 0.05f;
+		as.SetSoundPolicy("1.wav", policy);
+
+		// A retrigger only merges into the last voice if it loops the same way
+		SoundHandle loop = as.PlaySound("1.wav", true);
+		SoundHandle oneShot = as.PlaySound("1.wav");
+		REQUIRE(oneShot != loop);
+		REQUIRE(as.PlaySound("1.wav", true) == loop);
+		REQUIRE(as.PlaySound("1.wav") == oneShot);
+
+		// At max instances, it merges into the newest voice that matches
+		as.Update(0.1f);
+		REQUIRE(as.PlaySound("1.wav", true) == loop);
+		REQUIRE(as.mHandleMap[loop].mIsLooping);
+		REQUIRE(as.PlaySound("1.wav") == oneShot);
+		REQUIRE_FALSE(as.mHandleMap[oneShot].mIsLooping);
+
+		// With none that matches, it starts a new voice after all
+		as.StopSound(oneShot);
+		as.Update(0.1f);
+		SoundHandle oneShot2 = as.PlaySound("1.wav");
+		SoundHandle loop2 = as.PlaySound("1.wav", true);
+		REQUIRE(oneShot2 != loop);
+		REQUIRE(loop2 == loop);
+		SoundRequest requests[] = {{"1.wav", true}, {"1.wav", false}};
+		std::span<const SoundHandle> handles = as.PlaySounds(requests);
+		REQUIRE(handles[0] == loop);
+		REQUIRE(handles[1] == oneShot2);
 	}
 
-	SECTION("PlaySound running out of channels priority 3 (oldest sound)")
+	SECTION("SoundPolicy - retriggers in the same frame merge with a volume boost")
 	{
 		AudioSystem as(4);
 		as.CacheSound("1.wav");
 		as.CacheSound("2.wav");
-		as.CacheSound("3.wav");
-		as.CacheSound("4.wav");
-		as.CacheSound("5.wav");
+		SoundPolicy policy;
+		policy.mMinRetriggerInterval = 0.05f;
+		policy.mVolume = 64;
+		policy.mMergeVolumeBoost = 16;
+		as.SetSoundPolicy("1.wav", policy);
+
+		SoundRequest requests[] = {{"1.wav"}, {"1.wav"}, {"1.wav"}};
+		std::span<const SoundHandle> handles = as.PlaySounds(requests);
+		REQUIRE(handles[1] == handles[0]);
+		REQUIRE(handles[2] == handles[0]);
+		REQUIRE(!as.mChannels[1].IsValid());
+		REQUIRE(as.mHandleMap[handles[0]].mVolume == 96);
+		REQUIRE(Mock::Mixer.mChannels[0].mVolume == 96);
 
-		SoundHandle snd = as.PlaySound("1.wav", true);
-		SoundHandle snd2 = as.PlaySound("2.wav", true);
-		SoundHandle snd3 = as.PlaySound("3.wav", true);
-		SoundHandle snd4 = as.PlaySound("4.wav", true);
-		SoundHandle snd5 = as.PlaySound("5.wav");
+		SoundHandle snd = as.PlaySound("1.wav");
+		REQUIRE(snd == handles[0]);
+		REQUIRE(Mock::Mixer.mChannels[0].mVolume == 112);
 
-		// Channels should be in this order: snd5, snd2, snd3, snd4
-		REQUIRE(as.mChannels[0] == snd5);
+		// Outside the interval it starts a new voice at the policy volume
+		as.Update(0.1f);
+		SoundHandle snd2 = as.PlaySound("1.wav");
+		REQUIRE(snd2 != snd);
 		REQUIRE(as.mChannels[1] == snd2);
-		REQUIRE(as.mChannels[2] == snd3);
-		REQUIRE(as.mChannels[3] == snd4);
+		REQUIRE(Mock::Mixer.mChannels[1].mVolume == 64);
 
-		// Make sure that snd is not in the map (and the others are)
-		REQUIRE(as.mHandleMap.find(snd) == as.mHandleMap.end());
-		REQUIRE(as.mHandleMap.find(snd2) != as.mHandleMap.end());
-		REQUIRE(as.mHandleMap.find(snd3) != as.mHandleMap.end());
-		REQUIRE(as.mHandleMap.find(snd4) != as.mHandleMap.end());
-		REQUIRE(as.mHandleMap.find(snd5) != as.mHandleMap.end());
+		// A different sound on the first channel goes back to full volume
+		as.StopSound(snd);
+		as.PlaySound("2.wav");
+		REQUIRE(Mock::Mixer.mChannels[0].mVolume == MIX_MAX_VOLUME);
+	}
 
-		// Make sure we have the correct sounds in SDL_Mixer
-		REQUIRE(Mock::Mixer.mChannels[0].mChunk != nullptr);
-		REQUIRE(Mock::Mixer.mChannels[0].mChunk->mName == "Assets/Sounds/5.wav");
-		REQUIRE(Mock::Mixer.mChannels[1].mChunk != nullptr);
-		REQUIRE(Mock::Mixer.mChannels[1].mChunk->mName == "Assets/Sounds/2.wav");
-		REQUIRE(Mock::Mixer.mChannels[2].mChunk != nullptr);
-		REQUIRE(Mock::Mixer.mChannels[2].mChunk->mName == "Assets/Sounds/3.wav");
-		REQUIRE(Mock::Mixer.mChannels[3].mChunk != nullptr);
-		REQUIRE(Mock::Mixer.mChannels[3].mChunk->mName == "Assets/Sounds/4.wav");
+	SECTION("StopAllSounds stops every sound and frees every channel")
+	{
+		AudioSystem as(4);
+		as.CacheSound("1.wav");
+		as.CacheSound("2.wav");
+
+		SoundHandle snd = as.PlaySound("1.wav");
+		SoundHandle snd2 = as.PlaySound("2.wav", true);
+		as.StopAllSounds();
+
+		REQUIRE(as.GetSoundState(snd) == SoundState::Stopped);
+		REQUIRE(as.GetSoundState(snd2) == SoundState::Stopped);
+		for (int i = 0; i < 4; i++)
+		{
+			REQUIRE(!as.mChannels[i].IsValid());
+			REQUIRE(!Mock::Mixer.mChannels[i].mPlaying);
+		}
+
+		SoundHandle snd3 = as.PlaySound("2.wav");
+		REQUIRE(as.mChannels[0] == snd3);
 	}
+
+	SECTION("Buses pause, resume and stop only the sounds on them")
+	{
+		AudioSystem as(4);
+		as.CacheSound("1.wav");
+		as.CacheSound("2.wav");
+		as.CacheSound("3.wav");
+
+		SoundHandle snd = as.PlaySound("1.wav", true);
+		SoundHandle snd2 = as.PlaySound("2.wav");
+		SoundHandle snd3 = as.PlaySound("3.wav", true);
+		as.SetSoundBus(snd, "SFX");
+		as.SetSoundBus(snd2, "Menu");
+		as.SetSoundBus(snd3, "SFX");
+
+		as.PauseBus("SFX");
+		REQUIRE(as.GetSoundState(snd) == SoundState::Paused);
+		REQUIRE(as.GetSoundState(snd2) == SoundState::Playing);
+		REQUIRE(as.GetSoundState(snd3) == SoundState::Paused);
+		REQUIRE(Mock::Mixer.mChannels[0].mPaused);
+		REQUIRE(!Mock::Mixer.mChannels[1].mPaused);
+		REQUIRE(Mock::Mixer.mChannels[2].mPaused);
+
+		as.ResumeBus("SFX");
+		REQUIRE(as.GetSoundState(snd) == SoundState::Playing);
+		REQUIRE(as.GetSoundState(snd3) == SoundState::Playing);
+		REQUIRE(!Mock::Mixer.mChannels[0].mPaused);
+
+		// Moving a sound to another bus takes it off the old one
+		as.SetSoundBus(snd3, "Menu");
+		as.StopBus("SFX");
+		REQUIRE(as.GetSoundState(snd) == SoundState::Stopped);
+		REQUIRE(as.GetSoundState(snd3) == SoundState::Playing);
+		REQUIRE(!as.mChannels[0].IsValid());
+
+		// A sound that stops on its own leaves its bus
+		Mock::Mixer.HaltChannel(1);
+		as.Update(DELTA_TIME);
+		as.StopBus("Menu");
+		REQUIRE(as.GetSoundState(snd3) == SoundState::Stopped);
+		REQUIRE(as.mBuses["Menu"].mVoices.mHead == AudioSystem::NO_SLOT);
+		REQUIRE(as.mHandleMap.empty());
+	}
+
+	SECTION("RegisterSound returns a SoundId that PlaySound and CacheSound accept")
+	{
+		AudioSystem as(4);
+		SoundId id = as.RegisterSound("1.wav");
+		SoundId id2 = as.RegisterSound("2.wav");
+		REQUIRE(id.IsValid());
+		REQUIRE(id != id2);
+		REQUIRE(as.RegisterSound("1.wav") == id);
+
+		// Registering doesn't load
+		REQUIRE(Mock::Mixer.mChunks.empty());
+		as.CacheSound(id);
+		REQUIRE(Mock::Mixer.mChunks.size() == 1);
+
+		SoundHandle snd = as.PlaySound(id);
+		SoundHandle snd2 = as.PlaySound(id2, true);
+		REQUIRE(as.mHandleMap[snd].mSoundName == "1.wav");
+		REQUIRE(as.mHandleMap[snd].mSoundId == id);
+		REQUIRE(as.mHandleMap[snd2].mSoundName == "2.wav");
+		REQUIRE(as.mHandleMap[snd2].mIsLooping);
+		REQUIRE(Mock::Mixer.mChannels[0].mChunk->mName == "Assets/Sounds/1.wav");
+		REQUIRE(Mock::Mixer.mChannels[1].mChunk->mName == "Assets/Sounds/2.wav");
+
+		// Name and id share the same cached chunk
+		REQUIRE(as.GetSound("2.wav") == Mock::Mixer.mChannels[1].mChunk);
+		REQUIRE(Mock::Mixer.mChunks.size() == 2);
+
+		REQUIRE(!as.PlaySound(SoundId::Invalid).IsValid());
+	}
+
+	SECTION("PlaySound with a SoundId doesn't allocate")
+	{
+		AudioSystem as(4);
+		SoundId id = as.RegisterSound("ALongSoundNameThatDoesNotFitInSSO.wav");
+		as.CacheSound(id);
+
+		// Play once so everything that grows has grown
+		SoundHandle snd = as.PlaySound(id);
+		as.StopSound(snd);
+		as.Update(DELTA_TIME);
+
+		size_t numAllocations = sNumAllocations;
+		for (int i = 0; i < 100; i++)
+		{
+			snd = as.PlaySound(id, i % 2 == 0);
+			as.PauseSound(snd);
+			as.ResumeSound(snd);
+			as.GetSoundState(snd);
+			as.StopSound(snd);
+			as.Update(DELTA_TIME);
+		}
+		numAllocations = sNumAllocations - numAllocations;
+
+		REQUIRE(numAllocations == 0);
+		REQUIRE(as.mHandleMap[as.PlaySound(id)].mSoundName ==
+				"ALongSoundNameThatDoesNotFitInSSO.wav");
+	}
+
+	SECTION("Sounds in the build-time manifest have their SoundManifest index as their SoundId")
+	{
+		AudioSystem as(4);
+		REQUIRE(as.mSoundIds.size() == SoundManifest::Count);
+		for (uint32_t i = 0; i < SoundManifest::Count; i++)
+		{
+			REQUIRE(as.RegisterSound(std::string(SoundManifest::Names[i])) == SoundId(i));
+		}
+	}
+
+	SECTION("Sounds in a manifest get the first SoundIds, and are all CacheAllSounds loads")
+	{
+		ScopedTempDir tempDir("AudioSystemManifest");
+		const std::filesystem::path& dir = tempDir.GetPath();
+		WriteSoundCorpus(dir, 3, 256);
+		const std::array<std::string_view, 2> manifest = {"2.wav", "0.wav"};
+		{
+			AudioSystem as(4, manifest);
+			REQUIRE(as.mSoundIds.size() == 2);
+			REQUIRE(as.RegisterSound("2.wav") == SoundId(0));
+			REQUIRE(as.RegisterSound("0.wav") == SoundId(1));
+
+			// Registering a sound that isn't in the manifest adds a new SoundId
+			SoundId id = as.RegisterSound("NotInManifest.wav");
+			REQUIRE(id.GetIndex() == 2);
+
+			// 1.ogg is in the folder, but not the manifest. The manifest lists
+			// the sounds, so the index only keeps their size and duration.
+			as.SetSoundIndexPath("SoundIndex.bin");
+			as.CacheAllSounds();
+			REQUIRE(std::filesystem::file_size("SoundIndex.bin") ==
+					sizeof(AudioSystem::SoundIndexHeader) +
+						2 * sizeof(AudioSystem::SoundIndexEntry) + std::string("2.wav0.wav").size());
+			REQUIRE(Mock::Mixer.mChunks.size() == 2);
+			REQUIRE(as.GetSound("2.wav") != nullptr);
+			REQUIRE(as.GetSound("0.wav") != nullptr);
+			REQUIRE(as.mSounds.count("Assets/Sounds/1.ogg") == 0);
+		}
+
+		// Lazy caching takes the sizes and durations from it, even after the
+		// folder changes
+		{
+			std::fstream index("SoundIndex.bin", std::ios::binary | std::ios::in | std::ios::out);
+			double duration = 42.0;
+			index.seekp(sizeof(AudioSystem::SoundIndexHeader) +
+						offsetof(AudioSystem::SoundIndexEntry, mDuration));
+			index.write(reinterpret_cast<const char*>(&duration), sizeof(duration));
+		}
+		std::ofstream("Assets/Sounds/New.wav", std::ios::binary) << std::string(64, '\0');
+		AudioSystem lazy(4, manifest);
+		lazy.SetSoundIndexPath("SoundIndex.bin");
+		lazy.SetLazyCaching(true);
+		lazy.CacheAllSounds();
+		REQUIRE(lazy.GetSoundMetadata("2.wav").mDuration == 42.0);
+		REQUIRE(lazy.GetSoundMetadata("2.wav").mFileSize == 256);
+		REQUIRE(lazy.GetSoundMetadata("0.wav").mFileSize == 256);
+		REQUIRE(lazy.mSounds.count("Assets/Sounds/New.wav") == 0);
+		REQUIRE(lazy.mSounds.count("Assets/Sounds/1.ogg") == 0);
+	}
+
+	SECTION("CacheAllSounds loads every sound in Assets/Sounds on the worker pool")
+	{
+		ScopedTempDir tempDir("AudioSystemCorpus");
+		const std::filesystem::path& dir = tempDir.GetPath();
+		WriteSoundCorpus(dir, 64, 256);
+		{
+			// No manifest, so CacheAllSounds goes through the folder whatever
+			// sounds the build found
+			AudioSystem as(4, {});
+			as.CacheSound("0.wav");
+			as.CacheAllSounds();
+
+			// 0.wav was already loaded, so it isn't loaded again
+			REQUIRE(Mock::Mixer.mChunks.size() == 64);
+			for (int i = 0; i < 64; i++)
+			{
+				std::string fileName = std::to_string(i) + (i % 2 == 0 ? ".wav" : ".ogg");
+				Mix_Chunk* chunk = as.GetSound(fileName);
+				REQUIRE(chunk != nullptr);
+				REQUIRE(chunk->mName == "Assets/Sounds/" + fileName);
+				REQUIRE(chunk->alen == 256);
+				REQUIRE(chunk->abuf[255] == static_cast<Uint8>(i));
+			}
+		}
+	}
+
+	SECTION("Sound index - CacheAllSounds skips the folder and unchanged files on a warm start")
+	{
+		ScopedTempDir tempDir("AudioSystemIndex");
+		const std::filesystem::path& dir = tempDir.GetPath();
+		WriteSoundCorpus(dir, 8, 256);
+		const std::string indexPath = "SoundIndex.bin";
+		{
+			AudioSystem as(4, {});
+			as.SetSoundIndexPath(indexPath);
+			as.SetLazyCaching(true);
+			as.CacheAllSounds();
+		}
+		REQUIRE(std::filesystem::file_size(indexPath) ==
+				sizeof(AudioSystem::SoundIndexHeader) + 8 * sizeof(AudioSystem::SoundIndexEntry) +
+					std::string("0.wav1.ogg2.wav3.ogg4.wav5.ogg6.wav7.ogg").size());
+
+		// Mark every entry's duration, so it shows which sounds came from it
+		{
+			std::fstream index(indexPath, std::ios::binary | std::ios::in | std::ios::out);
+			for (int i = 0; i < 8; i++)
+			{
+				double duration = 42.0;
+				index.seekp(sizeof(AudioSystem::SoundIndexHeader) +
+							i * sizeof(AudioSystem::SoundIndexEntry) +
+							offsetof(AudioSystem::SoundIndexEntry, mDuration));
+				index.write(reinterpret_cast<const char*>(&duration), sizeof(duration));
+			}
+		}
+
+		// A file edited in place is the only one indexed again. A new file
+		// is missed while the folder's time says nothing was added...
+		auto folderTime = std::filesystem::last_write_time("Assets/Sounds");
+		std::ofstream("Assets/Sounds/3.ogg", std::ios::binary) << std::string(512, '\0');
+		std::ofstream("Assets/Sounds/New.wav", std::ios::binary) << std::string(64, '\0');
+		std::filesystem::last_write_time("Assets/Sounds", folderTime);
+		{
+			AudioSystem as(4, {});
+			as.SetSoundIndexPath(indexPath);
+			as.SetLazyCaching(true);
+			as.CacheAllSounds();
+			REQUIRE(Mock::Mixer.mChunks.empty());
+			REQUIRE(as.GetSoundMetadata("0.wav").mDuration == 42.0);
+			REQUIRE(as.GetSoundMetadata("0.wav").mFileSize == 256);
+			REQUIRE(as.GetSoundMetadata("3.ogg").mDuration != 42.0);
+			REQUIRE(as.GetSoundMetadata("3.ogg").mFileSize == 512);
+			REQUIRE(as.GetSoundMetadata("New.wav").mFileSize == 0);
+		}
+
+		// ...and found once it does
+		std::filesystem::last_write_time("Assets/Sounds", folderTime + std::chrono::seconds(1));
+		{
+			AudioSystem as(4, {});
+			as.SetSoundIndexPath(indexPath);
+			as.CacheAllSounds();
+			REQUIRE(Mock::Mixer.mChunks.size() == 9);
+		}
+		{
+			AudioSystem as(4, {});
+			as.SetSoundIndexPath(indexPath);
+			as.SetLazyCaching(true);
+			as.CacheAllSounds();
+			REQUIRE(as.GetSoundMetadata("New.wav").mFileSize == 64);
+			REQUIRE(as.GetSoundMetadata("3.ogg").mFileSize == 512);
+		}
+	}
+
+	SECTION("Sounds that don't load aren't added to mSounds")
+	{
+		AudioSystem as(4);
+		size_t numSounds = as.mSounds.size();
+		Mock::Mixer.mFailLoads = true;
+		REQUIRE_FALSE(as.PlaySound("Missing.wav").IsValid());
+		SoundRequest requests[] = {{"Missing.wav"}, {"Missing2.wav"}};
+		REQUIRE_FALSE(as.PlaySounds(requests)[1].IsValid());
+		REQUIRE_FALSE(as.PlayStream("Missing.wav").IsValid());
+		REQUIRE(as.GetSound("Missing.wav") == nullptr);
+		as.CacheSound("Missing.wav");
+		as.SetSoundPolicy("Missing.wav", SoundPolicy());
+		as.UnloadSound("Missing.wav");
+		REQUIRE(as.GetSoundMetadata("Missing.wav").mFileSize == 0);
+		REQUIRE(as.mSounds.size() == numSounds);
+
+		// Once it does load, it's kept
+		Mock::Mixer.mFailLoads = false;
+		REQUIRE(as.PlaySound("Missing.wav").IsValid());
+		REQUIRE(as.mSounds.size() == numSounds + 1);
+	}
+
+	SECTION("CacheSoundAsync - A sound it added is removed if it doesn't load")
+	{
+		AudioSystem as(4);
+		size_t numSounds = as.mSounds.size();
+		Mock::Mixer.mFailLoads = true;
+		LoadTicket ticket = as.CacheSoundAsync("Missing.wav");
+		SoundHandle h = as.PlaySound("Missing.wav");
+		REQUIRE(as.mSounds.size() == numSounds + 1);
+		ticket.Wait();
+		as.Update(DELTA_TIME);
+		REQUIRE(as.GetSoundState(h) == SoundState::Stopped);
+		REQUIRE(as.FindSoundInfo("Missing.wav") == nullptr);
+		REQUIRE(as.mSounds.size() == numSounds);
+
+		// A registered sound keeps its SoundId, and so its SoundInfo
+		SoundId id = as.RegisterSound("Missing.wav");
+		ticket = as.CacheSoundAsync("Missing.wav");
+		ticket.Wait();
+		as.Update(DELTA_TIME);
+		REQUIRE(as.FindSoundInfo("Missing.wav") == as.mSoundIds[id.GetIndex()]);
+		Mock::Mixer.mFailLoads = false;
+	}
+
+	SECTION("CacheSoundAsync - PlaySound before the sound loads starts it on Update")
+	{
+		AudioSystem as(4);
+		LoadTicket ticket = as.CacheSoundAsync("1.wav");
+		REQUIRE(ticket.IsValid());
+
+		// The chunk isn't handed over until Update, so this is always pending
+		SoundHandle h = as.PlaySound("1.wav");
+		REQUIRE(h.IsValid());
+		REQUIRE(as.GetSoundState(h) == SoundState::Loading);
+		REQUIRE(as.mHandleMap[h].mChannel == 0);
+		REQUIRE(Mix_Playing(0) == 0);
+
+		ticket.Wait();
+		REQUIRE(ticket.IsReady());
+		as.Update(DELTA_TIME);
+		REQUIRE(as.GetSoundState(h) == SoundState::Playing);
+		REQUIRE(Mix_Playing(0) == 1);
+		REQUIRE(Mock::Mixer.mChannels[0].mChunk->mName == "Assets/Sounds/1.wav");
+		REQUIRE(Mock::Mixer.mChunks.size() == 1);
+
+		// Once loaded, the ticket is ready right away
+		REQUIRE(as.CacheSoundAsync("1.wav").IsReady());
+	}
+
+	SECTION("CacheSoundAsync - Voices stopped or paused while loading")
+	{
+		AudioSystem as(4);
+		LoadTicket ticket = as.CacheSoundAsync("1.wav");
+		SoundHandle stopped = as.PlaySound("1.wav");
+		SoundHandle paused = as.PlaySound("1.wav", true);
+		as.StopSound(stopped);
+		as.PauseSound(paused);
+		REQUIRE(as.GetSoundState(paused) == SoundState::Paused);
+
+		ticket.Wait();
+		as.Update(DELTA_TIME);
+		REQUIRE(as.GetSoundState(stopped) == SoundState::Stopped);
+		REQUIRE(Mix_Playing(0) == 0);
+		REQUIRE(as.mHandleMap[paused].mChannel == 1);
+		REQUIRE(Mock::Mixer.mChannels[1].mPaused);
+
+		as.ResumeSound(paused);
+		REQUIRE(as.GetSoundState(paused) == SoundState::Playing);
+		REQUIRE_FALSE(Mock::Mixer.mChannels[1].mPaused);
+	}
+
+	SECTION("CacheSoundAsync - CacheSound and GetSound don't wait for the load or load again")
+	{
+		AudioSystem as(4);
+		LoadTicket ticket = as.CacheSoundAsync("1.wav");
+		as.CacheSoundAsync("1.wav");
+		as.CacheSound("1.wav");
+		as.CacheSound(as.RegisterSound("1.wav"));
+		REQUIRE(as.GetSound("1.wav") == nullptr);
+		REQUIRE(as.mLoadingSounds.size() == 1);
+
+		// The sound lands on Update, even once it's decoded
+		ticket.Wait();
+		REQUIRE(as.GetSound("1.wav") == nullptr);
+		as.Update(DELTA_TIME);
+		REQUIRE(as.GetSound("1.wav") != nullptr);
+		REQUIRE(as.mLoadingSounds.empty());
+		REQUIRE(Mock::Mixer.mChunks.size() == 1);
+
+		// CacheAllSounds leaves the sounds that are loading for Update too
+		ticket = as.CacheSoundAsync("4.wav");
+		as.CacheAllSounds();
+		REQUIRE(as.mLoadingSounds.size() == 1);
+		size_t numChunks = Mock::Mixer.mChunks.size();
+		ticket.Wait();
+		as.Update(DELTA_TIME);
+		REQUIRE(as.GetSound("4.wav") != nullptr);
+		REQUIRE(Mock::Mixer.mChunks.size() == numChunks + 1);
+
+		// Sounds still loading when the AudioSystem is destroyed are freed
+		as.CacheSoundAsync("2.wav");
+		as.CacheSoundAsync(as.RegisterSound("3.wav"));
+	}
+
+	SECTION("Sound cache budget - evicts the least recently played sound that isn't playing")
+	{
+		AudioSystem as(4);
+		const size_t chunkSize = Mock::Mixer.mFrequency * 4;
+		as.SetSoundCacheBudget(chunkSize * 2);
+		as.CacheSound("1.wav");
+		as.CacheSound("2.wav");
+		REQUIRE(as.GetSoundCacheStats().mResidentBytes == chunkSize * 2);
+		REQUIRE(as.GetSoundCacheStats().mMisses == 2);
+
+		// 1.wav was played more recently, so 2.wav is evicted
+		as.StopSound(as.PlaySound("1.wav"));
+		REQUIRE(as.GetSoundCacheStats().mHits == 1);
+		as.CacheSound("3.wav");
+		REQUIRE(as.GetSoundCacheStats().mEvictions == 1);
+		REQUIRE(as.GetSoundCacheStats().mResidentBytes == chunkSize * 2);
+		REQUIRE(Mock::Mixer.mChunks.size() == 2);
+		REQUIRE(as.mSounds["Assets/Sounds/1.wav"].mChunk != nullptr);
+		REQUIRE(as.mSounds["Assets/Sounds/2.wav"].mChunk == nullptr);
+
+		// A playing sound isn't evicted even though it's the oldest
+		SoundHandle h = as.PlaySound("1.wav", true);
+		as.CacheSound("3.wav");
+		as.CacheSound("2.wav");
+		REQUIRE(as.GetSoundCacheStats().mMisses == 4);
+		REQUIRE(as.mSounds["Assets/Sounds/1.wav"].mChunk != nullptr);
+		REQUIRE(as.mSounds["Assets/Sounds/3.wav"].mChunk == nullptr);
+		REQUIRE(as.GetSoundState(h) == SoundState::Playing);
+
+		// Evicted sounds load again when they're played
+		SoundHandle h3 = as.PlaySound("3.wav");
+		REQUIRE(as.GetSoundState(h3) == SoundState::Playing);
+		REQUIRE(as.mSounds["Assets/Sounds/3.wav"].mChunk != nullptr);
+		REQUIRE(as.mSounds["Assets/Sounds/2.wav"].mChunk == nullptr);
+		REQUIRE(as.GetSoundCacheStats().mEvictions == 3);
+
+		// Lowering the budget evicts right away
+		as.StopAllSounds();
+		as.SetSoundCacheBudget(chunkSize);
+		REQUIRE(as.GetSoundCacheStats().mResidentBytes == chunkSize);
+		REQUIRE(Mock::Mixer.mChunks.size() == 1);
+	}
+
+	SECTION("Sound cache budget - CacheAllSounds stops loading once the budget is full")
+	{
+		ScopedTempDir tempDir("AudioSystemBudget");
+		WriteSoundCorpus(tempDir.GetPath(), 64, 256);
+		AudioSystem as(4, {});
+		as.SetSoundCacheBudget(256 * 3);
+		as.CacheAllSounds();
+
+		// Each worker may finish the sound it's on, but none are started
+		// after that
+		REQUIRE(as.GetSoundCacheStats().mResidentBytes == 256 * 3);
+		REQUIRE(as.GetSoundCacheStats().mMisses < 64);
+		REQUIRE(Mock::Mixer.mChunks.size() == 3);
+
+		// The sounds that weren't loaded still load when they're played
+		REQUIRE(as.GetSoundState(as.PlaySound("63.ogg")) == SoundState::Playing);
+	}
+
+	SECTION("UnloadSound - frees the sound once its last voice stops")
+	{
+		AudioSystem as(4);
+		SoundHandle h1 = as.PlaySound("1.wav");
+		SoundHandle h2 = as.PlaySound("1.wav");
+		as.PlaySound("2.wav");
+		as.UnloadSound("1.wav");
+		REQUIRE(Mock::Mixer.mChunks.size() == 2);
+
+		as.StopSound(h1);
+		REQUIRE(Mock::Mixer.mChunks.size() == 2);
+
+		// The last voice finishing on its own releases it too
+		Mock::Mixer.HaltChannel(as.mHandleMap[h2].mChannel);
+		as.Update(DELTA_TIME);
+		REQUIRE(Mock::Mixer.mChunks.size() == 1);
+		REQUIRE(as.mSounds["Assets/Sounds/1.wav"].mChunk == nullptr);
+		REQUIRE(as.GetSoundCacheStats().mResidentBytes ==
+				static_cast<size_t>(Mock::Mixer.mFrequency) * 4);
+
+		// It loads again the next time it's played
+		SoundHandle h3 = as.PlaySound("1.wav");
+		REQUIRE(as.GetSoundState(h3) == SoundState::Playing);
+		REQUIRE(Mock::Mixer.mChunks.size() == 2);
+	}
+
+	SECTION("UnloadSound - playing the sound again cancels the unload, and stealing releases it")
+	{
+		AudioSystem as(2);
+		SoundId id = as.RegisterSound("1.wav");
+		as.PlaySound(id);
+		as.UnloadSound(id);
+		SoundHandle h = as.PlaySound(id);
+		as.StopAllSounds();
+		REQUIRE(as.mSounds["Assets/Sounds/1.wav"].mChunk != nullptr);
+		REQUIRE(as.GetSoundState(h) == SoundState::Stopped);
+
+		// Stealing the last voice of an unloaded sound frees it
+		as.PlaySound("1.wav");
+		as.PlaySound("2.wav");
+		as.UnloadSound("1.wav");
+		SoundHandle h3 = as.PlaySound("3.wav");
+		REQUIRE(as.mHandleMap[h3].mChannel == 0);
+		REQUIRE(as.mSounds["Assets/Sounds/1.wav"].mChunk == nullptr);
+		REQUIRE(Mock::Mixer.mChunks.size() == 2);
+	}
+
+	SECTION("UnloadUnused - frees every sound that isn't playing")
+	{
+		AudioSystem as(4);
+		as.CacheSound("1.wav");
+		as.CacheSound("2.wav");
+		SoundHandle h = as.PlaySound("3.wav", true);
+		as.UnloadUnused();
+		REQUIRE(Mock::Mixer.mChunks.size() == 1);
+		REQUIRE(as.GetSoundState(h) == SoundState::Playing);
+		REQUIRE(as.mSounds["Assets/Sounds/3.wav"].mChunk != nullptr);
+		REQUIRE(as.GetSoundCacheStats().mEvictions == 0);
+	}
+
+	SECTION("Sound bank - sounds in the bank play straight from the mapping")
+	{
+		std::string bankPath = (std::filesystem::temp_directory_path() / "Test.bank").string();
+		std::vector<SoundBank::Sound> sounds = {
+			{"Zap.wav", std::vector<uint8_t>(1000, 7)},
+			{"Boom.ogg", std::vector<uint8_t>(4000, 9)},
+		};
+		REQUIRE(SoundBank::Write(bankPath, sounds, 44100, SDL_AUDIO_S16, 2));
+		{
+			AudioSystem as(4);
+			REQUIRE(as.OpenSoundBank(bankPath));
+			REQUIRE(as.mBankEntries.size() == 2);
+
+			SoundHandle h = as.PlaySound("Boom.ogg");
+			Mix_Chunk* chunk = Mock::Mixer.mChannels[as.mHandleMap[h].mChannel].mChunk;
+			REQUIRE(chunk->allocated == 0);
+			REQUIRE(chunk->alen == 4000);
+			REQUIRE(chunk->abuf >= as.mBankData);
+			REQUIRE(chunk->abuf + chunk->alen <= as.mBankData + as.mBankSize);
+			REQUIRE((chunk->abuf - as.mBankData) % SoundBank::ALIGNMENT == 0);
+			REQUIRE(chunk->abuf[3999] == 9);
+
+			LoadTicket ticket = as.CacheSoundAsync("Zap.wav");
+			ticket.Wait();
+			as.Update(DELTA_TIME);
+			REQUIRE(as.GetSound("Zap.wav")->alen == 1000);
+
+			// Sounds in the bank can be streamed too
+			SoundHandle stream = as.PlayStream("Zap.wav");
+			REQUIRE(as.mHandleMap[stream].mStream->mLengths[0] == 1000);
+			REQUIRE(as.mHandleMap[stream].mStream->mBuffers[0][999] == 7);
+
+			// Sounds that aren't in the bank still load from Assets/Sounds
+			REQUIRE(as.GetSound("1.wav")->mName == "Assets/Sounds/1.wav");
+			REQUIRE_FALSE(as.OpenSoundBank(bankPath));
+
+			// Sounds from the bank don't count against the budget, so going
+			// over it only unloads the sounds loaded from files
+			as.StopAllSounds();
+			as.Update(DELTA_TIME);
+			as.SetSoundCacheBudget(1);
+			REQUIRE(as.GetSoundCacheStats().mResidentBytes == 0);
+			REQUIRE(as.GetSoundCacheStats().mEvictions == 1);
+			REQUIRE(as.mSounds["Assets/Sounds/Boom.ogg"].mChunk != nullptr);
+			REQUIRE(as.mSounds["Assets/Sounds/Zap.wav"].mChunk != nullptr);
+		}
+
+		// A bank in a different format than the mixer's isn't used
+		REQUIRE(SoundBank::Write(bankPath, sounds, 48000, SDL_AUDIO_S16, 2));
+		{
+			AudioSystem as(4);
+			REQUIRE_FALSE(as.OpenSoundBank(bankPath));
+			REQUIRE(as.mBankData == nullptr);
+			REQUIRE(as.GetSound("Zap.wav")->mName == "Assets/Sounds/Zap.wav");
+			REQUIRE_FALSE(as.OpenSoundBank(bankPath + ".missing"));
+		}
+		std::filesystem::remove(bankPath);
+	}
+
+	SECTION("Sound bank builder - packs a folder into a bank, reusing what it can from the last")
+	{
+		ScopedTempDir tempDir("AudioSystemBankBuilder");
+		const std::filesystem::path& dir = tempDir.GetPath();
+		WriteStreamWav(dir / "Assets/Sounds/Music.wav", 4000);
+		std::ofstream(dir / "Assets/Sounds/Boom.ogg", std::ios::binary) << std::string(600, '\x05');
+		std::ofstream(dir / "Assets/Sounds/Broken.wav", std::ios::binary)
+			<< std::string("RIFF\x04\0\0\0WAVE", 12);
+		const std::string bankPath = "Sounds.bank";
+
+		// Decodes through SDL_mixer like the soundbank tool (here the mock,
+		// which gives a WAV's data chunk and any other file whole)
+		auto decode = [](const std::filesystem::path& path, std::vector<uint8_t>& pcm) {
+			Mix_Chunk* chunk = Mix_LoadWAV(path.string().c_str());
+			if (chunk == nullptr)
+			{
+				return false;
+			}
+			pcm.assign(chunk->abuf, chunk->abuf + chunk->alen);
+			Mix_FreeChunk(chunk);
+			return true;
+		};
+
+		// A sound that doesn't decode is left out, and reported in the result
+		SoundBankBuilder::BuildResult result;
+		REQUIRE(SoundBankBuilder::Build("Assets/Sounds", bankPath, {}, decode, result));
+		REQUIRE(result.mNumSounds == 2);
+		REQUIRE(result.mNumEncoded == 2);
+		REQUIRE(result.mFailed);
+		REQUIRE(result.mErrors == std::vector<std::string>{"couldn't decode Broken.wav"});
+		{
+			AudioSystem as(4);
+			REQUIRE(as.OpenSoundBank(bankPath));
+			REQUIRE(as.mBankEntries.size() == 2);
+
+			Mix_Chunk* chunk = as.GetSound("Music.wav");
+			REQUIRE(as.IsBankChunk(chunk));
+			REQUIRE(chunk->alen == 4000);
+			for (Uint32 i = 0; i < chunk->alen; i++)
+			{
+				REQUIRE(chunk->abuf[i] == i % 251);
+			}
+			REQUIRE(as.GetSound("Boom.ogg")->alen == 600);
+			REQUIRE(as.GetSound("Boom.ogg")->abuf[599] == 5);
+		}
+
+		// Unchanged files are copied from the old bank, which isn't rewritten
+		// unless a sound is added
+		REQUIRE(SoundBankBuilder::Build("Assets/Sounds", bankPath, {}, decode, result));
+		REQUIRE(result.mUpToDate);
+		REQUIRE(result.mNumEncoded == 0);
+		WriteStreamWav(dir / "Assets/Sounds/Zap.wav", 400);
+		REQUIRE(SoundBankBuilder::Build("Assets/Sounds", bankPath, {}, decode, result));
+		REQUIRE_FALSE(result.mUpToDate);
+		REQUIRE(result.mNumSounds == 3);
+		REQUIRE(result.mNumEncoded == 1);
+		{
+			AudioSystem as(4);
+			REQUIRE(as.OpenSoundBank(bankPath));
+			REQUIRE(as.GetSound("Zap.wav")->alen == 400);
+		}
+
+		// A folder that can't be read fails the build, with the reason
+		REQUIRE_FALSE(SoundBankBuilder::Build("Missing", bankPath, {}, decode, result));
+		REQUIRE(result.mErrors == std::vector<std::string>{"couldn't read Missing"});
+	}
+
+	SECTION("PlayStream - plays a WAV through the ring of buffers, from an effect on the channel")
+	{
+		ScopedTempDir tempDir("AudioSystemStream");
+		const std::filesystem::path& dir = tempDir.GetPath();
+		WriteStreamWav(dir / "Assets/Sounds/Music.wav", 250000);
+		{
+			AudioSystem as(4);
+			REQUIRE_FALSE(as.PlayStream("Missing.wav").IsValid());
+
+			SoundHandle h = as.PlayStream("Music.wav");
+			REQUIRE(as.GetSoundState(h) == SoundState::Playing);
+			AudioSystem::StreamInfo* stream = as.mHandleMap[h].mStream;
+			REQUIRE(Mock::Mixer.mChunks.empty());
+			REQUIRE(Mock::Mixer.mChannels[0].mChunk == &as.mStreamCarrier);
+			REQUIRE(Mock::Mixer.mChannels[0].mLoops == -1);
+			REQUIRE(Mock::Mixer.mChannels[0].mEffects.size() == 1);
+			REQUIRE(stream->mNumFilled == AudioSystem::NUM_STREAM_BUFFERS);
+			REQUIRE(stream->mLengths[0] == 44100);
+
+			// The audio thread goes straight from one buffer to the next
+			std::vector<Uint8> mixed = Mock::Mixer.Mix(0, 44100 + 400);
+			REQUIRE(mixed[300] == 300 % 251);
+			REQUIRE(mixed[44100 + 100] == (44100 + 100) % 251);
+			REQUIRE(stream->mNumPlayed == 1);
+
+			// Update refills the buffer that was played
+			as.Update(DELTA_TIME);
+			REQUIRE(stream->mNumFilled == 5);
+			REQUIRE(stream->mBuffers[0][0] == (4 * 44100) % 251);
+
+			as.PauseSound(h);
+			REQUIRE(as.GetSoundState(h) == SoundState::Paused);
+			REQUIRE(Mock::Mixer.mChannels[0].mPaused);
+			REQUIRE(Mock::Mixer.Mix(0, 44100).empty());
+			as.ResumeSound(h);
+			REQUIRE(as.GetSoundState(h) == SoundState::Playing);
+
+			Mock::Mixer.Mix(0, 5 * 44100 - (44100 + 400));
+			as.Update(DELTA_TIME);
+			REQUIRE(stream->mNumFilled == 6);
+			REQUIRE(stream->mLengths[1] == 250000 - 5 * 44100);
+			REQUIRE(stream->mEnded);
+			REQUIRE(as.GetSoundState(h) == SoundState::Playing);
+
+			// After the last buffer, the voice stops like any one-shot
+			mixed = Mock::Mixer.Mix(0, 250000 - 5 * 44100 + 100);
+			REQUIRE(mixed[250000 - 5 * 44100 - 1] == 249999 % 251);
+			REQUIRE(mixed.back() == 0);
+			as.Update(DELTA_TIME);
+			REQUIRE(as.GetSoundState(h) == SoundState::Stopped);
+			REQUIRE(Mix_Playing(0) == 0);
+			REQUIRE(Mock::Mixer.mChannels[0].mEffects.empty());
+			REQUIRE_FALSE(as.mChannels[0].IsValid());
+			REQUIRE(as.mStreams.empty());
+		}
+
+		// A sound that was only just added isn't kept when it can't be
+		// streamed, whatever the reason
+		WriteStreamWav(dir / "Assets/Sounds/Empty.wav", 0);
+		{
+			AudioSystem as(1);
+			REQUIRE_FALSE(as.PlayStream("Empty.wav").IsValid());
+			REQUIRE(as.FindSoundInfo("Empty.wav") == nullptr);
+			as.SetVirtualVoicesEnabled(true);
+			as.PlaySound("1.wav", true, 5);
+			REQUIRE_FALSE(as.PlayStream("Music.wav", false, 0).IsValid());
+			REQUIRE(as.FindSoundInfo("Music.wav") == nullptr);
+		}
+	}
+
+	SECTION("PlayStream - loops seamlessly, recovers from running out, and stops")
+	{
+		ScopedTempDir tempDir("AudioSystemStream");
+		const std::filesystem::path& dir = tempDir.GetPath();
+		WriteStreamWav(dir / "Assets/Sounds/Ambience.wav", 50000);
+		WriteStreamWav(dir / "Assets/Sounds/Music.wav", 50000);
+		{
+			AudioSystem as(4);
+			SoundHandle h = as.PlayStream("Ambience.wav", true);
+			AudioSystem::StreamInfo* stream = as.mHandleMap[h].mStream;
+			REQUIRE(as.mHandleMap[h].mIsLooping);
+
+			// The second buffer has the end of the sound, then its start
+			REQUIRE(stream->mLengths[1] == 44100);
+			REQUIRE(stream->mBuffers[1][5899] == 49999 % 251);
+			REQUIRE(stream->mBuffers[1][5900] == 0);
+
+			// Playing the whole ring before Update is silent past the end of
+			// it, and the stream picks up where it was once it's refilled
+			std::vector<Uint8> mixed = Mock::Mixer.Mix(0, 4 * 44100 + 1000);
+			REQUIRE(mixed[4 * 44100 - 1] == (4 * 44100 - 1) % 50000 % 251);
+			REQUIRE(mixed[4 * 44100 + 999] == 0);
+			as.Update(DELTA_TIME);
+			REQUIRE(Mock::Mixer.Mix(0, 1)[0] == (4 * 44100) % 50000 % 251);
+
+			for (int i = 0; i < 20; i++)
+			{
+				Mock::Mixer.Mix(0, 44100);
+				as.Update(DELTA_TIME);
+			}
+			REQUIRE(as.GetSoundState(h) == SoundState::Playing);
+
+			// Each stream keeps its place in mStreams as others stop
+			SoundHandle music = as.PlayStream("Music.wav");
+			REQUIRE(as.mStreams.size() == 2);
+			as.StopSound(h);
+			REQUIRE(as.mStreams.size() == 1);
+			REQUIRE(as.mStreams[0].get() == as.mHandleMap[music].mStream);
+			REQUIRE(as.mStreams[0]->mIndex == 0);
+
+			// Stopping takes the effect off with the channel
+			REQUIRE(Mix_Playing(0) == 0);
+			REQUIRE(Mock::Mixer.mChannels[0].mEffects.empty());
+			as.StopSound(music);
+			REQUIRE(as.mStreams.empty());
+		}
+	}
+
+	SECTION("Lazy caching - CacheAllSounds only indexes, and sounds decode when first used")
+	{
+		ScopedTempDir tempDir("AudioSystemLazy");
+		const std::filesystem::path& dir = tempDir.GetPath();
+		WriteStreamWav(dir / "Assets/Sounds/Short.wav", 44100);
+		WriteStreamWav(dir / "Assets/Sounds/Long.wav", 44100 * 4 * 3);
+		{
+			// Just enough of an Ogg file for the header and the last page
+			std::string ogg = "OggS" + std::string(24, '\0') + "\x01vorbis" +
+							  std::string("\0\0\0\0\x02\x44\xAC\0\0", 9) + std::string(100, '\0') +
+							  "OggS" + std::string("\0\x04\x88\x58\x01\0\0\0\0\0", 10) +
+							  std::string(20, '\0');
+			std::ofstream(dir / "Assets/Sounds/Music.ogg", std::ios::binary) << ogg;
+		}
+		{
+			AudioSystem as(4, {});
+			as.SetLazyCaching(true);
+			as.CacheAllSounds();
+			REQUIRE(Mock::Mixer.mChunks.empty());
+
+			SoundMetadata longInfo = as.GetSoundMetadata("Long.wav");
+			REQUIRE(longInfo.mFileSize == 44 + 44100 * 4 * 3);
+			REQUIRE(longInfo.mDuration == Approx(3.0));
+			REQUIRE_FALSE(longInfo.mIsLoaded);
+			REQUIRE(as.GetSoundMetadata("Short.wav").mDuration == Approx(0.25));
+			REQUIRE(as.GetSoundMetadata("Music.ogg").mDuration == Approx(2.0));
+			REQUIRE(as.GetSoundMetadata("NotASound.wav").mFileSize == 0);
+
+			// Only the sounds that get used are decoded
+			as.PlaySound("Short.wav");
+			REQUIRE(Mock::Mixer.mChunks.size() == 1);
+			REQUIRE(as.GetSoundMetadata("Short.wav").mIsLoaded);
+			REQUIRE(as.GetSoundCacheStats().mResidentBytes == 44100);
+
+			as.CacheSoundAsync("Long.wav").Wait();
+			as.Update(DELTA_TIME);
+			REQUIRE(as.GetSoundMetadata("Long.wav").mIsLoaded);
+			REQUIRE(Mock::Mixer.mChunks.size() == 2);
+		}
+	}
+
+	SECTION("Sound sharing - sounds with identical samples share one chunk")
+	{
+		ScopedTempDir tempDir("AudioSystemSharing");
+		const std::filesystem::path& dir = tempDir.GetPath();
+		WriteStreamWav(dir / "Assets/Sounds/Step.wav", 4000);
+		WriteStreamWav(dir / "Assets/Sounds/StepCopy.wav", 4000);
+		WriteStreamWav(dir / "Assets/Sounds/Jump.wav", 8000);
+		{
+			AudioSystem as(4);
+			as.SetSoundSharing(true);
+			as.CacheSound("Step.wav");
+			as.CacheSound("StepCopy.wav");
+			as.CacheSound("Jump.wav");
+			REQUIRE(Mock::Mixer.mChunks.size() == 2);
+			REQUIRE(as.GetSound("Step.wav") == as.GetSound("StepCopy.wav"));
+			REQUIRE(as.GetSound("Step.wav") != as.GetSound("Jump.wav"));
+			REQUIRE(as.GetSoundCacheStats().mResidentBytes == 4000 + 8000);
+			REQUIRE(as.GetSoundCacheStats().mSharedBytes == 4000);
+
+			// The chunk stays loaded until both sounds let go of it
+			SoundHandle handle = as.PlaySound("StepCopy.wav");
+			as.UnloadSound("Step.wav");
+			REQUIRE(Mock::Mixer.mChunks.size() == 2);
+			REQUIRE(as.GetSoundCacheStats().mSharedBytes == 0);
+			as.StopSound(handle);
+			as.UnloadSound("StepCopy.wav");
+			REQUIRE(Mock::Mixer.mChunks.size() == 1);
+			REQUIRE(as.GetSoundCacheStats().mResidentBytes == 8000);
+
+			// Loading a copy again shares with the copy that's left
+			as.CacheSound("Step.wav");
+			as.CacheSound("StepCopy.wav");
+			REQUIRE(Mock::Mixer.mChunks.size() == 2);
+			REQUIRE(as.GetSoundCacheStats().mSharedBytes == 4000);
+		}
+
+		// Only the samples are compared, so a copy whose file has a tag in
+		// its header shares too, and one sample's difference is enough not to
+		{
+			std::ifstream step(dir / "Assets/Sounds/Step.wav", std::ios::binary);
+			std::string samples(std::istreambuf_iterator<char>(step), {});
+			samples.erase(0, 44);
+			WriteWav(dir / "Assets/Sounds/StepTagged.wav", samples,
+					 std::string("LIST\x04\0\0\0INFO", 12));
+			samples[1000]++;
+			WriteWav(dir / "Assets/Sounds/StepEdited.wav", samples);
+		}
+		{
+			AudioSystem as(4);
+			as.SetSoundSharing(true);
+			as.CacheSound("Step.wav");
+			as.CacheSound("StepTagged.wav");
+			as.CacheSound("StepEdited.wav");
+			REQUIRE(as.GetSound("StepTagged.wav") == as.GetSound("Step.wav"));
+			REQUIRE(as.GetSound("StepEdited.wav") != as.GetSound("Step.wav"));
+			REQUIRE(as.GetSoundCacheStats().mSharedBytes == 4000);
+		}
+	}
+
+	SECTION("Compressed storage - sounds stay IMA-ADPCM and each voice decodes into its own buffers")
+	{
+		AudioSystem as(4);
+		as.SetCompressedStorage(true);
+
+		// A second is no longer than a voice's buffers, so it stays PCM
+		as.CacheSound("1.wav");
+		REQUIRE(as.GetSound("1.wav")->alen == 44100 * 4);
+		REQUIRE(as.FindSoundInfo("1.wav")->mAdpcm.empty());
+		as.UnloadSound("1.wav");
+
+		// Two seconds of the mock's silence, in blocks of 1025 frames. The
+		// chunk is IMA-ADPCM, so GetSound doesn't hand it out.
+		Mock::Mixer.mLoadSeconds = 2;
+		as.CacheSound("Ambience.wav");
+		Mix_Chunk* chunk = as.FindSoundInfo("Ambience.wav")->mChunk;
+		REQUIRE(as.GetSound("Ambience.wav") == nullptr);
+		REQUIRE(Mock::Mixer.mChunks.size() == 1);
+		REQUIRE(chunk->alen == 87 * ImaAdpcm::BlockSize(2));
+		REQUIRE(chunk->alen < 2 * 44100 * 4 / 3);
+		REQUIRE(as.GetSoundCacheStats().mResidentBytes == chunk->alen);
+		REQUIRE(as.GetSoundMetadata("Ambience.wav").mDuration == Approx(2.0));
+
+		SoundHandle a = as.PlaySound("Ambience.wav");
+		SoundHandle b = as.PlaySound("Ambience.wav", true);
+		AudioSystem::StreamInfo* streamA = as.mHandleMap[a].mStream;
+		AudioSystem::StreamInfo* streamB = as.mHandleMap[b].mStream;
+		REQUIRE(streamA != nullptr);
+		REQUIRE(streamB != nullptr);
+		REQUIRE(streamA != streamB);
+		REQUIRE(Mock::Mixer.mChannels[0].mChunk == &as.mStreamCarrier);
+		REQUIRE(streamA->mLengths[0] == 44100);
+		REQUIRE(streamA->mBuffers[0][1000] == 0);
+		REQUIRE(Mock::Mixer.mChunks.size() == 1);
+
+		// The sound can't be unloaded out from under its voices
+		as.UnloadUnused();
+		REQUIRE(as.FindSoundInfo("Ambience.wav")->mChunk == chunk);
+
+		// The one-shot stops after its eight buffers, and the loop keeps going
+		for (int i = 0; i < 8; i++)
+		{
+			Mock::Mixer.Mix(0, 44100);
+			Mock::Mixer.Mix(1, 44100);
+			as.Update(DELTA_TIME);
+		}
+		REQUIRE(as.GetSoundState(a) == SoundState::Stopped);
+		REQUIRE(as.GetSoundState(b) == SoundState::Playing);
+		as.StopSound(b);
+		REQUIRE(as.mStreams.empty());
+
+		as.UnloadSound("Ambience.wav");
+		REQUIRE(Mock::Mixer.mChunks.empty());
+		REQUIRE(as.GetSoundCacheStats().mResidentBytes == 0);
+	}
+
+	SECTION("Compressed storage - a WAV's samples play back close to the original")
+	{
+		// Two seconds of a stereo sine, so the sound is compressed
+		ScopedTempDir tempDir("AudioSystemCompressed");
+		const size_t numFrames = 44100 * 2;
+		std::vector<int16_t> samples(numFrames * 2);
+		for (size_t i = 0; i < numFrames; i++)
+		{
+			double t = static_cast<double>(i) / 44100.0;
+			samples[i * 2] = static_cast<int16_t>(12000.0 * std::sin(t * 440.0 * 6.2831853));
+			samples[i * 2 + 1] = static_cast<int16_t>(8000.0 * std::sin(t * 97.0 * 6.2831853));
+		}
+		WriteWav(tempDir.GetPath() / "Assets/Sounds/Sine.wav",
+				 std::string(reinterpret_cast<const char*>(samples.data()), numFrames * 4));
+
+		AudioSystem as(4);
+		as.SetCompressedStorage(true);
+		as.CacheSound("Sine.wav");
+		const AudioSystem::SoundInfo* soundInfo = as.FindSoundInfo("Sine.wav");
+		REQUIRE(soundInfo->mPcmLength == numFrames * 4);
+		REQUIRE(soundInfo->mAdpcm.size() ==
+				(numFrames + ImaAdpcm::FRAMES_PER_BLOCK - 1) / ImaAdpcm::FRAMES_PER_BLOCK *
+					ImaAdpcm::BlockSize(2));
+
+		// The first buffer a voice decodes matches the file's samples (and
+		// the first frame of each block exactly)
+		SoundHandle handle = as.PlaySound("Sine.wav");
+		AudioSystem::StreamInfo* stream = as.mHandleMap[handle].mStream;
+		REQUIRE(stream->mLengths[0] == 44100);
+		std::vector<int16_t> decoded(44100 / 2);
+		std::memcpy(decoded.data(), stream->mBuffers[0].data(), 44100);
+		int maxError = 0;
+		for (size_t i = 0; i < decoded.size(); i++)
+		{
+			maxError = std::max(maxError, std::abs(decoded[i] - samples[i]));
+		}
+		REQUIRE(decoded[0] == samples[0]);
+		REQUIRE(decoded[1] == samples[1]);
+		REQUIRE(maxError < 1024);
+	}
+
+	SECTION("Compressed storage - IMA-ADPCM round trip stays close to the original")
+	{
+		const size_t numFrames = ImaAdpcm::FRAMES_PER_BLOCK * 3 + 100;
+		std::vector<int16_t> samples(numFrames * 2);
+		for (size_t i = 0; i < numFrames; i++)
+		{
+			double t = static_cast<double>(i) / 44100.0;
+			samples[i * 2] = static_cast<int16_t>(12000.0 * std::sin(t * 440.0 * 6.2831853));
+			samples[i * 2 + 1] = static_cast<int16_t>(8000.0 * std::sin(t * 97.0 * 6.2831853));
+		}
+
+		std::vector<uint8_t> blocks = ImaAdpcm::Encode(samples.data(), numFrames, 2);
+		REQUIRE(blocks.size() == 4 * ImaAdpcm::BlockSize(2));
+
+		std::vector<int16_t> decoded(ImaAdpcm::FRAMES_PER_BLOCK * 2);
+		int maxError = 0;
+		for (size_t block = 0; block < 4; block++)
+		{
+			ImaAdpcm::DecodeBlock(blocks.data() + block * ImaAdpcm::BlockSize(2), 2, decoded.data());
+			for (size_t i = 0; i < ImaAdpcm::FRAMES_PER_BLOCK * 2; i++)
+			{
+				size_t sample = block * ImaAdpcm::FRAMES_PER_BLOCK * 2 + i;
+				if (sample < samples.size())
+				{
+					maxError = std::max(maxError, std::abs(decoded[i] - samples[sample]));
+				}
+			}
+		}
+		REQUIRE(maxError < 1024);
+	}
+
+	SECTION("Hot reload - Update swaps in sounds whose files changed")
+	{
+		ScopedTempDir tempDir("AudioSystemHotReload");
+		const std::filesystem::path& dir = tempDir.GetPath();
+		WriteStreamWav(dir / "Assets/Sounds/Loop.wav", 40000);
+		WriteStreamWav(dir / "Assets/Sounds/Unused.wav", 1000);
+		WriteStreamWav(dir / "Assets/Sounds/Folder/Hit.wav", 1000);
+		{
+			AudioSystem as(4);
+			REQUIRE(as.SetHotReload(true));
+			SoundHandle loop = as.PlaySound("Loop.wav", true);
+			as.CacheSound("Folder/Hit.wav");
+			REQUIRE(Mock::Mixer.mChunks.size() == 2);
+
+			// Nothing changed, so nothing is reloaded
+			Mix_Chunk* oldChunk = as.GetSound("Loop.wav");
+			as.Update(DELTA_TIME);
+			REQUIRE(as.GetSound("Loop.wav") == oldChunk);
+
+			// The playing loop moves over to the new data, and a file that was
+			// never loaded stays that way
+			WriteStreamWav(dir / "Assets/Sounds/Loop.wav", 80000);
+			WriteStreamWav(dir / "Assets/Sounds/Unused.wav", 2000);
+			as.Update(DELTA_TIME);
+			Mix_Chunk* newChunk = as.GetSound("Loop.wav");
+			REQUIRE(newChunk->alen == 80000);
+			REQUIRE(Mock::Mixer.mChunks.size() == 2);
+			REQUIRE(Mock::Mixer.mChannels[0].mChunk == newChunk);
+			REQUIRE(Mix_Playing(0) == 1);
+			REQUIRE(as.GetSoundState(loop) == SoundState::Playing);
+			REQUIRE(as.GetSoundCacheStats().mResidentBytes == 80000 + 1000);
+			as.Update(DELTA_TIME);
+			REQUIRE(as.GetSoundState(loop) == SoundState::Playing);
+
+			// Folders in Assets/Sounds are watched too, even new ones
+			WriteStreamWav(dir / "Assets/Sounds/Folder/Hit.wav", 3000);
+			std::filesystem::create_directories(dir / "Assets/Sounds/New");
+			as.Update(DELTA_TIME);
+			REQUIRE(as.GetSound("Folder/Hit.wav")->alen == 3000);
+
+			// A file being copied in isn't reloaded until it's closed
+			std::filesystem::remove(dir / "Assets/Sounds/Folder/Hit.wav");
+			{
+				std::ofstream partial(dir / "Assets/Sounds/Folder/Hit.wav", std::ios::binary);
+				partial << "RIFF";
+				partial.flush();
+				as.Update(DELTA_TIME);
+				REQUIRE(as.GetSound("Folder/Hit.wav")->alen == 3000);
+			}
+			WriteStreamWav(dir / "Assets/Sounds/Folder/Hit.wav", 2000);
+			as.Update(DELTA_TIME);
+			REQUIRE(as.GetSound("Folder/Hit.wav")->alen == 2000);
+			WriteStreamWav(dir / "Assets/Sounds/New/Step.wav", 1000);
+			as.CacheSound("New/Step.wav");
+			WriteStreamWav(dir / "Assets/Sounds/New/Step.wav", 500);
+			as.Update(DELTA_TIME);
+			REQUIRE(as.GetSound("New/Step.wav")->alen == 500);
+
+			// Once it's off, changes aren't picked up
+			as.SetHotReload(false);
+			WriteStreamWav(dir / "Assets/Sounds/Loop.wav", 1000);
+			as.Update(DELTA_TIME);
+			REQUIRE(as.GetSound("Loop.wav") == newChunk);
+		}
+	}
+
+	SECTION("Software mixer - SIMD kernels match the scalar ones")
+	{
+		// Odd lengths so the scalar tails run too
+		const size_t numSamples = 1003;
+		std::vector<int16_t> s16(numSamples);
+		std::vector<float> f32(numSamples);
+		std::vector<float> start(numSamples);
+		for (size_t i = 0; i < numSamples; i++)
+		{
+			s16[i] = static_cast<int16_t>((i * 7919) % 65536 - 32768);
+			f32[i] = static_cast<float>(i % 37) / 12.0f - 1.5f;
+			start[i] = static_cast<float>(i % 11) / 10.0f - 0.5f;
+		}
+
+		std::vector<float> expected = start;
+		SoftwareMixer::MixS16Scalar(expected.data(), s16.data(), numSamples, 0.75f);
+		SoftwareMixer::MixF32Scalar(expected.data(), f32.data(), numSamples, 0.5f);
+
+		using MixS16 = void (*)(float*, const int16_t*, size_t, float);
+		using MixF32 = void (*)(float*, const float*, size_t, float);
+		using Clip = void (*)(float*, size_t);
+		std::vector<std::tuple<MixS16, MixF32, Clip>> kernels = {
+			{SoftwareMixer::MixS16SSE2, SoftwareMixer::MixF32SSE2, SoftwareMixer::ClipSSE2},
+			{SoftwareMixer::MixS16AVX2, SoftwareMixer::MixF32AVX2, SoftwareMixer::ClipAVX2},
+		};
+		for (size_t k = 0; k < kernels.size(); k++)
+		{
+			if (k >= static_cast<size_t>(SoftwareMixer::DetectKernels()))
+			{
+				break;
+			}
+			auto [mixS16, mixF32, clip] = kernels[k];
+			std::vector<float> actual = start;
+			mixS16(actual.data(), s16.data(), numSamples, 0.75f);
+			mixF32(actual.data(), f32.data(), numSamples, 0.5f);
+			float maxError = 0.0f;
+			for (size_t i = 0; i < numSamples; i++)
+			{
+				maxError = std::max(maxError, std::abs(actual[i] - expected[i]));
+			}
+			REQUIRE(maxError < 1e-6f);
+
+			std::vector<float> clipped = actual;
+			SoftwareMixer::ClipScalar(clipped.data(), numSamples);
+			clip(actual.data(), numSamples);
+			REQUIRE(actual == clipped);
+		}
+	}
+
+	SECTION("Software mixer - mixes, loops and clips channels, and reports finished ones")
+	{
+		static std::vector<int> finished;
+		finished.clear();
+		SoftwareMixer mixer(2, 44100, SDL_AUDIO_S16, 1);
+		mixer.SetChannelFinished([](int channel) { finished.push_back(channel); });
+		REQUIRE(SoftwareMixer::IsFormatSupported(SDL_AUDIO_F32, 2));
+		REQUIRE_FALSE(SoftwareMixer::IsFormatSupported(SDL_AUDIO_U8, 2));
+		REQUIRE_FALSE(SoftwareMixer::IsFormatSupported(SDL_AUDIO_S16, 9));
+
+		std::vector<int16_t> samples = {16384, -16384, 8192};
+		Mix_Chunk chunk;
+		chunk.abuf = reinterpret_cast<Uint8*>(samples.data());
+		chunk.alen = static_cast<Uint32>(samples.size() * sizeof(int16_t));
+		std::vector<int16_t> loud = {32767, 32767, 32767, 32767, 32767, 32767, 32767, 32767};
+		Mix_Chunk loudChunk;
+		loudChunk.abuf = reinterpret_cast<Uint8*>(loud.data());
+		loudChunk.alen = static_cast<Uint32>(loud.size() * sizeof(int16_t));
+
+		// Played twice at half volume, then the channel finishes mid block
+		mixer.PlayChannel(0, &chunk, 1);
+		mixer.SetVolume(0, MIX_MAX_VOLUME / 2);
+		std::vector<float> output(8, 5.0f);
+		mixer.Mix(output.data(), output.size());
+		std::vector<float> expected = {0.25f, -0.25f, 0.125f, 0.25f, -0.25f, 0.125f, 0.0f, 0.0f};
+		for (size_t i = 0; i < output.size(); i++)
+		{
+			REQUIRE(output[i] == Approx(expected[i]));
+		}
+		REQUIRE_FALSE(mixer.IsPlaying(0));
+		REQUIRE(finished == std::vector<int>{0});
+
+		// Paused channels hold their place, and the sum is clipped
+		mixer.PlayChannel(0, &loudChunk, -1);
+		mixer.PlayChannel(1, &loudChunk, 0);
+		mixer.Pause(0);
+		mixer.Mix(output.data(), 4);
+		REQUIRE(output[0] == Approx(32767.0f / 32768.0f));
+		mixer.Resume(0);
+		mixer.Mix(output.data(), 4);
+		REQUIRE(output[3] == 1.0f);
+		REQUIRE(mixer.IsPlaying(0));
+		REQUIRE(mixer.mChannels[0].mPosition == 8);
+		REQUIRE(mixer.mChannels[1].mPosition == 16);
+
+		// Halting and replacing a sound both report it finished
+		mixer.HaltChannel(1);
+		mixer.PlayChannel(0, &chunk, 0);
+		REQUIRE(finished == std::vector<int>{0, 1, 0});
+	}
+
+	SECTION("Software mixer - AudioSystem plays sounds and streams through it on Update")
+	{
+		ScopedTempDir tempDir("AudioSystemSoftware");
+		const std::filesystem::path& dir = tempDir.GetPath();
+		WriteStreamWav(dir / "Assets/Sounds/Music.wav", 100000);
+		{
+			AudioSystem as(4);
+			Mock::Mixer.mFormat = SDL_AUDIO_U8;
+			REQUIRE_FALSE(as.SetSoftwareMixer(true));
+			Mock::Mixer.mFormat = SDL_AUDIO_S16;
+			REQUIRE(as.SetSoftwareMixer(true));
+
+			// One second of the mock's silence, at half volume
+			SoundPolicy policy;
+			policy.mVolume = MIX_MAX_VOLUME / 2;
+			as.SetSoundPolicy("Ambience.wav", policy);
+			SoundHandle oneShot = as.PlaySound("Ambience.wav");
+			SoundHandle loop = as.PlaySound("Ambience.wav", true);
+			REQUIRE_FALSE(Mock::Mixer.mChannels[0].mPlaying);
+			REQUIRE(as.mSoftwareMixer->IsPlaying(0));
+			REQUIRE(as.mSoftwareMixer->mChannels[1].mVolume == MIX_MAX_VOLUME / 2);
+			for (int i = 0; i < 3; i++)
+			{
+				as.Update(0.4f);
+			}
+			REQUIRE(as.GetSoundState(oneShot) == SoundState::Stopped);
+			REQUIRE(as.GetSoundState(loop) == SoundState::Playing);
+			as.StopSound(loop);
+
+			// The stream's effect plays its buffers inside Mix
+			SoundHandle music = as.PlayStream("Music.wav");
+			as.Update(DELTA_TIME);
+			REQUIRE(as.GetSoundState(music) == SoundState::Playing);
+			REQUIRE(std::any_of(as.mMixBlock.begin(), as.mMixBlock.end(),
+								[](float sample) { return sample != 0.0f; }));
+			for (int i = 0; i < 60; i++)
+			{
+				as.Update(DELTA_TIME);
+			}
+			REQUIRE(as.GetSoundState(music) == SoundState::Stopped);
+			REQUIRE(as.mStreams.empty());
+
+			// Back on SDL_mixer, sounds play there again
+			REQUIRE(as.SetSoftwareMixer(false));
+			as.PlaySound("Ambience.wav");
+			REQUIRE(Mock::Mixer.mChannels[0].mPlaying);
+		}
+	}
+
+	SECTION("Software mixer - SIMD ramp kernels match the scalar ones")
+	{
+		const size_t numFrames = 251;
+		std::vector<int16_t> s16(numFrames * 4);
+		std::vector<float> f32(numFrames * 4);
+		for (size_t i = 0; i < s16.size(); i++)
+		{
+			s16[i] = static_cast<int16_t>((i * 7919) % 65536 - 32768);
+			f32[i] = static_cast<float>(i % 37) / 12.0f - 1.5f;
+		}
+		const float gains[] = {1.0f, 0.25f, 0.5f, 0.0f};
+		const float steps[] = {-0.004f, 0.003f, 0.0f, 0.002f};
+
+		using MixS16Ramp = void (*)(float*, const int16_t*, size_t, int, const float*, const float*);
+		using MixF32Ramp = void (*)(float*, const float*, size_t, int, const float*, const float*);
+		std::vector<std::pair<MixS16Ramp, MixF32Ramp>> kernels = {
+			{SoftwareMixer::MixS16RampSSE2, SoftwareMixer::MixF32RampSSE2},
+			{SoftwareMixer::MixS16RampAVX2, SoftwareMixer::MixF32RampAVX2},
+		};
+		for (size_t k = 0; k < kernels.size(); k++)
+		{
+			if (k >= static_cast<size_t>(SoftwareMixer::DetectKernels()))
+			{
+				break;
+			}
+			// 3 channels don't divide the width, so they take the scalar path
+			for (int channels : {1, 2, 3, 4})
+			{
+				std::vector<float> expected(numFrames * channels);
+				SoftwareMixer::MixS16RampScalar(expected.data(), s16.data(), numFrames, channels,
+												gains, steps);
+				SoftwareMixer::MixF32RampScalar(expected.data(), f32.data(), numFrames, channels,
+												gains, steps);
+				std::vector<float> actual(numFrames * channels);
+				kernels[k].first(actual.data(), s16.data(), numFrames, channels, gains, steps);
+				kernels[k].second(actual.data(), f32.data(), numFrames, channels, gains, steps);
+				float maxError = 0.0f;
+				for (size_t i = 0; i < actual.size(); i++)
+				{
+					maxError = std::max(maxError, std::abs(actual[i] - expected[i]));
+				}
+				REQUIRE(maxError < 1e-5f);
+			}
+		}
+	}
+
+	SECTION("Software mixer - volume and pan ramp linearly and land on their targets")
+	{
+		SoftwareMixer mixer(1, 44100, SDL_AUDIO_S16, 2);
+		std::vector<int16_t> samples(64, 16384);
+		Mix_Chunk chunk;
+		chunk.abuf = reinterpret_cast<Uint8*>(samples.data());
+		chunk.alen = static_cast<Uint32>(samples.size() * sizeof(int16_t));
+		mixer.PlayChannel(0, &chunk, -1);
+
+		// Full volume down to silence over four frames, then it stays there
+		mixer.SetVolume(0, 0, 4);
+		std::vector<float> output(12);
+		mixer.Mix(output.data(), 6);
+		std::vector<float> expected = {0.5f, 0.5f, 0.375f, 0.375f, 0.25f, 0.25f,
+									   0.125f, 0.125f, 0.0f, 0.0f, 0.0f, 0.0f};
+		for (size_t i = 0; i < output.size(); i++)
+		{
+			REQUIRE(output[i] == Approx(expected[i]).margin(1e-6));
+		}
+		REQUIRE(mixer.mChannels[0].mRampFrames == 0);
+		REQUIRE(mixer.mChannels[0].mGains[0] == 0.0f);
+
+		// Panned hard right, the left speaker is silent and the right isn't
+		// turned down
+		mixer.SetVolume(0, MIX_MAX_VOLUME);
+		mixer.SetPan(0, 1.0f);
+		mixer.Mix(output.data(), 2);
+		REQUIRE(output[0] == 0.0f);
+		REQUIRE(output[1] == Approx(0.5f));
+
+		// A ramp with no frames (or a new setting with none) jumps straight there
+		mixer.SetPan(0, 0.0f, 100);
+		mixer.SetVolume(0, MIX_MAX_VOLUME / 2);
+		REQUIRE(mixer.mChannels[0].mRampFrames == 0);
+		mixer.Mix(output.data(), 1);
+		REQUIRE(output[0] == Approx(0.25f));
+		REQUIRE(output[1] == Approx(0.25f));
+	}
+
+	SECTION("SetVolume and SetPan - ramp with the software mixer, and step with SDL_mixer")
+	{
+		AudioSystem as(2);
+		SoundHandle h = as.PlaySound("Ambience.wav", true);
+		as.SetVolume(h, 64, 0.5f);
+		as.SetPan(h, -0.5f);
+		REQUIRE(Mock::Mixer.mChannels[0].mVolume == 64);
+		REQUIRE(Mock::Mixer.mChannels[0].mLeft == 255);
+		REQUIRE(Mock::Mixer.mChannels[0].mRight == 128);
+		as.SetVolume(SoundHandle(), 10);
+
+		REQUIRE(as.SetSoftwareMixer(true));
+		h = as.PlaySound("Ambience.wav", true);
+		as.SetVolume(h, 0, 0.1f);
+		SoftwareMixer::Channel& channel = as.mSoftwareMixer->mChannels[0];
+		REQUIRE(channel.mRampFrames == 4410);
+		as.Update(0.05f);
+		REQUIRE(channel.mRampFrames == 2205);
+		REQUIRE(channel.mGains[0] == Approx(0.5f));
+		as.Update(0.05f);
+		REQUIRE(channel.mRampFrames == 0);
+		REQUIRE(channel.mGains[0] == 0.0f);
+
+		as.SetPan(h, 1.0f);
+		REQUIRE(channel.mRampFrames ==
+				static_cast<size_t>(std::lround(AudioSystem::PAN_RAMP_TIME * 44100)));
+
+		// The next voice on the channel starts at its own volume and pan,
+		// not partway through the last one's ramp
+		as.StopSound(h);
+		h = as.PlaySound("Ambience.wav");
+		REQUIRE(channel.mRampFrames == 0);
+		REQUIRE(channel.mGains[0] == 1.0f);
+		REQUIRE(channel.mGains[1] == 1.0f);
+	}
+
+	SECTION("Offline render - renders exact lengths on a simulated clock, to samples or a WAV")
+	{
+		ScopedTempDir tempDir("AudioSystemRender");
+		const std::filesystem::path& dir = tempDir.GetPath();
+		WriteStreamWav(dir / "Assets/Sounds/Music.wav", 100000);
+		{
+			AudioSystem as(4);
+			std::vector<float> samples;
+			REQUIRE_FALSE(as.RenderOffline(1.0f, samples));
+			REQUIRE(as.SetSoftwareMixer(true));
+			REQUIRE_FALSE(as.RenderOffline(1.0f, samples, 0.0f));
+			REQUIRE(samples.empty());
+
+			// The mock loads the file's 25000 frames, so the sound finishes
+			// partway through the first render
+			SoundHandle music = as.PlaySound("Music.wav");
+			REQUIRE(as.RenderOffline(1.0f, samples));
+			REQUIRE(samples.size() == 44100 * 2);
+			REQUIRE(as.mTime == Approx(1.0));
+			REQUIRE(as.GetSoundState(music) == SoundState::Stopped);
+			REQUIRE(samples[0] != 0.0f);
+			REQUIRE(samples[24999 * 2 + 1] != 0.0f);
+			REQUIRE(samples[25000 * 2] == 0.0f);
+
+			// A sound played between renders starts on the frame it was
+			// played at, whatever the update steps
+			as.PlaySound("Music.wav");
+			REQUIRE(as.RenderOffline(0.75f, samples, 1.0f / 7.0f));
+			REQUIRE(samples.size() == 44100 * 2 + 33075 * 2);
+			REQUIRE(std::equal(samples.begin(), samples.begin() + 33075 * 2,
+							   samples.begin() + 44100 * 2));
+
+			as.PlaySound("Music.wav");
+			REQUIRE(as.RenderOfflineToWav(0.25f, "Render.wav"));
+			std::ifstream file("Render.wav", std::ios::binary);
+			std::vector<char> wav((std::istreambuf_iterator<char>(file)),
+								  std::istreambuf_iterator<char>());
+			REQUIRE(wav.size() == 44 + 11025 * 4);
+			REQUIRE(std::string(wav.data(), 4) == "RIFF");
+			REQUIRE(std::string(wav.data() + 36, 4) == "data");
+			int16_t first = 0;
+			std::memcpy(&first, wav.data() + 44, sizeof(first));
+			REQUIRE(first == std::lround(samples[0] * 32767.0f));
+		}
+	}
+
+	SECTION("Virtual voices - PlaySound always succeeds and promotes when a channel frees")
+	{
+		AudioSystem as(2);
+		as.SetVirtualVoicesEnabled(true);
+		as.CacheSound("1.wav");
+		as.CacheSound("2.wav");
+		as.CacheSound("3.wav");
+
+		SoundHandle snd = as.PlaySound("1.wav");
+		SoundHandle snd2 = as.PlaySound("2.wav");
+		SoundHandle snd3 = as.PlaySound("3.wav");
+
+		// Third sound is virtual, but still a playing sound
+		REQUIRE(snd3.IsValid());
+		REQUIRE(as.mHandleMap[snd3].mChannel == -1);
+		REQUIRE(as.mVirtualVoices.size() == 1);
+		REQUIRE(as.GetSoundState(snd3) == SoundState::Playing);
+		REQUIRE(as.mChannels[0] == snd);
+		REQUIRE(as.mChannels[1] == snd2);
+
+		// Freeing a channel gives it to the virtual voice
+		as.StopSound(snd);
+		REQUIRE(as.mVirtualVoices.empty());
+		REQUIRE(as.mHandleMap[snd3].mChannel == 0);
+		REQUIRE(as.mChannels[0] == snd3);
+		REQUIRE(Mock::Mixer.mChannels[0].mChunk->mName == "Assets/Sounds/3.wav");
+	}
+
+	SECTION("Virtual voices - higher priority voice takes the lowest priority channel")
+	{
+		AudioSystem as(2);
+		as.SetVirtualVoicesEnabled(true);
+		as.CacheSound("1.wav");
+		as.CacheSound("2.wav");
+		as.CacheSound("3.wav");
+
+		SoundHandle snd = as.PlaySound("1.wav", true, 0);
+		SoundHandle snd2 = as.PlaySound("2.wav", true, 1);
+		SoundHandle snd3 = as.PlaySound("3.wav", false, 2);
+
+		// snd is the lowest priority, so it becomes virtual
+		REQUIRE(as.mChannels[0] == snd3);
+		REQUIRE(as.mChannels[1] == snd2);
+		REQUIRE(as.mHandleMap[snd].mChannel == -1);
+		REQUIRE(as.GetSoundState(snd) == SoundState::Playing);
+		REQUIRE(Mock::Mixer.mChannels[0].mChunk->mName == "Assets/Sounds/3.wav");
+
+		// Lower priority than everything playing, so it starts virtual
+		SoundHandle snd4 = as.PlaySound("1.wav", false, -1);
+		REQUIRE(as.mHandleMap[snd4].mChannel == -1);
+		REQUIRE(as.mVirtualVoices.size() == 2);
+
+		// When a channel frees, the higher priority virtual voice gets it
+		as.StopSound(snd3);
+		REQUIRE(as.mChannels[0] == snd);
+		REQUIRE(Mock::Mixer.mChannels[0].mLoops == -1);
+		REQUIRE(as.mHandleMap[snd4].mChannel == -1);
+	}
+
+	SECTION("Virtual voices - past the cap, the lowest priority virtual voice is stopped")
+	{
+		AudioSystem as(4);
+		as.SetVirtualVoicesEnabled(true);
+		as.CacheSound("1.wav");
+
+		// Far more voices than a handle can index
+		std::vector<SoundHandle> sounds;
+		for (size_t i = 0; i < HandleMap<int>::MAX_SIZE + 4000; i++)
+		{
+			sounds.emplace_back(as.PlaySound("1.wav", true));
+		}
+		REQUIRE(std::all_of(sounds.begin(), sounds.end(),
+							[](SoundHandle sound) { return sound.IsValid(); }));
+		REQUIRE(as.mVirtualVoices.size() == AudioSystem::MAX_VIRTUAL_VOICES);
+		REQUIRE(as.mHandleMap.size() == 4 + AudioSystem::MAX_VIRTUAL_VOICES);
+
+		// The oldest virtual voices went first, and the newest are still there
+		REQUIRE(as.GetSoundState(sounds[4]) == SoundState::Stopped);
+		REQUIRE(as.GetSoundState(sounds.back()) == SoundState::Playing);
+		REQUIRE(as.mHandleMap[sounds.back()].mChannel == -1);
+
+		// A lower priority voice than all of them is the one stopped
+		SoundHandle low = as.PlaySound("1.wav", true, -1);
+		REQUIRE_FALSE(low.IsValid());
+		REQUIRE(as.mVirtualVoices.size() == AudioSystem::MAX_VIRTUAL_VOICES);
+
+		// A higher one takes a channel, and the voice it demotes is older
+		// than every virtual voice, so that's the one stopped
+		SoundHandle high = as.PlaySound("1.wav", true, 1);
+		REQUIRE(as.mChannels[0] == high);
+		REQUIRE(as.GetSoundState(sounds[0]) == SoundState::Stopped);
+		REQUIRE(as.GetSoundState(sounds[sounds.size() - AudioSystem::MAX_VIRTUAL_VOICES]) ==
+				SoundState::Playing);
+		REQUIRE(as.mVirtualVoices.size() == AudioSystem::MAX_VIRTUAL_VOICES);
+	}
+
+	SECTION("Virtual voices - demoted and promoted by priority, oldest first among equals")
+	{
+		ScopedTempDir tempDir("AudioSystemVirtual");
+		WriteStreamWav(tempDir.GetPath() / "Assets/Sounds/Music.wav", 250000);
+		AudioSystem as(4);
+		as.SetVirtualVoicesEnabled(true);
+		as.CacheSound("1.wav");
+
+		// A stream can't be virtual, so it keeps its channel from all of them
+		SoundHandle music = as.PlayStream("Music.wav", true, -10);
+		std::vector<SoundHandle> sounds;
+		for (int i = 0; i < 64; i++)
+		{
+			sounds.emplace_back(as.PlaySound("1.wav", true, (i * 7) % 5));
+		}
+		REQUIRE(as.mChannels[0] == music);
+		REQUIRE(as.mVirtualVoices.size() == 61);
+
+		// Each freed channel goes to the next voice in the same order
+		std::vector<SoundHandle> expected = sounds;
+		std::stable_sort(expected.begin(), expected.end(), [&as](SoundHandle a, SoundHandle b) {
+			return as.mHandleMap[a].mPriority > as.mHandleMap[b].mPriority;
+		});
+		for (SoundHandle sound : expected)
+		{
+			REQUIRE(as.mHandleMap[sound].mChannel != -1);
+			as.StopSound(sound);
+		}
+		REQUIRE(as.mVirtualVoices.empty());
+		REQUIRE(as.mVirtualVictims.empty());
+		REQUIRE(as.mDemotableVoices.empty());
+		REQUIRE(as.GetSoundState(music) == SoundState::Playing);
+	}
+
+	SECTION("Virtual voices - virtual one-shots keep their place in the sound")
+	{
+		AudioSystem as(1);
+		as.SetVirtualVoicesEnabled(true);
+		as.CacheSound("1.wav");
+		as.CacheSound("2.wav");
+		as.CacheSound("3.wav");
+
+		// Mock sounds are one second long
+		SoundHandle snd = as.PlaySound("1.wav", true);
+		SoundHandle snd2 = as.PlaySound("2.wav");
+		SoundHandle snd3 = as.PlaySound("3.wav");
+		as.Update(0.5f);
+		as.PauseSound(snd3);
+		as.Update(0.75f);
+
+		// snd2 ran out while virtual, the paused snd3 didn't
+		REQUIRE(as.GetSoundState(snd2) == SoundState::Stopped);
+		REQUIRE(as.GetSoundState(snd3) == SoundState::Paused);
+
+		// snd3 gets the channel halfway through its sound, still paused
+		as.StopSound(snd);
+		REQUIRE(as.mChannels[0] == snd3);
+		Mix_Chunk* chunk = Mock::Mixer.mChannels[0].mChunk;
+		REQUIRE(chunk->mName == "Assets/Sounds/3.wav");
+		REQUIRE(chunk->alen == as.GetSound("3.wav")->alen / 2);
+		REQUIRE(chunk->abuf == as.GetSound("3.wav")->abuf + chunk->alen);
+		REQUIRE(Mock::Mixer.mChannels[0].mPaused);
+	}
+
+	SECTION("PlaySound running out of channels priority 1 (oldest instance of same sound)")
+	{
+		AudioSystem as(4);
+		as.CacheSound("1.wav");
+		as.CacheSound("2.wav");
+		as.CacheSound("3.wav");
+
+		SoundHandle snd = as.PlaySound("1.wav");
+		SoundHandle snd2 = as.PlaySound("2.wav");
+		SoundHandle snd3 = as.PlaySound("2.wav");
+		SoundHandle snd4 = as.PlaySound("2.wav");
+		SoundHandle snd5 = as.PlaySound("2.wav");
+
+		// Channels should be in this order: snd, snd5, snd3, snd4
+		REQUIRE(as.mChannels[0] == snd);
+		REQUIRE(as.mChannels[1] == snd5);
+		REQUIRE(as.mChannels[2] == snd3);
+		REQUIRE(as.mChannels[3] == snd4);
+
+		// Make sure that snd2 is not in the map (and the others are)
+		REQUIRE(as.mHandleMap.find(snd2) == as.mHandleMap.end());
+		REQUIRE(as.mHandleMap.find(snd) != as.mHandleMap.end());
+		REQUIRE(as.mHandleMap.find(snd3) != as.mHandleMap.end());
+		REQUIRE(as.mHandleMap.find(snd4) != as.mHandleMap.end());
+		REQUIRE(as.mHandleMap.find(snd5) != as.mHandleMap.end());
+
+		// Make sure we have the correct sounds in SDL_Mixer
+		REQUIRE(Mock::Mixer.mChannels[0].mChunk != nullptr);
+		REQUIRE(Mock::Mixer.mChannels[0].mChunk->mName == "Assets/Sounds/1.wav");
+		REQUIRE(Mock::Mixer.mChannels[1].mChunk != nullptr);
+		REQUIRE(Mock::Mixer.mChannels[1].mChunk->mName == "Assets/Sounds/2.wav");
+		REQUIRE(Mock::Mixer.mChannels[2].mChunk != nullptr);
+		REQUIRE(Mock::Mixer.mChannels[2].mChunk->mName == "Assets/Sounds/2.wav");
+		REQUIRE(Mock::Mixer.mChannels[3].mChunk != nullptr);
+		REQUIRE(Mock::Mixer.mChannels[3].mChunk->mName == "Assets/Sounds/2.wav");
+	}
+
+	SECTION("PlaySound running out of channels priority 2 (oldest non-looping sound)")
+	{
+		AudioSystem as(4);
+		as.CacheSound("1.wav");
+		as.CacheSound("2.wav");
+		as.CacheSound("3.wav");
+		as.CacheSound("4.wav");
+		as.CacheSound("5.wav");
+
+		SoundHandle snd = as.PlaySound("1.wav", true);
+		SoundHandle snd2 = as.PlaySound("2.wav", true);
+		SoundHandle snd3 = as.PlaySound("3.wav");
+		SoundHandle snd4 = as.PlaySound("4.wav", true);
+		SoundHandle snd5 = as.PlaySound("5.wav");
+
+		// Channels should be in this order: snd, snd2, snd5, snd4
+		REQUIRE(as.mChannels[0] == snd);
+		REQUIRE(as.mChannels[1] == snd2);
+		REQUIRE(as.mChannels[2] == snd5);
+		REQUIRE(as.mChannels[3] == snd4);
+
+		// Make sure that snd3 is not in the map (and the others are)
+		REQUIRE(as.mHandleMap.find(snd3) == as.mHandleMap.end());
+		REQUIRE(as.mHandleMap.find(snd) != as.mHandleMap.end());
+		REQUIRE(as.mHandleMap.find(snd2) != as.mHandleMap.end());
+		REQUIRE(as.mHandleMap.find(snd4) != as.mHandleMap.end());
+		REQUIRE(as.mHandleMap.find(snd5) != as.mHandleMap.end());
+
+		// Make sure we have the correct sounds in SDL_Mixer
+		REQUIRE(Mock::Mixer.mChannels[0].mChunk != nullptr);
+		REQUIRE(Mock::Mixer.mChannels[0].mChunk->mName == "Assets/Sounds/1.wav");
+		REQUIRE(Mock::Mixer.mChannels[1].mChunk != nullptr);
+		REQUIRE(Mock::Mixer.mChannels[1].mChunk->mName == "Assets/Sounds/2.wav");
+		REQUIRE(Mock::Mixer.mChannels[2].mChunk != nullptr);
+		REQUIRE(Mock::Mixer.mChannels[2].mChunk->mName == "Assets/Sounds/5.wav");
+		REQUIRE(Mock::Mixer.mChannels[3].mChunk != nullptr);
+		REQUIRE(Mock::Mixer.mChannels[3].mChunk->mName == "Assets/Sounds/4.wav");
+	}
+
+	SECTION("PlaySound running out of channels priority 3 (oldest sound)")
+	{
+		AudioSystem as(4);
+		as.CacheSound("1.wav");
+		as.CacheSound("2.wav");
+		as.CacheSound("3.wav");
+		as.CacheSound("4.wav");
+		as.CacheSound("5.wav");
+
+		SoundHandle snd = as.PlaySound("1.wav", true);
+		SoundHandle snd2 = as.PlaySound("2.wav", true);
+		SoundHandle snd3 = as.PlaySound("3.wav", true);
+		SoundHandle snd4 = as.PlaySound("4.wav", true);
+		SoundHandle snd5 = as.PlaySound("5.wav");
+
+		// Channels should be in this order: snd5, snd2, snd3, snd4
+		REQUIRE(as.mChannels[0] == snd5);
+		REQUIRE(as.mChannels[1] == snd2);
+		REQUIRE(as.mChannels[2] == snd3);
+		REQUIRE(as.mChannels[3] == snd4);
+
+		// Make sure that snd is not in the map (and the others are)
+		REQUIRE(as.mHandleMap.find(snd) == as.mHandleMap.end());
+		REQUIRE(as.mHandleMap.find(snd2) != as.mHandleMap.end());
+		REQUIRE(as.mHandleMap.find(snd3) != as.mHandleMap.end());
+		REQUIRE(as.mHandleMap.find(snd4) != as.mHandleMap.end());
+		REQUIRE(as.mHandleMap.find(snd5) != as.mHandleMap.end());
+
+		// Make sure we have the correct sounds in SDL_Mixer
+		REQUIRE(Mock::Mixer.mChannels[0].mChunk != nullptr);
+		REQUIRE(Mock::Mixer.mChannels[0].mChunk->mName == "Assets/Sounds/5.wav");
+		REQUIRE(Mock::Mixer.mChannels[1].mChunk != nullptr);
+		REQUIRE(Mock::Mixer.mChannels[1].mChunk->mName == "Assets/Sounds/2.wav");
+		REQUIRE(Mock::Mixer.mChannels[2].mChunk != nullptr);
+		REQUIRE(Mock::Mixer.mChannels[2].mChunk->mName == "Assets/Sounds/3.wav");
+		REQUIRE(Mock::Mixer.mChannels[3].mChunk != nullptr);
+		REQUIRE(Mock::Mixer.mChannels[3].mChunk->mName == "Assets/Sounds/4.wav");
+	}
+}
+
+TEST_CASE("AudioSystem benchmarks", "[!benchmark]")
+{
+	// Every channel but the last is busy, which is the worst case for
+	// finding a free channel
+	for (int numChannels : {8, 64, 512, 4096})
+	{
+		AudioSystem as(numChannels);
+		as.CacheSound("1.wav");
+		for (int i = 0; i < numChannels - 1; i++)
+		{
+			as.PlaySound("1.wav", true);
+		}
+
+		BENCHMARK("PlaySound/StopSound with " + std::to_string(numChannels) + " channels")
+		{
+			SoundHandle snd = as.PlaySound("1.wav");
+			as.StopSound(snd);
+			return snd;
+		};
+
+		// Nothing finished, so Update shouldn't depend on the channel count
+		as.Update(DELTA_TIME);
+		BENCHMARK("Update with " + std::to_string(numChannels) + " looping channels")
+		{
+			as.Update(DELTA_TIME);
+		};
+
+		// Every channel is busy, so each PlaySound steals the oldest one-shot
+		as.PlaySound("1.wav");
+		BENCHMARK("PlaySound stealing with " + std::to_string(numChannels) + " channels")
+		{
+			return as.PlaySound("1.wav");
+		};
+	}
+}
+
+TEST_CASE("AudioSystem PlaySounds benchmarks", "[!benchmark]")
+{
+	AudioSystem as(512);
+	as.CacheSound("Explosion.wav");
+
+	std::vector<SoundRequest> requests(32, SoundRequest{"Explosion.wav"});
+	const std::string name = "Explosion.wav";
+
+	BENCHMARK("PlaySound x32")
+	{
+		for (int i = 0; i < 32; i++)
+		{
+			as.PlaySound(name);
+		}
+		as.Update(DELTA_TIME);
+	};
+
+	BENCHMARK("PlaySounds with 32 requests")
+	{
+		as.PlaySounds(requests);
+		as.Update(DELTA_TIME);
+	};
+}
+
+TEST_CASE("AudioSystem compressed storage benchmarks", "[!benchmark]")
+{
+	// What each voice of a compressed sound costs per buffer (a quarter
+	// second), compared to copying the same amount of PCM
+	AudioSystem as(8);
+	as.SetCompressedStorage(true);
+	Mock::Mixer.mLoadSeconds = 2;
+	as.CacheSound("Ambience.wav");
+	SoundHandle sound = as.PlaySound("Ambience.wav", true);
+	AudioSystem::StreamInfo& stream = *as.mHandleMap[sound].mStream;
+	std::vector<Uint8> pcm(44100 * 4);
+
+	BENCHMARK("Decode one IMA-ADPCM buffer for a voice")
+	{
+		stream.mNumPlayed = stream.mNumFilled.load();
+		return as.FillStreamBuffer(stream);
+	};
+
+	BENCHMARK("Copy one PCM buffer for a voice")
+	{
+		std::vector<Uint8>& buffer = stream.mBuffers[0];
+		std::memcpy(buffer.data(), pcm.data(), buffer.size());
+		return buffer[0];
+	};
+}
+
+TEST_CASE("AudioSystem CacheAllSounds benchmarks", "[!benchmark]")
+{
+	// A few thousand sounds, like a full game's worth of assets (with no
+	// manifest, so CacheAllSounds goes through the folder)
+	ScopedTempDir tempDir("AudioSystemBenchCorpus");
+	const std::filesystem::path& dir = tempDir.GetPath();
+	WriteSoundCorpus(dir, 4000, 64 * 1024);
+	std::vector<std::string> fileNames;
+	for (int i = 0; i < 4000; i++)
+	{
+		fileNames.emplace_back(std::to_string(i) + (i % 2 == 0 ? ".wav" : ".ogg"));
+	}
+
+	BENCHMARK("CacheSound for each of 4000 sounds")
+	{
+		AudioSystem as(8);
+		for (const std::string& fileName : fileNames)
+		{
+			as.CacheSound(fileName);
+		}
+	};
+
+	BENCHMARK("CacheAllSounds with 4000 sounds")
+	{
+		AudioSystem as(8, {});
+		as.CacheAllSounds();
+	};
+
+	BENCHMARK("Lazy CacheAllSounds with 4000 sounds")
+	{
+		AudioSystem as(8, {});
+		as.SetLazyCaching(true);
+		as.CacheAllSounds();
+	};
+
+	// The first CacheAllSounds writes the index that the rest read
+	BENCHMARK("Lazy CacheAllSounds with 4000 sounds and a sound index")
+	{
+		AudioSystem as(8, {});
+		as.SetLazyCaching(true);
+		as.SetSoundIndexPath("SoundIndex.bin");
+		as.CacheAllSounds();
+	};
+
+}
+
+TEST_CASE("AudioSystem LoadSounds benchmarks", "[!benchmark]")
+{
+	// A level's worth of small sounds loaded again and again, where getting
+	// the worker threads going is a big part of each CacheAllSounds
+	ScopedTempDir tempDir("AudioSystemBenchReload");
+	WriteSoundCorpus(tempDir.GetPath(), 64, 4 * 1024);
+	AudioSystem as(8, {});
+
+	BENCHMARK("CacheAllSounds again after UnloadUnused, with 64 small sounds")
+	{
+		as.UnloadUnused();
+		as.CacheAllSounds();
+	};
+}
+
+TEST_CASE("SoftwareMixer benchmarks", "[!benchmark]")
+{
+	// Mixing 10 ms of stereo 16-bit audio with each set of kernels
+	const size_t numFrames = 441;
+	std::vector<int16_t> samples(44100 * 2);
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		samples[i] = static_cast<int16_t>((i * 7919) % 65536 - 32768);
+	}
+	Mix_Chunk chunk;
+	chunk.abuf = reinterpret_cast<Uint8*>(samples.data());
+	chunk.alen = static_cast<Uint32>(samples.size() * sizeof(int16_t));
+	std::vector<float> output(numFrames * 2);
+
+	// Fading voices ramp their gains the whole time (over far longer than
+	// the benchmark runs, so the ramps never finish)
+	for (int numVoices : {64, 256})
+	{
+		for (bool fading : {false, true})
+		{
+			SoftwareMixer mixer(numVoices, 44100, SDL_AUDIO_S16, 2);
+			for (int i = 0; i < numVoices; i++)
+			{
+				mixer.PlayChannel(i, &chunk, -1);
+				if (fading)
+				{
+					mixer.SetVolume(i, 0, size_t{1} << 40);
+				}
+			}
+			for (SoftwareMixer::Kernels kernels :
+				 {SoftwareMixer::Kernels::Scalar, SoftwareMixer::Kernels::SSE2,
+				  SoftwareMixer::Kernels::AVX2})
+			{
+				mixer.SetKernels(kernels);
+				if (mixer.GetKernels() != kernels)
+				{
+					continue;
+				}
+				const char* names[] = {"scalar", "SSE2", "AVX2"};
+				BENCHMARK("Mix 10 ms of " + std::to_string(numVoices) +
+						  (fading ? " fading" : "") + " voices (" +
+						  names[static_cast<int>(kernels)] + ")")
+				{
+					mixer.Mix(output.data(), numFrames);
+					return output[0];
+				};
+			}
+		}
+	}
+}
+
+TEST_CASE("AudioSystem offline render benchmarks", "[!benchmark]")
+{
+	// Seconds of audio rendered per wall-clock second is 10 over the time
+	AudioSystem as(64);
+	as.SetSoftwareMixer(true);
+	for (int i = 0; i < 64; i++)
+	{
+		as.PlaySound("Ambience.wav", true);
+	}
+	std::vector<float> samples;
+
+	BENCHMARK("Render 10 s offline with 64 looping voices")
+	{
+		samples.clear();
+		as.RenderOffline(10.0f, samples);
+		return samples.size();
+	};
 }
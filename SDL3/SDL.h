@@ -1,8 +1,15 @@
 // This is just a dummy SDL header in case someone includes it
 #pragma once
 
+#include <cassert>
 #include <string>
 #include "SDL_stdinc.h"
+#include "SDL_audio.h"
+
+// The tests define their own SDL_assert first (as a REQUIRE)
+#ifndef SDL_assert
+#define SDL_assert(condition) assert(condition)
+#endif
 
 void SDL_Log(...);
 
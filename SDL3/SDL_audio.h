@@ -0,0 +1,16 @@
+// This is just a dummy SDL header in case someone includes it
+#pragma once
+
+#include "SDL_stdinc.h"
+
+typedef enum SDL_AudioFormat
+{
+	SDL_AUDIO_UNKNOWN = 0x0000u,
+	SDL_AUDIO_U8 = 0x0008u,
+	SDL_AUDIO_S16 = 0x8010u,
+	SDL_AUDIO_F32 = 0x8120u
+} SDL_AudioFormat;
+
+#define SDL_AUDIO_BITSIZE(x) ((x) & 0xFFu)
+#define SDL_AUDIO_BYTESIZE(x) (SDL_AUDIO_BITSIZE(x) / 8)
+#define SDL_AUDIO_ISFLOAT(x) ((x) & 0x0100u)
@@ -1,5 +1,8 @@
 #pragma once
+#include <cstdint>
 typedef uint8_t Uint8;
+typedef int16_t Sint16;
 typedef uint16_t Uint16;
+typedef uint32_t Uint32;
 
 #define SDL_SCANCODE_PERIOD 55
@@ -1,14 +1,29 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <mutex>
 #include <string>
 #include <set>
 #include <vector>
+#include "../SDL3/SDL_audio.h"
 #include "../catch.hpp"
 
+#define MIX_MAX_VOLUME 128
+
 struct Mix_Chunk
 {
+	int allocated = 0;
+	Uint8* abuf = nullptr;
+	Uint32 alen = 0;
+	Uint8 volume = 128;
 	std::string mName;
 };
 
+typedef void (*Mix_EffectFunc_t)(int chan, void* stream, int len, void* udata);
+typedef void (*Mix_EffectDone_t)(int chan, void* udata);
+
 struct Mock
 {
 	void OpenAudio(int devid, int* spec)
@@ -27,6 +42,9 @@ struct Mock
 		mSpec = nullptr;
 		mChannels.clear();
 		mChunks.clear();
+		mChannelFinished = nullptr;
+		mFailLoads = false;
+		mLoadSeconds = 1;
 	}
 
 	void FreeChunk(Mix_Chunk* chunk)
@@ -35,6 +53,10 @@ struct Mock
 		if (iter != mChunks.end())
 		{
 			mChunks.erase(iter);
+			if (chunk->allocated)
+			{
+				delete[] chunk->abuf;
+			}
 			delete chunk;
 		}
 		else
@@ -59,11 +81,22 @@ struct Mock
 			FAIL("Mix_PlayChannel should not be called with a channel of -1");
 		}
 
-		if (channel < 0 || channel >= mChannels.size())
+		if (channel < 0 || channel >= static_cast<int>(mChannels.size()))
 		{
 			FAIL("Mix_PlayChannel called with an out-of-bounds channel");
 		}
 
+		// Like SDL_mixer, replacing a playing sound reports it as finished
+		// and unregisters its effects
+		if (mChannels[channel].mPlaying)
+		{
+			if (mChannelFinished)
+			{
+				mChannelFinished(channel);
+			}
+			UnregisterAllEffects(channel);
+		}
+
 		mChannels[channel].mChunk = chunk;
 		mChannels[channel].mPlaying = true;
 		mChannels[channel].mPaused = false;
@@ -79,15 +112,81 @@ struct Mock
 			FAIL("Mix_HaltChannel should not be called with a channel of -1");
 		}
 
-		if (channel < 0 || channel >= mChannels.size())
+		if (channel < 0 || channel >= static_cast<int>(mChannels.size()))
 		{
 			FAIL("Mix_HaltChannel called with an out-of-bounds channel");
 		}
 
+		bool wasPlaying = mChannels[channel].mPlaying;
 		mChannels[channel].mChunk = nullptr;
 		mChannels[channel].mPlaying = false;
+
+		if (wasPlaying)
+		{
+			if (mChannelFinished)
+			{
+				mChannelFinished(channel);
+			}
+			UnregisterAllEffects(channel);
+		}
+	}
+
+	bool RegisterEffect(int channel, Mix_EffectFunc_t effect, Mix_EffectDone_t done, void* arg)
+	{
+		if (channel < 0 || channel >= static_cast<int>(mChannels.size()))
+		{
+			FAIL("Mix_RegisterEffect called with an out-of-bounds channel");
+		}
+
+		mChannels[channel].mEffects.push_back({effect, done, arg});
+		return true;
 	}
 
+	bool UnregisterAllEffects(int channel)
+	{
+		if (channel < 0 || channel >= static_cast<int>(mChannels.size()))
+		{
+			FAIL("Mix_UnregisterAllEffects called with an out-of-bounds channel");
+		}
+
+		std::vector<Effect> effects;
+		effects.swap(mChannels[channel].mEffects);
+		for (const Effect& effect : effects)
+		{
+			if (effect.mDone)
+			{
+				effect.mDone(channel, effect.mArg);
+			}
+		}
+		return true;
+	}
+
+	// Mixes the next length bytes of the channel like SDL_mixer's audio
+	// thread would (looping its chunk) and runs them through its effects.
+	// Returns nothing if the channel is stopped or paused.
+	std::vector<Uint8> Mix(int channel, int length)
+	{
+		std::vector<Uint8> mixed;
+		ChannelInfo& info = mChannels[channel];
+		if (!info.mPlaying || info.mPaused)
+		{
+			return mixed;
+		}
+
+		mixed.resize(length);
+		for (int i = 0; i < length && info.mChunk->alen > 0; i++)
+		{
+			mixed[i] = info.mChunk->abuf[i % info.mChunk->alen];
+		}
+		for (const Effect& effect : info.mEffects)
+		{
+			effect.mFunc(channel, mixed.data(), length, effect.mArg);
+		}
+		return mixed;
+	}
+
+	void ChannelFinished(void (*channelFinished)(int)) { mChannelFinished = channelFinished; }
+
 	void Pause(int channel)
 	{
 		if (channel == -1)
@@ -95,7 +194,7 @@ struct Mock
 			FAIL("Mix_Pause should not be called with a channel of -1");
 		}
 
-		if (channel < 0 || channel >= mChannels.size())
+		if (channel < 0 || channel >= static_cast<int>(mChannels.size()))
 		{
 			FAIL("Mix_Pause called with an out-of-bounds channel");
 		}
@@ -110,7 +209,7 @@ struct Mock
 			FAIL("Mix_Resume should not be called with a channel of -1");
 		}
 
-		if (channel < 0 || channel >= mChannels.size())
+		if (channel < 0 || channel >= static_cast<int>(mChannels.size()))
 		{
 			FAIL("Mix_Resume called with an out-of-bounds channel");
 		}
@@ -118,28 +217,175 @@ struct Mock
 		mChannels[channel].mPaused = false;
 	}
 
+	int Volume(int channel, int volume)
+	{
+		if (channel == -1)
+		{
+			FAIL("Mix_Volume should not be called with a channel of -1");
+		}
+
+		if (channel < 0 || channel >= static_cast<int>(mChannels.size()))
+		{
+			FAIL("Mix_Volume called with an out-of-bounds channel");
+		}
+
+		int prevVolume = mChannels[channel].mVolume;
+		if (volume >= 0)
+		{
+			mChannels[channel].mVolume = volume > MIX_MAX_VOLUME ? MIX_MAX_VOLUME : volume;
+		}
+		return prevVolume;
+	}
+
+	bool SetPanning(int channel, Uint8 left, Uint8 right)
+	{
+		if (channel < 0 || channel >= static_cast<int>(mChannels.size()))
+		{
+			FAIL("Mix_SetPanning called with an out-of-bounds channel");
+		}
+
+		mChannels[channel].mLeft = left;
+		mChannels[channel].mRight = right;
+		return true;
+	}
+
 	int Playing(int channel) { return mChannels[channel].mPlaying ? 1 : 0; }
 
+	bool QuerySpec(int* frequency, SDL_AudioFormat* format, int* channels)
+	{
+		if (mDevID == -1)
+		{
+			return false;
+		}
+
+		*frequency = mFrequency;
+		*format = mFormat;
+		*channels = mNumChannels;
+		return true;
+	}
+
+	// Every mock sound is mLoadSeconds of silence in the device format
 	Mix_Chunk* LoadWAV(const char* file)
 	{
-		Mix_Chunk* chunk = new Mix_Chunk{file};
+		if (mFailLoads)
+		{
+			return nullptr;
+		}
+
+		Mix_Chunk* chunk = new Mix_Chunk;
+		chunk->mName = file;
+
+		// Files that exist are "decoded" by reading them in, so loading a
+		// real asset costs roughly what it would in SDL_mixer. A WAV file's
+		// chunk is the samples in its data chunk (its format isn't
+		// converted), and one without a data chunk doesn't load. Other
+		// files are taken as samples whole. A missing file is mLoadSeconds
+		// of silence.
+		std::ifstream stream(file, std::ios::binary | std::ios::ate);
+		if (stream)
+		{
+			std::vector<char> contents(static_cast<size_t>(stream.tellg()));
+			stream.seekg(0);
+			stream.read(contents.data(), static_cast<std::streamsize>(contents.size()));
+			size_t offset = 0;
+			size_t length = contents.size();
+			if (!FindWavData(contents, offset, length))
+			{
+				delete chunk;
+				return nullptr;
+			}
+			chunk->alen = static_cast<Uint32>(length);
+			chunk->abuf = new Uint8[chunk->alen]();
+			std::memcpy(chunk->abuf, contents.data() + offset, length);
+		}
+		else
+		{
+			chunk->alen = mLoadSeconds * mFrequency * SDL_AUDIO_BYTESIZE(mFormat) * mNumChannels;
+			chunk->abuf = new Uint8[chunk->alen]();
+		}
+		chunk->allocated = 1;
+
+		// Like SDL_mixer, chunks can be loaded from any thread
+		std::lock_guard<std::mutex> lock(mChunksMutex);
+		mChunks.emplace(chunk);
+		return chunk;
+	}
+
+	// Narrows offset and length to a RIFF/WAVE file's data chunk. Returns
+	// false for a WAV file without one, and true (leaving them alone) for
+	// anything that isn't a WAV file.
+	static bool FindWavData(const std::vector<char>& file, size_t& offset, size_t& length)
+	{
+		if (file.size() < 12 || std::memcmp(file.data(), "RIFF", 4) != 0 ||
+			std::memcmp(file.data() + 8, "WAVE", 4) != 0)
+		{
+			return true;
+		}
+		for (size_t pos = 12; pos + 8 <= file.size();)
+		{
+			uint32_t chunkSize = 0;
+			std::memcpy(&chunkSize, file.data() + pos + 4, sizeof(chunkSize));
+			size_t size = std::min<size_t>(chunkSize, file.size() - pos - 8);
+			if (std::memcmp(file.data() + pos, "data", 4) == 0)
+			{
+				offset = pos + 8;
+				length = size;
+				return true;
+			}
+			pos += 8 + size + (size & 1);
+		}
+		return false;
+	}
+
+	// Like SDL_mixer, the chunk points at mem rather than copying it
+	Mix_Chunk* QuickLoadRAW(Uint8* mem, Uint32 len)
+	{
+		Mix_Chunk* chunk = new Mix_Chunk;
+		chunk->abuf = mem;
+		chunk->alen = len;
+		chunk->allocated = 0;
+
+		std::lock_guard<std::mutex> lock(mChunksMutex);
 		mChunks.emplace(chunk);
 		return chunk;
 	}
 
+	struct Effect
+	{
+		Mix_EffectFunc_t mFunc = nullptr;
+		Mix_EffectDone_t mDone = nullptr;
+		void* mArg = nullptr;
+	};
+
 	struct ChannelInfo
 	{
 		Mix_Chunk* mChunk = nullptr;
 		bool mPlaying = false;
 		bool mPaused = false;
 		int mLoops = 0;
+		int mVolume = MIX_MAX_VOLUME;
+		Uint8 mLeft = 255;
+		Uint8 mRight = 255;
+		std::vector<Effect> mEffects;
 	};
 
 	int mDevID = -1;
 	int* mSpec = nullptr;
 
+	// Device format reported by Mix_QuerySpec
+	int mFrequency = 44100;
+	SDL_AudioFormat mFormat = SDL_AUDIO_S16;
+	int mNumChannels = 2;
+
+	// Makes Mix_LoadWAV fail, as if the file wasn't there
+	std::atomic<bool> mFailLoads = false;
+	// Length of the silence Mix_LoadWAV makes for a file that isn't there
+	int mLoadSeconds = 1;
+
 	std::set<Mix_Chunk*> mChunks;
+	std::mutex mChunksMutex;
 	std::vector<ChannelInfo> mChannels;
+	void (*mChannelFinished)(int) = nullptr;
 
 	static Mock Mixer;
 };
@@ -178,6 +424,11 @@ inline int Mix_HaltChannel(int channel)
 	return 0;
 }
 
+inline void Mix_ChannelFinished(void (*channel_finished)(int channel))
+{
+	Mock::Mixer.ChannelFinished(channel_finished);
+}
+
 inline void Mix_Pause(int channel)
 {
 	Mock::Mixer.Pause(channel);
@@ -188,16 +439,46 @@ inline void Mix_Resume(int channel)
 	Mock::Mixer.Resume(channel);
 }
 
+inline int Mix_Volume(int channel, int volume)
+{
+	return Mock::Mixer.Volume(channel, volume);
+}
+
+inline bool Mix_SetPanning(int channel, Uint8 left, Uint8 right)
+{
+	return Mock::Mixer.SetPanning(channel, left, right);
+}
+
+inline bool Mix_RegisterEffect(int chan, Mix_EffectFunc_t f, Mix_EffectDone_t d, void* arg)
+{
+	return Mock::Mixer.RegisterEffect(chan, f, d, arg);
+}
+
+inline bool Mix_UnregisterAllEffects(int channel)
+{
+	return Mock::Mixer.UnregisterAllEffects(channel);
+}
+
 inline int Mix_Playing(int channel)
 {
 	return Mock::Mixer.Playing(channel);
 }
 
+inline bool Mix_QuerySpec(int* frequency, SDL_AudioFormat* format, int* channels)
+{
+	return Mock::Mixer.QuerySpec(frequency, format, channels);
+}
+
 inline Mix_Chunk* Mix_LoadWAV(const char* file)
 {
 	return Mock::Mixer.LoadWAV(file);
 }
 
+inline Mix_Chunk* Mix_QuickLoad_RAW(Uint8* mem, Uint32 len)
+{
+	return Mock::Mixer.QuickLoadRAW(mem, len);
+}
+
 inline const char* Mix_GetError()
 {
 	return "stubbed error";
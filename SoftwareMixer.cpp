@@ -0,0 +1,755 @@
+#include "SoftwareMixer.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SOFTWARE_MIXER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only allow AVX2 intrinsics in functions built for it, and
+// the rest of the program may not be
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+SoftwareMixer::SoftwareMixer(int numChannels, int frequency, SDL_AudioFormat format,
+							 int outputChannels)
+: mChannels(numChannels)
+, mFrequency(frequency)
+, mOutputChannels(outputChannels)
+, mIsFloat(SDL_AUDIO_ISFLOAT(format))
+, mFrameSize(static_cast<int>(SDL_AUDIO_BYTESIZE(format)) * outputChannels)
+{
+	for (Channel& info : mChannels)
+	{
+		info.mGains = GetTargetGains(info);
+	}
+	SetKernels(DetectKernels());
+}
+
+// Returns true if the mixer can mix chunks in this format
+bool SoftwareMixer::IsFormatSupported(SDL_AudioFormat format, int outputChannels)
+{
+	return (format == SDL_AUDIO_S16 || format == SDL_AUDIO_F32) && outputChannels > 0 &&
+		   outputChannels <= MAX_OUTPUT_CHANNELS;
+}
+
+void SoftwareMixer::PlayChannel(int channel, Mix_Chunk* chunk, int loops)
+{
+	std::lock_guard<std::recursive_mutex> lock(mMutex);
+
+	// Like SDL_mixer, replacing a playing sound reports it as finished
+	if (mChannels[channel].mPlaying)
+	{
+		FinishChannel(channel);
+	}
+
+	Channel& info = mChannels[channel];
+	info.mChunk = chunk;
+	info.mPosition = 0;
+	info.mLoops = loops;
+	info.mPlaying = true;
+	info.mPaused = false;
+}
+
+void SoftwareMixer::HaltChannel(int channel)
+{
+	std::lock_guard<std::recursive_mutex> lock(mMutex);
+	if (mChannels[channel].mPlaying)
+	{
+		FinishChannel(channel);
+	}
+}
+
+void SoftwareMixer::Pause(int channel)
+{
+	std::lock_guard<std::recursive_mutex> lock(mMutex);
+	mChannels[channel].mPaused = true;
+}
+
+void SoftwareMixer::Resume(int channel)
+{
+	std::lock_guard<std::recursive_mutex> lock(mMutex);
+	mChannels[channel].mPaused = false;
+}
+
+// Sets the channel's volume, ramping to it over rampFrames frames
+void SoftwareMixer::SetVolume(int channel, int volume, size_t rampFrames)
+{
+	std::lock_guard<std::recursive_mutex> lock(mMutex);
+	mChannels[channel].mVolume = std::clamp(volume, 0, MIX_MAX_VOLUME);
+	StartRamp(mChannels[channel], rampFrames);
+}
+
+// Sets the channel's pan, ramping to it over rampFrames frames
+void SoftwareMixer::SetPan(int channel, float pan, size_t rampFrames)
+{
+	std::lock_guard<std::recursive_mutex> lock(mMutex);
+	mChannels[channel].mPan = std::clamp(pan, -1.0f, 1.0f);
+	StartRamp(mChannels[channel], rampFrames);
+}
+
+bool SoftwareMixer::IsPlaying(int channel) const
+{
+	std::lock_guard<std::recursive_mutex> lock(mMutex);
+	return mChannels[channel].mPlaying;
+}
+
+void SoftwareMixer::SetChannelFinished(void (*channelFinished)(int))
+{
+	std::lock_guard<std::recursive_mutex> lock(mMutex);
+	mChannelFinished = channelFinished;
+}
+
+void SoftwareMixer::RegisterEffect(int channel, Mix_EffectFunc_t effect, Mix_EffectDone_t done,
+								   void* userData)
+{
+	std::lock_guard<std::recursive_mutex> lock(mMutex);
+	mChannels[channel].mEffects.push_back({effect, done, userData});
+}
+
+void SoftwareMixer::UnregisterAllEffects(int channel)
+{
+	std::lock_guard<std::recursive_mutex> lock(mMutex);
+	std::vector<Effect> effects;
+	effects.swap(mChannels[channel].mEffects);
+	for (const Effect& effect : effects)
+	{
+		if (effect.mDone)
+		{
+			effect.mDone(channel, effect.mUserData);
+		}
+	}
+}
+
+// Mixes the next numFrames of every playing channel into output
+void SoftwareMixer::Mix(float* output, size_t numFrames)
+{
+	std::lock_guard<std::recursive_mutex> lock(mMutex);
+	size_t numSamples = numFrames * mOutputChannels;
+	std::fill(output, output + numSamples, 0.0f);
+	for (size_t i = 0; i < mChannels.size(); i++)
+	{
+		if (mChannels[i].mPlaying && !mChannels[i].mPaused)
+		{
+			MixChannel(static_cast<int>(i), output, numFrames);
+		}
+	}
+	mClip(output, numSamples);
+}
+
+// Mixes the channel into output until numFrames are done or it stops
+void SoftwareMixer::MixChannel(int channel, float* output, size_t numFrames)
+{
+	Channel& info = mChannels[channel];
+	size_t done = 0;
+	while (done < numFrames && info.mPlaying && !info.mPaused)
+	{
+		Mix_Chunk* chunk = info.mChunk;
+		size_t count = std::min<size_t>((chunk->alen - info.mPosition) / mFrameSize,
+										numFrames - done);
+		// The rest of a ramp is mixed on its own, so the frames after it
+		// can go back to the kernels with one gain
+		if (info.mRampFrames > 0)
+		{
+			count = std::min(count, info.mRampFrames);
+		}
+		const Uint8* src = chunk->abuf + info.mPosition;
+		if (!info.mEffects.empty())
+		{
+			// The effects change a copy, so the chunk stays as it was
+			size_t numBytes = count * mFrameSize;
+			mEffectBuffer.assign(src, src + numBytes);
+			for (const Effect& effect : info.mEffects)
+			{
+				effect.mFunc(channel, mEffectBuffer.data(), static_cast<int>(numBytes),
+							 effect.mUserData);
+			}
+			src = mEffectBuffer.data();
+		}
+		MixFrames(info, *chunk, src, output + done * mOutputChannels, count);
+		info.mPosition += static_cast<Uint32>(count * mFrameSize);
+		done += count;
+
+		if (info.mRampFrames > 0)
+		{
+			info.mRampFrames -= count;
+			for (int c = 0; c < mOutputChannels; c++)
+			{
+				info.mGains[c] += info.mSteps[c] * static_cast<float>(count);
+			}
+			// Land exactly on the gains it was ramping to
+			if (info.mRampFrames == 0)
+			{
+				StartRamp(info, 0);
+			}
+		}
+
+		// At the end of the chunk, go around again or finish (a chunk with
+		// no whole frames can't loop, or it would never get anywhere)
+		if (chunk->alen - info.mPosition < static_cast<Uint32>(mFrameSize))
+		{
+			if (info.mLoops != 0 && chunk->alen >= static_cast<Uint32>(mFrameSize))
+			{
+				info.mLoops -= info.mLoops > 0 ? 1 : 0;
+				info.mPosition = 0;
+			}
+			else
+			{
+				FinishChannel(channel);
+			}
+		}
+	}
+}
+
+// Mixes numFrames of the chunk's samples at src into output, at the
+// channel's gains
+void SoftwareMixer::MixFrames(const Channel& info, const Mix_Chunk& chunk, const Uint8* src,
+							  float* output, size_t numFrames)
+{
+	// The chunk's own volume scales the channel's gains
+	float chunkGain = static_cast<float>(chunk.volume) / MIX_MAX_VOLUME;
+	std::array<float, MAX_OUTPUT_CHANNELS> gains{};
+	std::array<float, MAX_OUTPUT_CHANNELS> steps{};
+	bool isUniform = info.mRampFrames == 0;
+	for (int c = 0; c < mOutputChannels; c++)
+	{
+		gains[c] = info.mGains[c] * chunkGain;
+		steps[c] = info.mRampFrames > 0 ? info.mSteps[c] * chunkGain : 0.0f;
+		isUniform = isUniform && gains[c] == gains[0];
+	}
+
+	// Most channels aren't ramping or panned, so they get by with one gain
+	if (mIsFloat)
+	{
+		const float* samples = reinterpret_cast<const float*>(src);
+		if (isUniform)
+		{
+			mMixF32(output, samples, numFrames * mOutputChannels, gains[0]);
+		}
+		else
+		{
+			mMixF32Ramp(output, samples, numFrames, mOutputChannels, gains.data(), steps.data());
+		}
+	}
+	else
+	{
+		const int16_t* samples = reinterpret_cast<const int16_t*>(src);
+		if (isUniform)
+		{
+			mMixS16(output, samples, numFrames * mOutputChannels, gains[0]);
+		}
+		else
+		{
+			mMixS16Ramp(output, samples, numFrames, mOutputChannels, gains.data(), steps.data());
+		}
+	}
+}
+
+// Ramps the channel's gains from where they are to its volume and pan over
+// rampFrames frames
+void SoftwareMixer::StartRamp(Channel& info, size_t rampFrames)
+{
+	std::array<float, MAX_OUTPUT_CHANNELS> target = GetTargetGains(info);
+	info.mRampFrames = rampFrames;
+	if (rampFrames == 0)
+	{
+		info.mGains = target;
+		info.mSteps = {};
+		return;
+	}
+	for (int c = 0; c < mOutputChannels; c++)
+	{
+		info.mSteps[c] = (target[c] - info.mGains[c]) / static_cast<float>(rampFrames);
+	}
+}
+
+// Gains of each output channel for the channel's volume and pan
+std::array<float, SoftwareMixer::MAX_OUTPUT_CHANNELS> SoftwareMixer::GetTargetGains(
+	const Channel& info) const
+{
+	std::array<float, MAX_OUTPUT_CHANNELS> gains{};
+	float gain = static_cast<float>(info.mVolume) / MIX_MAX_VOLUME;
+	std::fill_n(gains.begin(), mOutputChannels, gain);
+	// Panning fades out the far speaker and leaves the near one at full
+	// volume, so a centered sound is as loud as it was with no pan
+	if (mOutputChannels == 2)
+	{
+		gains[0] *= std::min(1.0f, 1.0f - info.mPan);
+		gains[1] *= std::min(1.0f, 1.0f + info.mPan);
+	}
+	return gains;
+}
+
+// Stops the channel, unregisters its effects and calls the channel
+// finished callback
+void SoftwareMixer::FinishChannel(int channel)
+{
+	Channel& info = mChannels[channel];
+	info.mChunk = nullptr;
+	info.mPlaying = false;
+	info.mPaused = false;
+	UnregisterAllEffects(channel);
+	if (mChannelFinished)
+	{
+		mChannelFinished(channel);
+	}
+}
+
+// Returns the best kernels this CPU supports
+SoftwareMixer::Kernels SoftwareMixer::DetectKernels()
+{
+#if defined(SOFTWARE_MIXER_X86) && defined(_MSC_VER)
+	int info[4] = {};
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	// AVX2 also needs the OS to save the upper halves of the registers
+	bool osSavesAvx = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+	__cpuid(info, 0);
+	bool avx2 = false;
+	if (info[0] >= 7 && osSavesAvx)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+	return avx2 ? Kernels::AVX2 : sse2 ? Kernels::SSE2 : Kernels::Scalar;
+#elif defined(SOFTWARE_MIXER_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return Kernels::AVX2;
+	}
+	return __builtin_cpu_supports("sse2") ? Kernels::SSE2 : Kernels::Scalar;
+#else
+	return Kernels::Scalar;
+#endif
+}
+
+// Sets the kernels Mix uses (limited to what the CPU supports)
+void SoftwareMixer::SetKernels(Kernels kernels)
+{
+	std::lock_guard<std::recursive_mutex> lock(mMutex);
+	mKernels = std::min(kernels, DetectKernels());
+	switch (mKernels)
+	{
+	case Kernels::AVX2:
+		mMixS16 = MixS16AVX2;
+		mMixF32 = MixF32AVX2;
+		mMixS16Ramp = MixS16RampAVX2;
+		mMixF32Ramp = MixF32RampAVX2;
+		mClip = ClipAVX2;
+		break;
+	case Kernels::SSE2:
+		mMixS16 = MixS16SSE2;
+		mMixF32 = MixF32SSE2;
+		mMixS16Ramp = MixS16RampSSE2;
+		mMixF32Ramp = MixF32RampSSE2;
+		mClip = ClipSSE2;
+		break;
+	default:
+		mMixS16 = MixS16Scalar;
+		mMixF32 = MixF32Scalar;
+		mMixS16Ramp = MixS16RampScalar;
+		mMixF32Ramp = MixF32RampScalar;
+		mClip = ClipScalar;
+		break;
+	}
+}
+
+void SoftwareMixer::MixS16Scalar(float* dest, const int16_t* src, size_t numSamples, float gain)
+{
+	float scale = gain / 32768.0f;
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		dest[i] += static_cast<float>(src[i]) * scale;
+	}
+}
+
+void SoftwareMixer::MixF32Scalar(float* dest, const float* src, size_t numSamples, float gain)
+{
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		dest[i] += src[i] * gain;
+	}
+}
+
+void SoftwareMixer::MixS16RampScalar(float* dest, const int16_t* src, size_t numFrames,
+									 int channels, const float* gains, const float* steps)
+{
+	for (size_t f = 0; f < numFrames; f++)
+	{
+		float frame = static_cast<float>(f);
+		for (int c = 0; c < channels; c++)
+		{
+			float gain = (gains[c] + steps[c] * frame) / 32768.0f;
+			size_t i = f * channels + c;
+			dest[i] += static_cast<float>(src[i]) * gain;
+		}
+	}
+}
+
+void SoftwareMixer::MixF32RampScalar(float* dest, const float* src, size_t numFrames,
+									 int channels, const float* gains, const float* steps)
+{
+	for (size_t f = 0; f < numFrames; f++)
+	{
+		float frame = static_cast<float>(f);
+		for (int c = 0; c < channels; c++)
+		{
+			size_t i = f * channels + c;
+			dest[i] += src[i] * (gains[c] + steps[c] * frame);
+		}
+	}
+}
+
+void SoftwareMixer::ClipScalar(float* samples, size_t numSamples)
+{
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		samples[i] = std::clamp(samples[i], -1.0f, 1.0f);
+	}
+}
+
+#ifdef SOFTWARE_MIXER_X86
+namespace
+{
+	// Sets up a ramp kernel that's width samples wide: each lane's gain,
+	// step, and frame. The gains come from the frame like the scalar
+	// kernels' do, rather than adding up error, and the frames count up as
+	// integers, which is quicker than chaining float adds.
+	struct RampLanes
+	{
+		alignas(32) float mGains[8];
+		alignas(32) float mSteps[8];
+		alignas(32) int32_t mFrames[8];
+
+		RampLanes(int width, int channels, const float* gains, const float* steps, float scale)
+		{
+			// Counted rather than divided, since this runs for every ramping
+			// channel in every block
+			int channel = 0;
+			int frame = 0;
+			for (int i = 0; i < width; i++)
+			{
+				mGains[i] = gains[channel] * scale;
+				mSteps[i] = steps[channel] * scale;
+				mFrames[i] = frame;
+				if (++channel == channels)
+				{
+					channel = 0;
+					frame++;
+				}
+			}
+		}
+	};
+
+	// Gains for the scalar kernel to finish off the frames from firstFrame
+	void RampTail(int channels, const float* gains, const float* steps, size_t firstFrame,
+				  float* tailGains)
+	{
+		for (int c = 0; c < channels; c++)
+		{
+			tailGains[c] = gains[c] + steps[c] * static_cast<float>(firstFrame);
+		}
+	}
+}
+
+TARGET_SSE2 void SoftwareMixer::MixS16SSE2(float* dest, const int16_t* src, size_t numSamples,
+										   float gain)
+{
+	__m128 scale = _mm_set1_ps(gain / 32768.0f);
+	size_t i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		// Sign extend each half to 32 bits by putting it in the top half
+		// and shifting it back down
+		__m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		__m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+		__m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+		__m128 mixedLow = _mm_add_ps(_mm_loadu_ps(dest + i), _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+		__m128 mixedHigh =
+			_mm_add_ps(_mm_loadu_ps(dest + i + 4), _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+		_mm_storeu_ps(dest + i, mixedLow);
+		_mm_storeu_ps(dest + i + 4, mixedHigh);
+	}
+	MixS16Scalar(dest + i, src + i, numSamples - i, gain);
+}
+
+TARGET_SSE2 void SoftwareMixer::MixF32SSE2(float* dest, const float* src, size_t numSamples,
+										   float gain)
+{
+	__m128 scale = _mm_set1_ps(gain);
+	size_t i = 0;
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		__m128 mixed = _mm_add_ps(_mm_loadu_ps(dest + i), _mm_mul_ps(_mm_loadu_ps(src + i), scale));
+		_mm_storeu_ps(dest + i, mixed);
+	}
+	MixF32Scalar(dest + i, src + i, numSamples - i, gain);
+}
+
+TARGET_SSE2 void SoftwareMixer::MixS16RampSSE2(float* dest, const int16_t* src, size_t numFrames,
+											   int channels, const float* gains,
+											   const float* steps)
+{
+	if (4 % channels != 0)
+	{
+		MixS16RampScalar(dest, src, numFrames, channels, gains, steps);
+		return;
+	}
+
+	RampLanes lanes(4, channels, gains, steps, 1.0f / 32768.0f);
+	__m128 gain = _mm_load_ps(lanes.mGains);
+	__m128 step = _mm_load_ps(lanes.mSteps);
+	__m128i frame = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.mFrames));
+	__m128i nextFrame = _mm_set1_epi32(4 / channels);
+	size_t numSamples = numFrames * channels;
+	size_t i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		__m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+		__m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+		__m128 gainLow = _mm_add_ps(gain, _mm_mul_ps(step, _mm_cvtepi32_ps(frame)));
+		frame = _mm_add_epi32(frame, nextFrame);
+		__m128 gainHigh = _mm_add_ps(gain, _mm_mul_ps(step, _mm_cvtepi32_ps(frame)));
+		frame = _mm_add_epi32(frame, nextFrame);
+		__m128 mixedLow =
+			_mm_add_ps(_mm_loadu_ps(dest + i), _mm_mul_ps(_mm_cvtepi32_ps(low), gainLow));
+		__m128 mixedHigh =
+			_mm_add_ps(_mm_loadu_ps(dest + i + 4), _mm_mul_ps(_mm_cvtepi32_ps(high), gainHigh));
+		_mm_storeu_ps(dest + i, mixedLow);
+		_mm_storeu_ps(dest + i + 4, mixedHigh);
+	}
+
+	float tailGains[MAX_OUTPUT_CHANNELS];
+	RampTail(channels, gains, steps, i / channels, tailGains);
+	MixS16RampScalar(dest + i, src + i, numFrames - i / channels, channels, tailGains, steps);
+}
+
+TARGET_SSE2 void SoftwareMixer::MixF32RampSSE2(float* dest, const float* src, size_t numFrames,
+											   int channels, const float* gains,
+											   const float* steps)
+{
+	if (4 % channels != 0)
+	{
+		MixF32RampScalar(dest, src, numFrames, channels, gains, steps);
+		return;
+	}
+
+	RampLanes lanes(4, channels, gains, steps, 1.0f);
+	__m128 gain = _mm_load_ps(lanes.mGains);
+	__m128 step = _mm_load_ps(lanes.mSteps);
+	__m128i frame = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.mFrames));
+	__m128i nextFrame = _mm_set1_epi32(4 / channels);
+	size_t numSamples = numFrames * channels;
+	size_t i = 0;
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		__m128 rampedGain = _mm_add_ps(gain, _mm_mul_ps(step, _mm_cvtepi32_ps(frame)));
+		frame = _mm_add_epi32(frame, nextFrame);
+		__m128 mixed =
+			_mm_add_ps(_mm_loadu_ps(dest + i), _mm_mul_ps(_mm_loadu_ps(src + i), rampedGain));
+		_mm_storeu_ps(dest + i, mixed);
+	}
+
+	float tailGains[MAX_OUTPUT_CHANNELS];
+	RampTail(channels, gains, steps, i / channels, tailGains);
+	MixF32RampScalar(dest + i, src + i, numFrames - i / channels, channels, tailGains, steps);
+}
+
+TARGET_SSE2 void SoftwareMixer::ClipSSE2(float* samples, size_t numSamples)
+{
+	__m128 low = _mm_set1_ps(-1.0f);
+	__m128 high = _mm_set1_ps(1.0f);
+	size_t i = 0;
+	for (; i + 4 <= numSamples; i += 4)
+	{
+		__m128 clipped = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(samples + i), low), high);
+		_mm_storeu_ps(samples + i, clipped);
+	}
+	ClipScalar(samples + i, numSamples - i);
+}
+
+TARGET_AVX2 void SoftwareMixer::MixS16AVX2(float* dest, const int16_t* src, size_t numSamples,
+										   float gain)
+{
+	__m256 scale = _mm256_set1_ps(gain / 32768.0f);
+	size_t i = 0;
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		__m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		__m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+		__m256 lowSamples = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(low));
+		__m256 highSamples = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(high));
+		__m256 mixedLow =
+			_mm256_add_ps(_mm256_loadu_ps(dest + i), _mm256_mul_ps(lowSamples, scale));
+		__m256 mixedHigh =
+			_mm256_add_ps(_mm256_loadu_ps(dest + i + 8), _mm256_mul_ps(highSamples, scale));
+		_mm256_storeu_ps(dest + i, mixedLow);
+		_mm256_storeu_ps(dest + i + 8, mixedHigh);
+	}
+	MixS16Scalar(dest + i, src + i, numSamples - i, gain);
+}
+
+TARGET_AVX2 void SoftwareMixer::MixF32AVX2(float* dest, const float* src, size_t numSamples,
+										   float gain)
+{
+	__m256 scale = _mm256_set1_ps(gain);
+	size_t i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m256 mixed =
+			_mm256_add_ps(_mm256_loadu_ps(dest + i), _mm256_mul_ps(_mm256_loadu_ps(src + i), scale));
+		_mm256_storeu_ps(dest + i, mixed);
+	}
+	MixF32Scalar(dest + i, src + i, numSamples - i, gain);
+}
+
+TARGET_AVX2 void SoftwareMixer::MixS16RampAVX2(float* dest, const int16_t* src, size_t numFrames,
+											   int channels, const float* gains,
+											   const float* steps)
+{
+	if (8 % channels != 0)
+	{
+		MixS16RampScalar(dest, src, numFrames, channels, gains, steps);
+		return;
+	}
+
+	RampLanes lanes(8, channels, gains, steps, 1.0f / 32768.0f);
+	__m256 gain = _mm256_load_ps(lanes.mGains);
+	__m256 step = _mm256_load_ps(lanes.mSteps);
+	__m256i frame = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.mFrames));
+	__m256i nextFrame = _mm256_set1_epi32(8 / channels);
+	size_t numSamples = numFrames * channels;
+	size_t i = 0;
+	for (; i + 16 <= numSamples; i += 16)
+	{
+		__m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		__m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+		__m256 lowSamples = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(low));
+		__m256 highSamples = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(high));
+		__m256 gainLow = _mm256_add_ps(gain, _mm256_mul_ps(step, _mm256_cvtepi32_ps(frame)));
+		frame = _mm256_add_epi32(frame, nextFrame);
+		__m256 gainHigh = _mm256_add_ps(gain, _mm256_mul_ps(step, _mm256_cvtepi32_ps(frame)));
+		frame = _mm256_add_epi32(frame, nextFrame);
+		__m256 mixedLow =
+			_mm256_add_ps(_mm256_loadu_ps(dest + i), _mm256_mul_ps(lowSamples, gainLow));
+		__m256 mixedHigh =
+			_mm256_add_ps(_mm256_loadu_ps(dest + i + 8), _mm256_mul_ps(highSamples, gainHigh));
+		_mm256_storeu_ps(dest + i, mixedLow);
+		_mm256_storeu_ps(dest + i + 8, mixedHigh);
+	}
+
+	float tailGains[MAX_OUTPUT_CHANNELS];
+	RampTail(channels, gains, steps, i / channels, tailGains);
+	MixS16RampScalar(dest + i, src + i, numFrames - i / channels, channels, tailGains, steps);
+}
+
+TARGET_AVX2 void SoftwareMixer::MixF32RampAVX2(float* dest, const float* src, size_t numFrames,
+											   int channels, const float* gains,
+											   const float* steps)
+{
+	if (8 % channels != 0)
+	{
+		MixF32RampScalar(dest, src, numFrames, channels, gains, steps);
+		return;
+	}
+
+	RampLanes lanes(8, channels, gains, steps, 1.0f);
+	__m256 gain = _mm256_load_ps(lanes.mGains);
+	__m256 step = _mm256_load_ps(lanes.mSteps);
+	__m256i frame = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.mFrames));
+	__m256i nextFrame = _mm256_set1_epi32(8 / channels);
+	size_t numSamples = numFrames * channels;
+	size_t i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m256 rampedGain = _mm256_add_ps(gain, _mm256_mul_ps(step, _mm256_cvtepi32_ps(frame)));
+		frame = _mm256_add_epi32(frame, nextFrame);
+		__m256 mixed = _mm256_add_ps(_mm256_loadu_ps(dest + i),
+									 _mm256_mul_ps(_mm256_loadu_ps(src + i), rampedGain));
+		_mm256_storeu_ps(dest + i, mixed);
+	}
+
+	float tailGains[MAX_OUTPUT_CHANNELS];
+	RampTail(channels, gains, steps, i / channels, tailGains);
+	MixF32RampScalar(dest + i, src + i, numFrames - i / channels, channels, tailGains, steps);
+}
+
+TARGET_AVX2 void SoftwareMixer::ClipAVX2(float* samples, size_t numSamples)
+{
+	__m256 low = _mm256_set1_ps(-1.0f);
+	__m256 high = _mm256_set1_ps(1.0f);
+	size_t i = 0;
+	for (; i + 8 <= numSamples; i += 8)
+	{
+		__m256 clipped = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(samples + i), low), high);
+		_mm256_storeu_ps(samples + i, clipped);
+	}
+	ClipScalar(samples + i, numSamples - i);
+}
+#else
+// Other CPUs only have the scalar kernels (DetectKernels never picks these)
+void SoftwareMixer::MixS16SSE2(float* dest, const int16_t* src, size_t numSamples, float gain)
+{
+	MixS16Scalar(dest, src, numSamples, gain);
+}
+
+void SoftwareMixer::MixF32SSE2(float* dest, const float* src, size_t numSamples, float gain)
+{
+	MixF32Scalar(dest, src, numSamples, gain);
+}
+
+void SoftwareMixer::ClipSSE2(float* samples, size_t numSamples)
+{
+	ClipScalar(samples, numSamples);
+}
+
+void SoftwareMixer::MixS16AVX2(float* dest, const int16_t* src, size_t numSamples, float gain)
+{
+	MixS16Scalar(dest, src, numSamples, gain);
+}
+
+void SoftwareMixer::MixF32AVX2(float* dest, const float* src, size_t numSamples, float gain)
+{
+	MixF32Scalar(dest, src, numSamples, gain);
+}
+
+void SoftwareMixer::ClipAVX2(float* samples, size_t numSamples)
+{
+	ClipScalar(samples, numSamples);
+}
+
+void SoftwareMixer::MixS16RampSSE2(float* dest, const int16_t* src, size_t numFrames,
+								   int channels, const float* gains, const float* steps)
+{
+	MixS16RampScalar(dest, src, numFrames, channels, gains, steps);
+}
+
+void SoftwareMixer::MixF32RampSSE2(float* dest, const float* src, size_t numFrames, int channels,
+								   const float* gains, const float* steps)
+{
+	MixF32RampScalar(dest, src, numFrames, channels, gains, steps);
+}
+
+void SoftwareMixer::MixS16RampAVX2(float* dest, const int16_t* src, size_t numFrames,
+								   int channels, const float* gains, const float* steps)
+{
+	MixS16RampScalar(dest, src, numFrames, channels, gains, steps);
+}
+
+void SoftwareMixer::MixF32RampAVX2(float* dest, const float* src, size_t numFrames, int channels,
+								   const float* gains, const float* steps)
+{
+	MixF32RampScalar(dest, src, numFrames, channels, gains, steps);
+}
+#endif
@@ -0,0 +1,174 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "SDL3_mixer/SDL_mixer.h"
+
+// Mixes Mix_Chunks on channels in process, with the same channel model as
+// SDL_mixer (play, halt, pause, resume, volume, effects and the channel
+// finished callback), so AudioSystem can use it in place of SDL_mixer's mixer.
+// Chunks have to be in the output format, which can be S16 or F32 with up
+// to MAX_OUTPUT_CHANNELS channels. The mix is interleaved float samples,
+// clipped to [-1, 1].
+class SoftwareMixer
+{
+public:
+	// Sets of kernels Mix can sum, scale and clip samples with
+	enum class Kernels
+	{
+		Scalar,
+		SSE2,
+		AVX2
+	};
+
+	static constexpr int MAX_OUTPUT_CHANNELS = 8;
+
+	SoftwareMixer(int numChannels, int frequency, SDL_AudioFormat format, int outputChannels);
+
+	// Returns true if the mixer can mix chunks in this format
+	static bool IsFormatSupported(SDL_AudioFormat format, int outputChannels);
+
+	// Same as Mix_PlayChannel, Mix_HaltChannel, Mix_Pause, Mix_Resume,
+	// Mix_Playing and Mix_ChannelFinished
+	void PlayChannel(int channel, Mix_Chunk* chunk, int loops);
+	void HaltChannel(int channel);
+	void Pause(int channel);
+	void Resume(int channel);
+	bool IsPlaying(int channel) const;
+	void SetChannelFinished(void (*channelFinished)(int));
+
+	// Same as Mix_RegisterEffect and Mix_UnregisterAllEffects. Effects run
+	// in Mix, in the order they were registered, on a copy of each piece of
+	// the chunk before it's mixed. A channel's effects are unregistered
+	// when it finishes.
+	void RegisterEffect(int channel, Mix_EffectFunc_t effect, Mix_EffectDone_t done,
+						void* userData);
+	void UnregisterAllEffects(int channel);
+
+	// Sets the channel's volume (0 to MIX_MAX_VOLUME) or pan (-1 for only
+	// the left speaker, to 1 for only the right), ramping the gains there
+	// linearly over rampFrames frames so they don't click. Setting either
+	// with no ramp also ends any ramp that's still going. Pan only changes
+	// stereo output.
+	void SetVolume(int channel, int volume, size_t rampFrames = 0);
+	void SetPan(int channel, float pan, size_t rampFrames = 0);
+
+	// Mixes the next numFrames of every playing channel into output, which
+	// needs room for numFrames * GetOutputChannels() floats. A channel that
+	// finishes calls the channel finished callback, which can start it
+	// again to carry on in the same block.
+	void Mix(float* output, size_t numFrames);
+
+	// Returns the best kernels this CPU supports
+	static Kernels DetectKernels();
+
+	// Kernels Mix uses (DetectKernels's by default). Asking for kernels the
+	// CPU doesn't support uses the best ones it does.
+	Kernels GetKernels() const { return mKernels; }
+	void SetKernels(Kernels kernels);
+
+	int GetFrequency() const { return mFrequency; }
+	int GetOutputChannels() const { return mOutputChannels; }
+
+private:
+	struct Effect
+	{
+		Mix_EffectFunc_t mFunc = nullptr;
+		Mix_EffectDone_t mDone = nullptr;
+		void* mUserData = nullptr;
+	};
+
+	struct Channel
+	{
+		Mix_Chunk* mChunk = nullptr;
+		// Bytes into mChunk
+		Uint32 mPosition = 0;
+		// Times left to repeat the chunk (-1 for forever)
+		int mLoops = 0;
+		int mVolume = MIX_MAX_VOLUME;
+		float mPan = 0.0f;
+		bool mPlaying = false;
+		bool mPaused = false;
+		// Gain of each output channel now, how much it changes each frame,
+		// and for how many more frames
+		std::array<float, MAX_OUTPUT_CHANNELS> mGains{};
+		std::array<float, MAX_OUTPUT_CHANNELS> mSteps{};
+		size_t mRampFrames = 0;
+		std::vector<Effect> mEffects;
+	};
+
+	// Mixes the channel into output until numFrames are done or it stops
+	void MixChannel(int channel, float* output, size_t numFrames);
+
+	// Mixes numFrames of the chunk's samples at src into output, at the
+	// channel's gains
+	void MixFrames(const Channel& info, const Mix_Chunk& chunk, const Uint8* src,
+				   float* output, size_t numFrames);
+
+	// Ramps the channel's gains from where they are to its volume and pan
+	// over rampFrames frames
+	void StartRamp(Channel& info, size_t rampFrames);
+
+	// Gains of each output channel for the channel's volume and pan
+	std::array<float, MAX_OUTPUT_CHANNELS> GetTargetGains(const Channel& info) const;
+
+	// Stops the channel, unregisters its effects and calls the channel
+	// finished callback
+	void FinishChannel(int channel);
+
+	// Adds src * gain to dest, for numSamples samples (16-bit samples are
+	// scaled to [-1, 1] too)
+	static void MixS16Scalar(float* dest, const int16_t* src, size_t numSamples, float gain);
+	static void MixS16SSE2(float* dest, const int16_t* src, size_t numSamples, float gain);
+	static void MixS16AVX2(float* dest, const int16_t* src, size_t numSamples, float gain);
+	static void MixF32Scalar(float* dest, const float* src, size_t numSamples, float gain);
+	static void MixF32SSE2(float* dest, const float* src, size_t numSamples, float gain);
+	static void MixF32AVX2(float* dest, const float* src, size_t numSamples, float gain);
+
+	// Adds src * gain to dest, for numFrames frames of channels samples,
+	// where the gain of channel c in frame f is gains[c] + steps[c] * f.
+	// The SIMD ones fall back to scalar if channels doesn't divide their
+	// width.
+	static void MixS16RampScalar(float* dest, const int16_t* src, size_t numFrames, int channels,
+								 const float* gains, const float* steps);
+	static void MixS16RampSSE2(float* dest, const int16_t* src, size_t numFrames, int channels,
+							   const float* gains, const float* steps);
+	static void MixS16RampAVX2(float* dest, const int16_t* src, size_t numFrames, int channels,
+							   const float* gains, const float* steps);
+	static void MixF32RampScalar(float* dest, const float* src, size_t numFrames, int channels,
+								 const float* gains, const float* steps);
+	static void MixF32RampSSE2(float* dest, const float* src, size_t numFrames, int channels,
+							   const float* gains, const float* steps);
+	static void MixF32RampAVX2(float* dest, const float* src, size_t numFrames, int channels,
+							   const float* gains, const float* steps);
+
+	// Clamps the samples to [-1, 1]
+	static void ClipScalar(float* samples, size_t numSamples);
+	static void ClipSSE2(float* samples, size_t numSamples);
+	static void ClipAVX2(float* samples, size_t numSamples);
+
+	std::vector<Channel> mChannels;
+	int mFrequency = 0;
+	int mOutputChannels = 0;
+	bool mIsFloat = false;
+	int mFrameSize = 0;
+	void (*mChannelFinished)(int) = nullptr;
+	// What the effects of the channel being mixed change
+	std::vector<Uint8> mEffectBuffer;
+
+	// The chosen kernels
+	Kernels mKernels = Kernels::Scalar;
+	void (*mMixS16)(float*, const int16_t*, size_t, float) = MixS16Scalar;
+	void (*mMixF32)(float*, const float*, size_t, float) = MixF32Scalar;
+	void (*mMixS16Ramp)(float*, const int16_t*, size_t, int, const float*, const float*) =
+		MixS16RampScalar;
+	void (*mMixF32Ramp)(float*, const float*, size_t, int, const float*, const float*) =
+		MixF32RampScalar;
+	void (*mClip)(float*, size_t) = ClipScalar;
+
+	// Like SDL_mixer's audio lock. It's recursive since the channel
+	// finished callback can play the channel again from inside Mix.
+	mutable std::recursive_mutex mMutex;
+};
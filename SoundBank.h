@@ -0,0 +1,133 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A sound bank is a single file of sounds that are already decoded to the
+// mixer's output format, so AudioSystem can map it and play the sounds
+// straight from the mapping.
+//
+// File layout:
+//   Header
+//   Entry[mNumSounds], sorted by name hash (then name)
+//   Names (not null-terminated)
+//   PCM data for each sound, starting on a multiple of ALIGNMENT
+namespace SoundBank
+{
+	inline constexpr char MAGIC[4] = {'S', 'B', 'N', 'K'};
+	inline constexpr uint32_t VERSION = 2;
+	// Sample data starts on a multiple of this from the start of the file
+	inline constexpr uint32_t ALIGNMENT = 64;
+
+	struct Header
+	{
+		char mMagic[4] = {MAGIC[0], MAGIC[1], MAGIC[2], MAGIC[3]};
+		uint32_t mVersion = VERSION;
+		uint32_t mNumSounds = 0;
+		// Format of all the PCM data (as reported by Mix_QuerySpec)
+		uint32_t mFrequency = 0;
+		uint16_t mFormat = 0;
+		uint16_t mChannels = 0;
+		uint32_t mReserved = 0;
+	};
+
+	struct Entry
+	{
+		// Offsets are from the start of the file
+		uint64_t mDataOffset = 0;
+		uint32_t mDataLength = 0;
+		uint32_t mNameOffset = 0;
+		uint32_t mNameLength = 0;
+		// HashName of the name, so lookups mostly compare integers
+		uint32_t mNameHash = 0;
+	};
+
+	static_assert(sizeof(Header) == 24 && sizeof(Entry) == 24);
+
+	// 32-bit FNV-1a hash of a sound's name
+	constexpr uint32_t HashName(std::string_view name)
+	{
+		uint32_t hash = 2166136261u;
+		for (char c : name)
+		{
+			hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+		}
+		return hash;
+	}
+
+	// Order of entries in the index
+	inline bool EntryLess(uint32_t hashA, std::string_view nameA, uint32_t hashB,
+						  std::string_view nameB)
+	{
+		return hashA != hashB ? hashA < hashB : nameA < nameB;
+	}
+
+	// A sound to write to a bank, with its name relative to Assets/Sounds
+	struct Sound
+	{
+		std::string mName;
+		std::vector<uint8_t> mData;
+	};
+
+	// Writes the sounds (which must already be in the format given) to a
+	// bank file. Returns false if the file couldn't be written.
+	inline bool Write(const std::string& path, std::span<const Sound> sounds, uint32_t frequency,
+					  uint16_t format, uint16_t channels)
+	{
+		std::vector<const Sound*> sorted;
+		for (const Sound& sound : sounds)
+		{
+			sorted.emplace_back(&sound);
+		}
+		std::sort(sorted.begin(), sorted.end(), [](const Sound* a, const Sound* b) {
+			return EntryLess(HashName(a->mName), a->mName, HashName(b->mName), b->mName);
+		});
+
+		Header header;
+		header.mNumSounds = static_cast<uint32_t>(sorted.size());
+		header.mFrequency = frequency;
+		header.mFormat = format;
+		header.mChannels = channels;
+
+		// Lay out the names after the entries, then the aligned data
+		std::vector<Entry> entries(sorted.size());
+		uint64_t offset = sizeof(Header) + sizeof(Entry) * entries.size();
+		for (size_t i = 0; i < sorted.size(); i++)
+		{
+			entries[i].mNameOffset = static_cast<uint32_t>(offset);
+			entries[i].mNameLength = static_cast<uint32_t>(sorted[i]->mName.size());
+			entries[i].mNameHash = HashName(sorted[i]->mName);
+			offset += sorted[i]->mName.size();
+		}
+		for (size_t i = 0; i < sorted.size(); i++)
+		{
+			offset = (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+			entries[i].mDataOffset = offset;
+			entries[i].mDataLength = static_cast<uint32_t>(sorted[i]->mData.size());
+			offset += sorted[i]->mData.size();
+		}
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(entries.data()),
+				   static_cast<std::streamsize>(sizeof(Entry) * entries.size()));
+		for (const Sound* sound : sorted)
+		{
+			file.write(sound->mName.data(), static_cast<std::streamsize>(sound->mName.size()));
+		}
+		for (size_t i = 0; i < sorted.size(); i++)
+		{
+			static constexpr char padding[ALIGNMENT] = {};
+			uint64_t pos = static_cast<uint64_t>(file.tellp());
+			file.write(padding, static_cast<std::streamsize>(entries[i].mDataOffset - pos));
+			file.write(reinterpret_cast<const char*>(sorted[i]->mData.data()),
+					   static_cast<std::streamsize>(sorted[i]->mData.size()));
+		}
+		return static_cast<bool>(file);
+	}
+}
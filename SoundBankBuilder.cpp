@@ -0,0 +1,106 @@
+// Offline tool that packs every sound in Assets/Sounds into a sound bank
+// (see SoundBank.h) that AudioSystem::OpenSoundBank can map.
+//
+// Usage: soundbank <sounds dir> <bank path> [frequency] [s16|f32|u8] [channels]
+// The format defaults to 44100 Hz, s16, stereo, which is what SDL_mixer
+// opens the device with, and must match Mix_QuerySpec at runtime.
+//
+// The sounds are decoded by SDL_mixer (so the tool links the real SDL3 and
+// SDL3_mixer, not the mocks next to this file), opened on the dummy audio
+// driver in the bank's format so Mix_LoadWAV converts them to it. The
+// building itself is in SoundBankBuilder.h.
+#include "SoundBankBuilder.h"
+#include <SDL3/SDL.h>
+#include <SDL3_mixer/SDL_mixer.h>
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+int main(int argc, char* argv[])
+{
+	using namespace SoundBankBuilder;
+	if (argc < 3)
+	{
+		std::fprintf(stderr,
+					 "Usage: %s <sounds dir> <bank path> [frequency] [s16|f32|u8] [channels]\n",
+					 argv[0]);
+		return 1;
+	}
+
+	std::filesystem::path soundsDir = argv[1];
+	std::string bankPath = argv[2];
+	OutputFormat format;
+	if (argc > 3)
+	{
+		format.mFrequency = static_cast<uint32_t>(std::stoul(argv[3]));
+	}
+	if (argc > 4)
+	{
+		std::string formatName = argv[4];
+		format.mFormat = formatName == "f32"  ? FORMAT_F32
+						 : formatName == "u8" ? FORMAT_U8
+											  : FORMAT_S16;
+	}
+	if (argc > 5)
+	{
+		format.mChannels = static_cast<uint16_t>(std::stoul(argv[5]));
+	}
+
+	// Nothing is played, so no real device is needed
+	SDL_SetHint(SDL_HINT_AUDIO_DRIVER, "dummy");
+	SDL_AudioSpec spec{};
+	spec.format = static_cast<SDL_AudioFormat>(format.mFormat);
+	spec.channels = format.mChannels;
+	spec.freq = static_cast<int>(format.mFrequency);
+	if (!SDL_Init(SDL_INIT_AUDIO) || !Mix_OpenAudio(0, &spec))
+	{
+		std::fprintf(stderr, "soundbank: couldn't open SDL_mixer: %s\n", SDL_GetError());
+		return 1;
+	}
+
+	// Mix_LoadWAV converts to the device's format, which has to be the bank's
+	int frequency = 0;
+	SDL_AudioFormat mixFormat = SDL_AUDIO_UNKNOWN;
+	int channels = 0;
+	if (!Mix_QuerySpec(&frequency, &mixFormat, &channels) ||
+		frequency != static_cast<int>(format.mFrequency) || mixFormat != spec.format ||
+		channels != format.mChannels)
+	{
+		std::fprintf(stderr, "soundbank: SDL_mixer didn't open in the bank's format\n");
+		Mix_CloseAudio();
+		SDL_Quit();
+		return 1;
+	}
+
+	auto decode = [](const std::filesystem::path& path, std::vector<uint8_t>& pcm) {
+		Mix_Chunk* chunk = Mix_LoadWAV(path.string().c_str());
+		if (chunk == nullptr)
+		{
+			return false;
+		}
+		pcm.assign(chunk->abuf, chunk->abuf + chunk->alen);
+		Mix_FreeChunk(chunk);
+		return true;
+	};
+
+	auto startTime = std::chrono::steady_clock::now();
+	BuildResult result;
+	bool built = Build(soundsDir, bankPath, format, decode, result);
+	Mix_CloseAudio();
+	SDL_Quit();
+	for (const std::string& error : result.mErrors)
+	{
+		std::fprintf(stderr, "soundbank: %s\n", error.c_str());
+	}
+	if (!built)
+	{
+		return 1;
+	}
+
+	double seconds =
+		std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	std::printf("soundbank: %zu sounds (%zu encoded, %zu reused) -> %s in %.3fs%s\n",
+				result.mNumSounds, result.mNumEncoded, result.mNumSounds - result.mNumEncoded,
+				bankPath.c_str(), seconds, result.mUpToDate ? " (up to date)" : "");
+	return result.mFailed ? 1 : 0;
+}
@@ -0,0 +1,262 @@
+#pragma once
+#include "SoundBank.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <unordered_map>
+
+// Packs every sound in a folder into a sound bank (see SoundBank.h) that
+// AudioSystem::OpenSoundBank can map. Used by the soundbank tool.
+//
+// Sounds are decoded and converted to the bank's format by a DecodeFunc
+// (SDL_mixer's Mix_LoadWAV in the tool, opened in the bank's format), so
+// the game never has to decode them. Rebuilds are incremental:
+// <bank path>.index records the size, timestamp and content hash of each
+// source file, and sounds whose file hasn't changed are copied from the old
+// bank instead of decoded again.
+namespace SoundBankBuilder
+{
+	// Same values as SDL_AudioFormat
+	inline constexpr uint16_t FORMAT_U8 = 0x0008;
+	inline constexpr uint16_t FORMAT_S16 = 0x8010;
+	inline constexpr uint16_t FORMAT_F32 = 0x8120;
+
+	// Format the bank's sounds are converted to
+	struct OutputFormat
+	{
+		uint32_t mFrequency = 44100;
+		uint16_t mFormat = FORMAT_S16;
+		uint16_t mChannels = 2;
+	};
+
+	// What the index recorded about a source file last build
+	struct SourceRecord
+	{
+		uint64_t mSize = 0;
+		int64_t mTime = 0;
+		uint64_t mHash = 0;
+	};
+
+	// What a Build did
+	struct BuildResult
+	{
+		size_t mNumSounds = 0;
+		// Sounds decoded and converted, rather than copied from the old bank
+		size_t mNumEncoded = 0;
+		// Whether the old bank was left as it was
+		bool mUpToDate = false;
+		// Whether any sound couldn't be decoded (and was left out)
+		bool mFailed = false;
+		// What went wrong, for the caller to report
+		std::vector<std::string> mErrors;
+	};
+
+	// Decodes the sound file into PCM in the bank's format. Returns false if
+	// it can't.
+	using DecodeFunc =
+		std::function<bool(const std::filesystem::path& path, std::vector<uint8_t>& pcm)>;
+
+	inline std::vector<uint8_t> ReadFile(const std::filesystem::path& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), {});
+	}
+
+	// 64-bit FNV-1a hash of a file's contents
+	inline uint64_t HashContents(const std::vector<uint8_t>& data)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (uint8_t byte : data)
+		{
+			hash = (hash ^ byte) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	// Reads the records the last build left in the index file. Returns an
+	// empty map if the index is missing or was for a different format.
+	inline std::unordered_map<std::string, SourceRecord> ReadIndex(const std::string& path,
+																   const std::string& formatLine)
+	{
+		std::unordered_map<std::string, SourceRecord> records;
+		std::ifstream file(path);
+		std::string line;
+		if (!std::getline(file, line) || line != formatLine)
+		{
+			return records;
+		}
+		while (std::getline(file, line))
+		{
+			std::istringstream stream(line);
+			SourceRecord record;
+			std::string name;
+			if (stream >> record.mSize >> record.mTime >> record.mHash && stream.get() == '\t' &&
+				std::getline(stream, name))
+			{
+				records[name] = record;
+			}
+		}
+		return records;
+	}
+
+	// Returns the sounds in an existing bank by name (empty if the bank
+	// doesn't exist or isn't in this format)
+	inline std::unordered_map<std::string, std::vector<uint8_t>> ReadBank(
+		const std::string& path, const OutputFormat& format)
+	{
+		std::unordered_map<std::string, std::vector<uint8_t>> sounds;
+		std::vector<uint8_t> bank = ReadFile(path);
+		SoundBank::Header header;
+		if (bank.size() < sizeof(header))
+		{
+			return sounds;
+		}
+		std::memcpy(&header, bank.data(), sizeof(header));
+		if (std::memcmp(header.mMagic, SoundBank::MAGIC, 4) != 0 ||
+			header.mVersion != SoundBank::VERSION || header.mFrequency != format.mFrequency ||
+			header.mFormat != format.mFormat || header.mChannels != format.mChannels ||
+			header.mNumSounds > (bank.size() - sizeof(header)) / sizeof(SoundBank::Entry))
+		{
+			return sounds;
+		}
+
+		for (uint32_t i = 0; i < header.mNumSounds; i++)
+		{
+			SoundBank::Entry entry;
+			std::memcpy(&entry, bank.data() + sizeof(header) + i * sizeof(entry), sizeof(entry));
+			if (entry.mNameOffset + static_cast<uint64_t>(entry.mNameLength) <= bank.size() &&
+				entry.mDataOffset + entry.mDataLength <= bank.size())
+			{
+				std::string name(reinterpret_cast<const char*>(bank.data() + entry.mNameOffset),
+								 entry.mNameLength);
+				const uint8_t* data = bank.data() + entry.mDataOffset;
+				sounds[name].assign(data, data + entry.mDataLength);
+			}
+		}
+		return sounds;
+	}
+
+	inline int64_t GetFileTime(const std::filesystem::path& path)
+	{
+		std::error_code ec{};
+		return std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+	}
+
+	// Builds the bank at bankPath from the .wav and .ogg files in soundsDir,
+	// reusing what it can from the bank already there. Sounds that can't be
+	// decoded are left out (and listed in the result's errors). Returns false
+	// if the folder can't be read or the bank can't be written.
+	inline bool Build(const std::filesystem::path& soundsDir, const std::string& bankPath,
+					  const OutputFormat& format, const DecodeFunc& decode, BuildResult& result)
+	{
+		result = BuildResult();
+		std::string indexPath = bankPath + ".index";
+
+		// Scan the directory the same way AudioSystem::CacheAllSounds does
+		std::vector<std::filesystem::path> files;
+		std::error_code ec{};
+		for (const auto& rootDirEntry : std::filesystem::directory_iterator{soundsDir, ec})
+		{
+			std::string extension = rootDirEntry.path().extension().string();
+			if (extension == ".ogg" || extension == ".wav")
+			{
+				files.emplace_back(rootDirEntry.path());
+			}
+		}
+		if (ec)
+		{
+			result.mErrors.emplace_back("couldn't read " + soundsDir.string());
+			return false;
+		}
+
+		std::string formatLine = "soundbank " + std::to_string(SoundBank::VERSION) + " " +
+								 std::to_string(format.mFrequency) + " " +
+								 std::to_string(format.mFormat) + " " +
+								 std::to_string(format.mChannels);
+		std::unordered_map<std::string, SourceRecord> oldRecords = ReadIndex(indexPath, formatLine);
+		std::unordered_map<std::string, std::vector<uint8_t>> oldSounds;
+		if (!oldRecords.empty())
+		{
+			oldSounds = ReadBank(bankPath, format);
+		}
+
+		std::vector<SoundBank::Sound> sounds;
+		std::unordered_map<std::string, SourceRecord> records;
+		for (const std::filesystem::path& path : files)
+		{
+			std::string name = path.filename().string();
+			SourceRecord record;
+			record.mSize = std::filesystem::file_size(path, ec);
+			record.mTime = GetFileTime(path);
+
+			// Reuse the sound from the old bank if the file is unchanged, going
+			// by its timestamp or (if that changed) its contents
+			auto oldRecord = oldRecords.find(name);
+			auto oldSound = oldSounds.find(name);
+			bool haveOld = oldRecord != oldRecords.end() && oldSound != oldSounds.end() &&
+						   oldRecord->second.mSize == record.mSize;
+			if (haveOld && oldRecord->second.mTime == record.mTime)
+			{
+				record.mHash = oldRecord->second.mHash;
+				sounds.push_back({name, std::move(oldSound->second)});
+				records[name] = record;
+				continue;
+			}
+
+			std::vector<uint8_t> contents = ReadFile(path);
+			record.mHash = HashContents(contents);
+			if (haveOld && oldRecord->second.mHash == record.mHash)
+			{
+				sounds.push_back({name, std::move(oldSound->second)});
+				records[name] = record;
+				continue;
+			}
+
+			std::vector<uint8_t> pcm;
+			if (!decode(path, pcm))
+			{
+				result.mErrors.emplace_back("couldn't decode " + name);
+				result.mFailed = true;
+				continue;
+			}
+			sounds.push_back({name, std::move(pcm)});
+			records[name] = record;
+			result.mNumEncoded++;
+		}
+		result.mNumSounds = sounds.size();
+
+		// Nothing to do if every sound came from the old bank and none were
+		// removed
+		result.mUpToDate = result.mNumEncoded == 0 && sounds.size() == oldSounds.size() &&
+						   std::filesystem::exists(bankPath);
+		if (!result.mUpToDate)
+		{
+			// Write to a temporary file first so a failed build doesn't leave a
+			// half-written bank behind
+			std::string tempPath = bankPath + ".tmp";
+			if (!SoundBank::Write(tempPath, sounds, format.mFrequency, format.mFormat,
+								  format.mChannels))
+			{
+				result.mErrors.emplace_back("couldn't write " + bankPath);
+				return false;
+			}
+			std::filesystem::rename(tempPath, bankPath, ec);
+			if (ec)
+			{
+				result.mErrors.emplace_back("couldn't replace " + bankPath);
+				return false;
+			}
+		}
+
+		std::ofstream index(indexPath, std::ios::trunc);
+		index << formatLine << '\n';
+		for (const auto& [name, record] : records)
+		{
+			index << record.mSize << ' ' << record.mTime << ' ' << record.mHash << '\t' << name
+				  << '\n';
+		}
+		return true;
+	}
+}
@@ -0,0 +1,62 @@
+# Generates SoundManifest.h, which lists every sound in Assets/Sounds so
+# AudioSystem can register and preload them without walking the directory.
+#
+# Included from CMakeLists.txt with SOUNDS_DIR and SOUND_MANIFEST set, or run
+# directly with:
+#   cmake -DSOUNDS_DIR=<dir> -DSOUND_MANIFEST=<header> -P GenerateSoundManifest.cmake
+
+# Same files CacheAllSounds picks up. When included, CONFIGURE_DEPENDS reruns
+# this when sounds are added or removed (it isn't allowed in script mode).
+set(SOUND_MANIFEST_GLOB_FLAGS CONFIGURE_DEPENDS)
+if(CMAKE_SCRIPT_MODE_FILE)
+	set(SOUND_MANIFEST_GLOB_FLAGS "")
+endif()
+file(GLOB SOUND_MANIFEST_FILES ${SOUND_MANIFEST_GLOB_FLAGS} RELATIVE "${SOUNDS_DIR}"
+	"${SOUNDS_DIR}/*.wav" "${SOUNDS_DIR}/*.ogg")
+list(SORT SOUND_MANIFEST_FILES)
+list(LENGTH SOUND_MANIFEST_FILES SOUND_MANIFEST_COUNT)
+
+set(SOUND_MANIFEST_ENUM "")
+set(SOUND_MANIFEST_NAMES "")
+set(SOUND_MANIFEST_IDENTIFIERS "")
+foreach(SOUND_FILE IN LISTS SOUND_MANIFEST_FILES)
+	# Names that only differ in characters an identifier can't have (like
+	# "Hit-1.wav" and "Hit_1.wav") would give the enum the same value twice
+	string(MAKE_C_IDENTIFIER "${SOUND_FILE}" SOUND_ENUM_NAME)
+	list(FIND SOUND_MANIFEST_IDENTIFIERS "${SOUND_ENUM_NAME}" SOUND_ENUM_INDEX)
+	if(NOT SOUND_ENUM_INDEX EQUAL -1)
+		list(GET SOUND_MANIFEST_FILES ${SOUND_ENUM_INDEX} SOUND_ENUM_OTHER)
+		message(FATAL_ERROR "Sounds ${SOUND_ENUM_OTHER} and ${SOUND_FILE} in ${SOUNDS_DIR} "
+			"both become SoundManifest::${SOUND_ENUM_NAME}. Rename one of them.")
+	endif()
+	list(APPEND SOUND_MANIFEST_IDENTIFIERS "${SOUND_ENUM_NAME}")
+	string(APPEND SOUND_MANIFEST_ENUM "\t\t${SOUND_ENUM_NAME},\n")
+	string(APPEND SOUND_MANIFEST_NAMES "\t\t\"${SOUND_FILE}\",\n")
+endforeach()
+
+set(SOUND_MANIFEST_CONTENT "// Generated by cmake/GenerateSoundManifest.cmake from Assets/Sounds
+// Do not edit. To change it, add or remove files in Assets/Sounds.
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+namespace SoundManifest
+{
+	// Index of each sound, which is also its SoundId in AudioSystem
+	// For example, SoundId(SoundManifest::ChompLoop_wav)
+	enum Sound : uint32_t
+	{
+${SOUND_MANIFEST_ENUM}\t\tCount
+	};
+
+	// Sound names (without \"Assets/Sounds/\"), in Sound order
+	inline constexpr std::array<std::string_view, ${SOUND_MANIFEST_COUNT}> Names = {
+${SOUND_MANIFEST_NAMES}\t};
+}
+")
+
+# Only touch the header if it changed, so unchanged sounds don't cause a rebuild
+file(WRITE "${SOUND_MANIFEST}.tmp" "${SOUND_MANIFEST_CONTENT}")
+file(COPY_FILE "${SOUND_MANIFEST}.tmp" "${SOUND_MANIFEST}" ONLY_IF_DIFFERENT)
+file(REMOVE "${SOUND_MANIFEST}.tmp")
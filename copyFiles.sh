@@ -1,3 +1,7 @@
 #!/bin/bash
 cp ../Lab05/AudioSystem.h .
 cp ../Lab05/AudioSystem.cpp .
+cp ../Lab05/SoundBank.h .
+cp ../Lab05/ImaAdpcm.h .
+cp ../Lab05/SoftwareMixer.h .
+cp ../Lab05/SoftwareMixer.cpp .